@@ -0,0 +1,27 @@
+// Shared helpers for the bench/ harnesses.
+#ifndef NH_BENCH_H
+#define NH_BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+struct bench_open_how { uint64_t flags, mode, resolve; };
+
+static inline uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline void bench_header(const char *scenario) {
+    printf("# %s\n", scenario);
+    printf("%-28s %-10s %12s %10s\n", "case", "hook", "calls", "ns/call");
+}
+
+static inline void bench_report(const char *label, const char *hook, uint64_t calls, uint64_t ns) {
+    printf("%-28s %-10s %12llu %10.1f\n", label, hook,
+           (unsigned long long)calls, calls ? (double)ns / (double)calls : 0.0);
+}
+
+#endif
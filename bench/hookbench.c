@@ -0,0 +1,255 @@
+// Hook-overhead microbenchmark for libnvidia-hide.
+//
+// Measures ns/call of open, openat, openat2, dlopen and readdir over three
+// path corpora. Run it once without LD_PRELOAD and once per preload
+// configuration (see bench/run.sh); the differences are the cost of the
+// interposition.
+//
+//   tree   - a synthetic node_modules tree (open every file, readdir every dir)
+//   proc   - the /proc and /sys reads Chromium and Node repeat constantly
+//   probe  - the DRM / Vulkan / PCI probe sequence of a GPU process
+//   hidden - paths every configuration denies by name, so with the library
+//            active no syscall is made and ns/call is the decision alone
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+static const char *const g_proc_paths[] = {
+    "/proc/self/status",
+    "/proc/self/stat",
+    "/proc/self/maps",
+    "/proc/meminfo",
+    "/proc/stat",
+    "/proc/self/cgroup",
+    "/sys/devices/system/cpu/online",
+    "/sys/devices/system/cpu/possible",
+    "/sys/fs/cgroup/cpu.max",
+    "/etc/localtime",
+    NULL
+};
+
+static const char *const g_probe_paths[] = {
+    "/dev/dri/card0",
+    "/dev/dri/card1",
+    "/dev/dri/renderD128",
+    "/dev/dri/renderD129",
+    "/dev/nvidiactl",
+    "/dev/nvidia0",
+    "/dev/nvidia-modeset",
+    "/dev/nvidia-uvm",
+    "/sys/bus/pci/devices/0000:00:02.0/config",
+    "/sys/bus/pci/devices/0000:01:00.0/config",
+    "/usr/share/vulkan/icd.d/intel_icd.x86_64.json",
+    "/usr/share/vulkan/icd.d/radeon_icd.x86_64.json",
+    "/usr/share/vulkan/icd.d/nvidia_icd.json",
+    "/usr/share/vulkan/implicit_layer.d/nvidia_layers.json",
+    "/usr/lib/x86_64-linux-gnu/gbm/nvidia-drm_gbm.so",
+    "/usr/lib/x86_64-linux-gnu/libGLX_nvidia.so.0",
+    "/usr/lib/x86_64-linux-gnu/libGLX_mesa.so.0",
+    NULL
+};
+
+static const char *const g_hidden_paths[] = {
+    "/dev/nvidiactl",
+    "/dev/nvidia0",
+    "/dev/nvidia-uvm",
+    "/dev/nvidia-modeset",
+    "/usr/share/vulkan/icd.d/nvidia_icd.json",
+    "/usr/share/vulkan/implicit_layer.d/nvidia_layers.json",
+    "/usr/lib/x86_64-linux-gnu/gbm/nvidia-drm_gbm.so",
+    "/usr/lib/x86_64-linux-gnu/libGLX_nvidia.so.0",
+    "/usr/lib/x86_64-linux-gnu/libnvidia-glcore.so.550.54.14",
+    "/usr/lib/x86_64-linux-gnu/libnvidia-eglcore.so.550.54.14",
+    NULL
+};
+
+static const char *const g_probe_dirs[] = { "/dev", "/dev/dri", "/dev/dri/by-path",
+                                            "/usr/share/vulkan/icd.d", NULL };
+
+static const char *const g_dl_names[] = {
+    "libc.so.6", "libm.so.6", "libdl.so.2", "libpthread.so.0",
+    "libGLX_nvidia.so.0", "libnvidia-glcore.so", "libEGL_mesa.so.0", NULL
+};
+
+struct corpus {
+    char **paths;
+    int n;
+    char **dirs;
+    int ndirs;
+};
+
+static int g_iters = 20;
+
+// small corpora are repeated so every case lands on a comparable call count
+static int reps_for(int n) {
+    return g_iters * (n > 0 && n < 2000 ? 2000 / n : 1);
+}
+
+static void corpus_push(char ***v, int *n, const char *s) {
+    char **nv = realloc(*v, (size_t)(*n + 1) * sizeof(char*));
+    if (!nv || !(nv[*n] = strdup(s))) { perror("hookbench"); exit(1); }
+    *v = nv;
+    (*n)++;
+}
+
+// A node_modules-shaped tree: pkgs x (lib/ + files). Files are created empty.
+static void build_tree(struct corpus *c, const char *root) {
+    static const char *const leaves[] = { "index.js", "package.json", "README.md", "LICENSE",
+                                          "lib/util.js", "lib/main.js", "lib/card.js",
+                                          "nvidia-smi.d.ts", "renderer.js", "dist/bundle.js" };
+    char p[2 * PATH_MAX];
+    mkdir(root, 0755);
+    snprintf(p, sizeof(p), "%s/node_modules", root);
+    mkdir(p, 0755);
+    corpus_push(&c->dirs, &c->ndirs, p);
+    for (int i = 0; i < 200; i++) {
+        char pkg[PATH_MAX];
+        snprintf(pkg, sizeof(pkg), "%s/node_modules/pkg-%03d", root, i);
+        mkdir(pkg, 0755);
+        corpus_push(&c->dirs, &c->ndirs, pkg);
+        snprintf(p, sizeof(p), "%s/lib", pkg);
+        mkdir(p, 0755);
+        corpus_push(&c->dirs, &c->ndirs, p);
+        snprintf(p, sizeof(p), "%s/dist", pkg);
+        mkdir(p, 0755);
+        for (size_t k = 0; k < sizeof(leaves)/sizeof(leaves[0]); k++) {
+            snprintf(p, sizeof(p), "%s/%s", pkg, leaves[k]);
+            int fd = (int)syscall(SYS_openat, AT_FDCWD, p, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+            if (fd >= 0) close(fd);
+            corpus_push(&c->paths, &c->n, p);
+        }
+    }
+}
+
+static void build_list(struct corpus *c, const char *const *paths, const char *const *dirs) {
+    for (int i = 0; paths[i]; i++) corpus_push(&c->paths, &c->n, paths[i]);
+    for (int i = 0; dirs && dirs[i]; i++) corpus_push(&c->dirs, &c->ndirs, dirs[i]);
+}
+
+typedef int (*openat2_f)(int, const char*, const struct bench_open_how*, size_t);
+
+static int do_openat2(int dirfd, const char *path, int flags) {
+    static openat2_f fn;
+    static int looked;
+    if (!looked) { fn = (openat2_f)dlsym(RTLD_DEFAULT, "openat2"); looked = 1; }
+    struct bench_open_how how = { (uint64_t)flags, 0, 0 };
+    if (fn) return fn(dirfd, path, &how, sizeof(how));
+    return (int)syscall(SYS_openat2, dirfd, path, &how, sizeof(how));
+}
+
+static void bench_opens(const char *label, const struct corpus *c) {
+    static const char *const hooks[] = { "open", "openat", "openat2" };
+    for (int h = 0; h < 3; h++) {
+        uint64_t calls = 0, t0 = bench_now_ns();
+        for (int it = 0, reps = reps_for(c->n); it < reps; it++) {
+            for (int i = 0; i < c->n; i++) {
+                int fd;
+                if (h == 0) fd = open(c->paths[i], O_RDONLY | O_CLOEXEC);
+                else if (h == 1) fd = openat(AT_FDCWD, c->paths[i], O_RDONLY | O_CLOEXEC);
+                else fd = do_openat2(AT_FDCWD, c->paths[i], O_RDONLY | O_CLOEXEC);
+                if (fd >= 0) close(fd);
+                calls++;
+            }
+        }
+        bench_report(label, hooks[h], calls, bench_now_ns() - t0);
+    }
+}
+
+static void bench_readdir(const char *label, const struct corpus *c) {
+    uint64_t ents = 0, t0 = bench_now_ns();
+    for (int it = 0, reps = reps_for(c->ndirs * 10); it < reps; it++) {
+        for (int i = 0; i < c->ndirs; i++) {
+            DIR *d = opendir(c->dirs[i]);
+            if (!d) continue;
+            while (readdir(d)) ents++;
+            closedir(d);
+        }
+    }
+    if (ents) bench_report(label, "readdir", ents, bench_now_ns() - t0);
+}
+
+static void bench_dlopen(const char *label) {
+    uint64_t calls = 0, t0 = bench_now_ns();
+    for (int it = 0; it < g_iters * 100; it++) {
+        for (int i = 0; g_dl_names[i]; i++) {
+            // RTLD_NOLOAD: only the lookup, never an actual load
+            void *h = dlopen(g_dl_names[i], RTLD_NOW | RTLD_NOLOAD);
+            if (h) dlclose(h);
+            calls++;
+        }
+    }
+    bench_report(label, "dlopen", calls, bench_now_ns() - t0);
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: hookbench [-s scenario] [-c tree|proc|probe|hidden|all] [-n iterations] [-d dir]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const char *scenario = getenv("LD_PRELOAD") ? "preload" : "no-preload";
+    const char *which = "all";
+    const char *dir = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:c:n:d:")) != -1) {
+        switch (opt) {
+        case 's': scenario = optarg; break;
+        case 'c': which = optarg; break;
+        case 'n': g_iters = atoi(optarg); break;
+        case 'd': dir = optarg; break;
+        default: usage();
+        }
+    }
+    if (g_iters <= 0) usage();
+
+    char tmpl[] = "/tmp/hookbench.XXXXXX";
+    if (!dir) {
+        if (!mkdtemp(tmpl)) { perror("hookbench: mkdtemp"); return 1; }
+        dir = tmpl;
+    }
+
+    bench_header(scenario);
+    char label[128];
+    int all = !strcmp(which, "all");
+    if (all || !strcmp(which, "tree")) {
+        struct corpus c = {0};
+        build_tree(&c, dir);
+        snprintf(label, sizeof(label), "%s/tree", scenario);
+        bench_opens(label, &c);
+        bench_readdir(label, &c);
+    }
+    if (all || !strcmp(which, "proc")) {
+        struct corpus c = {0};
+        build_list(&c, g_proc_paths, NULL);
+        snprintf(label, sizeof(label), "%s/proc", scenario);
+        bench_opens(label, &c);
+    }
+    if (all || !strcmp(which, "probe")) {
+        struct corpus c = {0};
+        build_list(&c, g_probe_paths, g_probe_dirs);
+        snprintf(label, sizeof(label), "%s/probe", scenario);
+        bench_opens(label, &c);
+        bench_readdir(label, &c);
+        bench_dlopen(label);
+    }
+    if (all || !strcmp(which, "hidden")) {
+        struct corpus c = {0};
+        build_list(&c, g_hidden_paths, NULL);
+        snprintf(label, sizeof(label), "%s/hidden", scenario);
+        bench_opens(label, &c);
+    }
+    return 0;
+}
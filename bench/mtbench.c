@@ -0,0 +1,285 @@
+// Multi-threaded scalability benchmark for libnvidia-hide.
+//
+// Starts N threads (1, 2, 4 ... 64 by default) that each run the same mix of
+// hooked calls: openat over a node_modules tree, /proc reads and the DRM /
+// Vulkan probe paths, readdir of a tree or probe directory, and dlopen of a
+// library name. Every thread count runs in a fresh child process, twice:
+//
+//   cold - the threads are released at once into a process whose library
+//          has not initialized yet; their first call is a probe path, so
+//          all but one of them wait for nh_init
+//   warm - the same threads again once init is done
+//
+// For each run it prints the aggregate throughput, its scaling against one
+// thread, the p50/p99/p99.9 latency of single calls and, cold, the slowest
+// first call (the time a thread was stuck behind init). bench/run.sh also
+// reads the library's own init line from LIBNVIDIAHIDE_STATS.
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define MAX_THREADS 64
+#define MAX_COUNTS  16
+
+static const char *const g_probe_paths[] = {
+    "/dev/dri/renderD128",
+    "/dev/dri/card0",
+    "/dev/nvidia0",
+    "/dev/nvidiactl",
+    "/sys/bus/pci/devices/0000:01:00.0/config",
+    "/usr/share/vulkan/icd.d/nvidia_icd.json",
+    "/usr/share/vulkan/icd.d/intel_icd.x86_64.json",
+    "/usr/lib/x86_64-linux-gnu/libGLX_nvidia.so.0",
+    "/proc/self/status",
+    "/proc/meminfo",
+    "/sys/devices/system/cpu/online",
+    NULL
+};
+
+#define NPROBE ((int)(sizeof(g_probe_paths) / sizeof(g_probe_paths[0])) - 1)
+
+static const char *const g_probe_dirs[] = { "/dev", "/dev/dri", "/usr/share/vulkan/icd.d", NULL };
+
+static const char *const g_dl_names[] = {
+    "libc.so.6", "libm.so.6", "libGLX_nvidia.so.0", "libnvidia-glcore.so", "libEGL_mesa.so.0", NULL
+};
+#define NDL ((int)(sizeof(g_dl_names) / sizeof(g_dl_names[0])) - 1)
+
+struct corpus {
+    char **paths;
+    int n;
+    char **dirs;
+    int ndirs;
+};
+
+static struct corpus g_corpus;
+static int g_ops = 5000;
+
+static void corpus_push(char ***v, int *n, const char *s) {
+    char **nv = realloc(*v, (size_t)(*n + 1) * sizeof(char*));
+    if (!nv || !(nv[*n] = strdup(s))) { perror("mtbench"); exit(1); }
+    *v = nv;
+    (*n)++;
+}
+
+// Raw syscalls only: the parent must not call a hook, or the children it
+// forks would start out initialized.
+static void build_corpus(struct corpus *c, const char *root) {
+    static const char *const leaves[] = { "index.js", "package.json", "README.md", "lib/main.js", "lib/card.js" };
+    char p[2 * PATH_MAX];
+    syscall(SYS_mkdirat, AT_FDCWD, root, 0755);
+    snprintf(p, sizeof(p), "%s/node_modules", root);
+    syscall(SYS_mkdirat, AT_FDCWD, p, 0755);
+    for (int i = 0; i < 64; i++) {
+        char pkg[PATH_MAX];
+        snprintf(pkg, sizeof(pkg), "%s/node_modules/pkg-%02d", root, i);
+        syscall(SYS_mkdirat, AT_FDCWD, pkg, 0755);
+        if (i < 8) corpus_push(&c->dirs, &c->ndirs, pkg);
+        snprintf(p, sizeof(p), "%s/lib", pkg);
+        syscall(SYS_mkdirat, AT_FDCWD, p, 0755);
+        for (size_t k = 0; k < sizeof(leaves)/sizeof(leaves[0]); k++) {
+            snprintf(p, sizeof(p), "%s/%s", pkg, leaves[k]);
+            int fd = (int)syscall(SYS_openat, AT_FDCWD, p, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+            if (fd >= 0) syscall(SYS_close, fd);
+            corpus_push(&c->paths, &c->n, p);
+            // a probe path after every tree file keeps both in the mix
+            corpus_push(&c->paths, &c->n, g_probe_paths[(i * 5 + (int)k) % NPROBE]);
+        }
+    }
+    for (int i = 0; g_probe_dirs[i]; i++) corpus_push(&c->dirs, &c->ndirs, g_probe_dirs[i]);
+}
+
+struct worker {
+    pthread_t th;
+    int id;
+    uint32_t *lat;      // ns per call
+    uint64_t first_ns;  // the thread's first call
+    uint64_t start_ns, end_ns;
+};
+
+static pthread_barrier_t g_start;
+
+// 8 in 10 calls are openat, 1 a directory listing, 1 a dlopen lookup
+static void one_op(int id, int i) {
+    int k = id * 7919 + i;
+    if (i % 10 == 8) {
+        DIR *d = opendir(g_corpus.dirs[k % g_corpus.ndirs]);
+        if (d) {
+            while (readdir(d)) { }
+            closedir(d);
+        }
+    } else if (i % 10 == 9) {
+        // RTLD_NOLOAD: only the lookup, never an actual load
+        void *h = dlopen(g_dl_names[k % NDL], RTLD_NOW | RTLD_NOLOAD);
+        if (h) dlclose(h);
+    } else {
+        int fd = openat(AT_FDCWD, i ? g_corpus.paths[k % g_corpus.n] : g_probe_paths[0], O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) close(fd);
+    }
+}
+
+static void *worker_main(void *arg) {
+    struct worker *w = arg;
+    pthread_barrier_wait(&g_start);
+    w->start_ns = bench_now_ns();
+    uint64_t t1 = w->start_ns;
+    for (int i = 0; i < g_ops; i++) {
+        uint64_t t0 = t1;
+        one_op(w->id, i);
+        t1 = bench_now_ns();
+        uint64_t ns = t1 - t0;
+        if (!i) w->first_ns = ns;
+        w->lat[i] = ns > UINT32_MAX ? UINT32_MAX : (uint32_t)ns;
+    }
+    w->end_ns = t1;
+    return NULL;
+}
+
+struct result {
+    int threads, ok;
+    uint64_t ops, wall_ns;
+    uint64_t p50, p99, p999, first_max;
+};
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void run_threads(int n, struct worker *w, uint32_t *lat, struct result *r) {
+    pthread_barrier_init(&g_start, NULL, (unsigned)n + 1);
+    for (int i = 0; i < n; i++) {
+        w[i].id = i;
+        w[i].lat = lat + (size_t)i * (size_t)g_ops;
+        w[i].first_ns = 0;
+        if (pthread_create(&w[i].th, NULL, worker_main, &w[i]) != 0) { perror("mtbench: pthread_create"); _exit(1); }
+    }
+    pthread_barrier_wait(&g_start);
+    for (int i = 0; i < n; i++) pthread_join(w[i].th, NULL);
+    pthread_barrier_destroy(&g_start);
+    // from the first worker's start to the last one's end: the main thread
+    // may be scheduled last out of the barrier, and joins add their own wakeups
+    uint64_t start = UINT64_MAX, end = 0;
+    for (int i = 0; i < n; i++) {
+        if (w[i].start_ns < start) start = w[i].start_ns;
+        if (w[i].end_ns > end) end = w[i].end_ns;
+    }
+    r->wall_ns = end - start;
+
+    size_t total = (size_t)n * (size_t)g_ops;
+    qsort(lat, total, sizeof(*lat), cmp_u32);
+    r->threads = n;
+    r->ops = total;
+    r->p50 = lat[total / 2];
+    r->p99 = lat[total * 99 / 100];
+    r->p999 = lat[total * 999 / 1000];
+    r->first_max = 0;
+    for (int i = 0; i < n; i++) if (w[i].first_ns > r->first_max) r->first_max = w[i].first_ns;
+    r->ok = 1;
+}
+
+static void child_main(int n, struct result *cold, struct result *warm) {
+    struct worker w[MAX_THREADS];
+    uint32_t *lat = malloc((size_t)n * (size_t)g_ops * sizeof(*lat));
+    if (!lat) _exit(1);
+    run_threads(n, w, lat, cold);
+    run_threads(n, w, lat, warm);
+    free(lat);
+    exit(0);    // not _exit: the library's exit-time stats dump runs
+}
+
+static void report(const char *label, const struct result *r, const struct result *one, int cold) {
+    double rate = r->wall_ns ? (double)r->ops * 1e3 / (double)r->wall_ns : 0.0;   // Mops/s
+    double rate1 = one && one->wall_ns ? (double)one->ops * 1e3 / (double)one->wall_ns : 0.0;
+    printf("%-24s %7d %9llu %9.3f %6.2f %8llu %8llu %8llu", label, r->threads, (unsigned long long)r->ops,
+           rate, rate1 > 0 ? rate / rate1 : 0.0, (unsigned long long)r->p50, (unsigned long long)r->p99,
+           (unsigned long long)r->p999);
+    if (cold) printf(" %10llu", (unsigned long long)r->first_max);
+    printf("\n");
+}
+
+static int parse_counts(const char *s, int *out) {
+    int n = 0;
+    while (*s && n < MAX_COUNTS) {
+        char *e;
+        long v = strtol(s, &e, 10);
+        if (e == s || v < 1 || v > MAX_THREADS) return -1;
+        out[n++] = (int)v;
+        s = *e == ',' ? e + 1 : e;
+        if (*e && *e != ',') return -1;
+    }
+    return n;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: mtbench [-s scenario] [-t n,n,...] [-n calls per thread] [-d dir]\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const char *scenario = getenv("LD_PRELOAD") ? "preload" : "no-preload";
+    const char *dir = NULL;
+    int counts[MAX_COUNTS] = { 1, 2, 4, 8, 16, 32, 64 }, ncounts = 7;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:t:n:d:")) != -1) {
+        switch (opt) {
+        case 's': scenario = optarg; break;
+        case 't': if ((ncounts = parse_counts(optarg, counts)) <= 0) usage(); break;
+        case 'n': g_ops = atoi(optarg); break;
+        case 'd': dir = optarg; break;
+        default: usage();
+        }
+    }
+    if (g_ops <= 0) usage();
+
+    char tmpl[] = "/tmp/mtbench.XXXXXX";
+    if (!dir) {
+        if (!mkdtemp(tmpl)) { perror("mtbench: mkdtemp"); return 1; }
+        dir = tmpl;
+    }
+    build_corpus(&g_corpus, dir);
+
+    // children report through a shared page; the parent prints everything
+    struct result *res = mmap(NULL, sizeof(*res) * 2 * MAX_COUNTS, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (res == MAP_FAILED) { perror("mtbench: mmap"); return 1; }
+    memset(res, 0, sizeof(*res) * 2 * MAX_COUNTS);
+    fflush(stdout);
+    for (int c = 0; c < ncounts; c++) {
+        pid_t pid = fork();
+        if (pid < 0) { perror("mtbench: fork"); return 1; }
+        if (pid == 0) child_main(counts[c], &res[2 * c], &res[2 * c + 1]);
+        int st;
+        waitpid(pid, &st, 0);
+    }
+
+    printf("# %s (%ld cpus)\n", scenario, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%-24s %7s %9s %9s %6s %8s %8s %8s %10s\n", "case", "threads", "calls", "Mcalls/s", "scale",
+           "p50_ns", "p99_ns", "p999_ns", "first_ns");
+    static const char *const phase[] = { "cold", "warm" };
+    for (int p = 0; p < 2; p++) {
+        const struct result *one = NULL;
+        for (int c = 0; c < ncounts; c++) if (res[2 * c + p].ok && res[2 * c + p].threads == 1) one = &res[2 * c + p];
+        char label[128];
+        snprintf(label, sizeof(label), "%s/%s", scenario, phase[p]);
+        for (int c = 0; c < ncounts; c++) {
+            if (!res[2 * c + p].ok) { printf("%-24s %7d (child failed)\n", label, counts[c]); continue; }
+            report(label, &res[2 * c + p], one, p == 0);
+        }
+    }
+    return 0;
+}
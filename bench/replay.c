@@ -0,0 +1,231 @@
+// Replays LIBNVIDIAHIDE_RECORD traces through the library's decision path.
+//
+// Loads libnvidia-hide.so RTLD_LOCAL (so nothing is interposed on this
+// process), decides every recorded path once per verdict-cache mode and
+// then times repeated passes. Reports throughput, verdict counts per hook,
+// records whose verdict differs from the recording, and heap allocations
+// made while deciding (counted by the malloc wrappers below). Exits 1 if the
+// cached and uncached verdicts disagree anywhere.
+//
+// Relative paths resolve against this process's cwd, so their verdicts can
+// legitimately differ from the recording; they are counted separately.
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "../nh-core.h"
+
+// ---------- allocation counter ----------
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void*, size_t);
+extern void __libc_free(void*);
+
+static int g_counting;
+static uint64_t g_allocs;
+
+void *malloc(size_t n) { if (g_counting) g_allocs++; return __libc_malloc(n); }
+void *calloc(size_t k, size_t n) { if (g_counting) g_allocs++; return __libc_calloc(k, n); }
+void *realloc(void *p, size_t n) { if (g_counting) g_allocs++; return __libc_realloc(p, n); }
+void free(void *p) { __libc_free(p); }
+
+// ---------- traces ----------
+struct ent {
+    const char *p;
+    int hook;
+    uint8_t dircls, verdict, relative;
+};
+
+struct trace {
+    const char *file;
+    char snapshot[sizeof(((struct nh_rec_header*)0)->snapshot)];
+    struct ent *ents;
+    size_t n;
+};
+
+typedef int (*hook_f)(const char*);
+typedef int (*setup_f)(const char*, int);
+typedef int (*decide_f)(int, int, const char*);
+
+static hook_f g_hook;
+static setup_f g_setup;
+static decide_f g_decide;
+static const char *g_names[NH_LOG_MAX_HOOKS];
+static uint64_t g_skipped;
+
+static char *read_all(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    size_t cap = 1 << 16, n = 0, r;
+    char *buf = malloc(cap);
+    while (buf && (r = fread(buf + n, 1, cap - n, f)) > 0) {
+        n += r;
+        if (n == cap) buf = realloc(buf, cap *= 2);
+    }
+    fclose(f);
+    *len = n;
+    return buf;
+}
+
+static int load_trace(struct trace *t, const char *path) {
+    size_t len;
+    char *buf = read_all(path, &len);
+    if (!buf) { fprintf(stderr, "replay: %s: %s\n", path, strerror(errno)); return -1; }
+    struct nh_rec_header hd;
+    if (len < sizeof(hd)) goto bad;
+    memcpy(&hd, buf, sizeof(hd));
+    if (hd.magic != NH_REC_MAGIC || hd.version != NH_REC_VERSION || hd.nhooks > NH_LOG_MAX_HOOKS) goto bad;
+
+    // recorded hook ids -> this build's
+    int map[NH_LOG_MAX_HOOKS];
+    for (uint32_t h = 0; h < hd.nhooks; h++) {
+        hd.hooks[h][sizeof(hd.hooks[h]) - 1] = 0;
+        map[h] = g_hook(hd.hooks[h]);
+        if (map[h] >= 0 && map[h] < NH_LOG_MAX_HOOKS && !g_names[map[h]]) g_names[map[h]] = strdup(hd.hooks[h]);
+    }
+    hd.snapshot[sizeof(hd.snapshot) - 1] = 0;
+    memcpy(t->snapshot, hd.snapshot, sizeof(t->snapshot));
+    t->file = path;
+
+    // each path is moved down over its record header and NUL-terminated in place
+    size_t cap = 1024;
+    t->ents = malloc(cap * sizeof(*t->ents));
+    char *out = buf;
+    for (size_t off = sizeof(hd); off + sizeof(struct nh_rec) <= len; ) {
+        struct nh_rec r;
+        memcpy(&r, buf + off, sizeof(r));
+        off += sizeof(r);
+        if (off + r.len > len) break;   // truncated by a crash or a lost flush
+        int hook = r.hook < hd.nhooks ? map[r.hook] : -1;
+        if (hook < 0) { g_skipped++; off += r.len; continue; }
+        memmove(out, buf + off, r.len);
+        out[r.len] = 0;
+        if (t->n == cap) t->ents = realloc(t->ents, (cap *= 2) * sizeof(*t->ents));
+        t->ents[t->n++] = (struct ent){ out, hook, r.dircls, r.verdict, r.relative };
+        out += r.len + 1;
+        off += r.len;
+    }
+    return 0;
+bad:
+    fprintf(stderr, "replay: %s: not a recording\n", path);
+    free(buf);
+    return -1;
+}
+
+// ---------- replay ----------
+// One pass over every trace, each against its own topology; fills v when given.
+static uint64_t run_pass(struct trace *ts, int nts, int vcache, uint8_t *v) {
+    uint64_t denied = 0;
+    for (int i = 0; i < nts; i++) {
+        g_setup(ts[i].snapshot, vcache);
+        for (size_t k = 0; k < ts[i].n; k++) {
+            int d = g_decide(ts[i].ents[k].hook, ts[i].ents[k].dircls, ts[i].ents[k].p);
+            denied += (uint64_t)d;
+            if (v) *v++ = (uint8_t)d;
+        }
+    }
+    return denied;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: replay [-n reps] [-l libnvidia-hide.so] trace.rec...\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const char *lib = "./libnvidia-hide.so";
+    int reps = 20, opt;
+    while ((opt = getopt(argc, argv, "n:l:")) != -1) {
+        switch (opt) {
+        case 'n': reps = atoi(optarg); break;
+        case 'l': lib = optarg; break;
+        default: usage();
+        }
+    }
+    if (reps <= 0 || optind >= argc) usage();
+
+    // the library must not record, log or trace the replay itself
+    unsetenv("LIBNVIDIAHIDE_RECORD");
+    unsetenv("LIBNVIDIAHIDE_DEBUG");
+    unsetenv("LIBNVIDIAHIDE_TRACE");
+    unsetenv("LIBNVIDIAHIDE_STATS");
+    unsetenv(NH_SNAPSHOT_ENV);
+    void *h = dlopen(lib, RTLD_NOW | RTLD_LOCAL);
+    if (!h) { fprintf(stderr, "replay: %s\n", dlerror()); return 1; }
+    g_hook = (hook_f)dlsym(h, "nh_replay_hook");
+    g_setup = (setup_f)dlsym(h, "nh_replay_setup");
+    g_decide = (decide_f)dlsym(h, "nh_replay_decide");
+    if (!g_hook || !g_setup || !g_decide) { fprintf(stderr, "replay: %s lacks the replay entry points\n", lib); return 1; }
+
+    int nts = 0;
+    struct trace *ts = calloc((size_t)(argc - optind), sizeof(*ts));
+    uint64_t total = 0, relative = 0;
+    for (int i = optind; i < argc; i++) {
+        if (load_trace(&ts[nts], argv[i]) != 0) continue;
+        if (g_setup(ts[nts].snapshot, 1) != 0) fprintf(stderr, "replay: %s: bad topology, using none\n", argv[i]), ts[nts].snapshot[0] = 0;
+        total += ts[nts].n;
+        for (size_t k = 0; k < ts[nts].n; k++) relative += ts[nts].ents[k].relative;
+        nts++;
+    }
+    if (!total) { fprintf(stderr, "replay: no records\n"); return 1; }
+
+    printf("# replay: %d traces, %llu records (%llu relative), %llu skipped, %d reps\n", nts,
+           (unsigned long long)total, (unsigned long long)relative, (unsigned long long)g_skipped, reps);
+
+    static const struct { const char *name; int vcache; } modes[] = { { "vcache", 1 }, { "nocache", 0 } };
+    uint8_t *v[2];
+    printf("%-10s %12s %10s %10s %10s %10s %10s\n", "mode", "decisions", "ns/dec", "Mdec/s", "denied", "mismatch", "allocs");
+    for (int m = 0; m < 2; m++) {
+        v[m] = malloc(total);
+        run_pass(ts, nts, modes[m].vcache, v[m]);
+        uint64_t miss = 0, miss_rel = 0;
+        const uint8_t *vp = v[m];
+        for (int i = 0; i < nts; i++)
+            for (size_t k = 0; k < ts[i].n; k++, vp++)
+                if (*vp != ts[i].ents[k].verdict) { miss++; miss_rel += ts[i].ents[k].relative; }
+
+        uint64_t denied = 0;
+        g_allocs = 0;
+        g_counting = 1;
+        uint64_t t0 = bench_now_ns();
+        for (int r = 0; r < reps; r++) denied += run_pass(ts, nts, modes[m].vcache, NULL);
+        uint64_t ns = bench_now_ns() - t0;
+        g_counting = 0;
+
+        uint64_t n = total * (uint64_t)reps;
+        char mism[32];
+        if (miss_rel) snprintf(mism, sizeof(mism), "%llu(%llur)", (unsigned long long)miss, (unsigned long long)miss_rel);
+        else snprintf(mism, sizeof(mism), "%llu", (unsigned long long)miss);
+        printf("%-10s %12llu %10.1f %10.2f %10llu %10s %10llu\n", modes[m].name, (unsigned long long)n,
+               (double)ns / (double)n, (double)n * 1e3 / (double)ns, (unsigned long long)(denied / (uint64_t)reps),
+               mism, (unsigned long long)g_allocs);
+    }
+
+    uint64_t calls[NH_LOG_MAX_HOOKS] = {0}, den[NH_LOG_MAX_HOOKS] = {0}, differ = 0;
+    const uint8_t *a = v[0], *b = v[1];
+    for (int i = 0; i < nts; i++)
+        for (size_t k = 0; k < ts[i].n; k++, a++, b++) {
+            int hk = ts[i].ents[k].hook;
+            calls[hk]++;
+            den[hk] += *b;
+            if (*a != *b) {
+                if (differ++ < 10) fprintf(stderr, "replay: %s: cache %d, nocache %d for %s\n",
+                                           ts[i].file, *a, *b, ts[i].ents[k].p);
+            }
+        }
+    printf("\n%-10s %12s %10s\n", "hook", "records", "denied");
+    for (int hk = 0; hk < NH_LOG_MAX_HOOKS; hk++)
+        if (calls[hk]) printf("%-10s %12llu %10llu\n", g_names[hk] ? g_names[hk] : "?",
+                              (unsigned long long)calls[hk], (unsigned long long)den[hk]);
+    printf("\nverdicts: cache on and off %s (%llu of %llu differ)\n", differ ? "DISAGREE" : "agree",
+           (unsigned long long)differ, (unsigned long long)total);
+    return differ ? 1 : 0;
+}
@@ -0,0 +1,32 @@
+#!/bin/sh
+# make bench-replay: replay recorded path traces through the matcher.
+#
+# Traces are taken from the arguments, else from REPLAY_TRACES (a directory
+# or a list of files), else from $XDG_RUNTIME_DIR/nvidia-hide/record. With
+# none of those a hookbench run is recorded first, so the target always has
+# something to replay. Record real ones with:
+#   LIBNVIDIAHIDE_RECORD=/some/dir nvidia-hide run -- code
+set -e
+
+here=$(cd "$(dirname "$0")" && pwd)
+so=${LIBNVIDIAHIDE_SO:-$here/../libnvidia-hide.so}
+reps=${BENCH_ITERS:-20}
+
+work=$(mktemp -d /tmp/nh-replay.XXXXXX)
+trap 'rm -rf "$work"' EXIT INT TERM
+
+if [ $# -eq 0 ] && [ -n "$REPLAY_TRACES" ]; then
+    if [ -d "$REPLAY_TRACES" ]; then set -- "$REPLAY_TRACES"/*.rec; else set -- $REPLAY_TRACES; fi
+fi
+if [ $# -eq 0 ] && [ -n "$XDG_RUNTIME_DIR" ] && ls "$XDG_RUNTIME_DIR"/nvidia-hide/record/*.rec >/dev/null 2>&1; then
+    set -- "$XDG_RUNTIME_DIR"/nvidia-hide/record/*.rec
+fi
+if [ $# -eq 0 ]; then
+    echo "# no recorded traces: recording a hookbench run"
+    XDG_CONFIG_HOME=$work/config XDG_RUNTIME_DIR=$work/run \
+        LD_PRELOAD=$so LIBNVIDIAHIDE_RECORD=$work/rec "$here/hookbench" -n 1 -d "$work/t" >/dev/null
+    set -- "$work"/rec/*.rec
+fi
+
+# the harness's own policy decision must not come from the user's lists
+XDG_CONFIG_HOME=$work/config XDG_RUNTIME_DIR=$work/run "$here/replay" -n "$reps" -l "$so" "$@"
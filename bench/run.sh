@@ -0,0 +1,56 @@
+#!/bin/sh
+# make bench: run bench/hookbench under each preload configuration.
+#
+#   no-preload  baseline, no library
+#   inactive    library preloaded, policy disables it (denylist matches)
+#   active      library preloaded and active; the tree/proc corpora never
+#               match, the probe corpus is the matching DRM/Vulkan sequence
+#   active-nocache
+#               the same with the per-thread verdict cache off; the hidden
+#               corpus shows the per-call saving, the stats pass its hit rate
+#
+# then bench/mtbench without and with the active library: 1 to 64 threads
+# of mixed openat/readdir/dlopen, cold (racing into init) and warm, and a
+# stats pass for the time callers spent blocked on init
+set -e
+
+here=$(cd "$(dirname "$0")" && pwd)
+so=${LIBNVIDIAHIDE_SO:-$here/../libnvidia-hide.so}
+bin=$here/hookbench
+mt=$here/mtbench
+iters=${BENCH_ITERS:-20}
+
+work=$(mktemp -d /tmp/nh-bench.XXXXXX)
+trap 'rm -rf "$work"' EXIT INT TERM
+
+# keep the user's lists, caches and launcher snapshot out of the numbers
+export XDG_CONFIG_HOME=$work/config XDG_RUNTIME_DIR=$work/run
+mkdir -p "$XDG_RUNTIME_DIR"
+unset LIBNVIDIAHIDE_SNAPSHOT LIBNVIDIAHIDE_ALLOWLIST LIBNVIDIAHIDE_DENYLIST LIBNVIDIAHIDE_DEBUG
+
+"$bin" -s no-preload -n "$iters" -d "$work/t0"
+echo
+LD_PRELOAD=$so LIBNVIDIAHIDE_DENYLIST=hookbench "$bin" -s inactive -n "$iters" -d "$work/t1"
+echo
+LD_PRELOAD=$so "$bin" -s active -n "$iters" -d "$work/t2"
+echo
+LD_PRELOAD=$so LIBNVIDIAHIDE_VCACHE=0 "$bin" -s active-nocache -n "$iters" -d "$work/t3"
+
+mkdir -p "$work/stats"
+LD_PRELOAD=$so LIBNVIDIAHIDE_STATS=$work/stats "$bin" -s active-stats -n "$iters" -d "$work/t4" >/dev/null
+echo
+awk '$1 == "vcache" { h += $2; m += $3 }
+     END { if (h + m) printf "verdict cache: %d of %d candidate lookups hit (%.1f%%)\n", h, h + m, 100 * h / (h + m) }' \
+    "$work"/stats/*.stats
+
+echo
+"$mt" -s no-preload -n $((iters * 500)) -d "$work/m0"
+echo
+LD_PRELOAD=$so "$mt" -s active -n $((iters * 500)) -d "$work/m1"
+
+mkdir -p "$work/mtstats"
+LD_PRELOAD=$so LIBNVIDIAHIDE_STATS=$work/mtstats "$mt" -t 64 -n 100 -d "$work/m2" >/dev/null
+echo
+awk '$1 == "init" { n++; ns += $2; w += $3; wns += $4 }
+     END { if (n) printf "init (64 threads, cold): %.1f us, %d of 63 other threads blocked %.1f us in total\n", ns / n / 1000, w / n, wns / n / 1000 }' \
+    "$work"/mtstats/*.stats
@@ -0,0 +1,69 @@
+// rtld-audit module: drops NVIDIA libraries during the dynamic linker's own
+// search, so DT_NEEDED dependencies and dlopen()s the preload never sees
+// fail before any open(2) of a candidate path. nvidia-hide run sets it in
+// LD_AUDIT next to the LD_PRELOAD library.
+//
+// Audit modules live in their own link namespace with their own libc, so
+// the policy is decided here again, the same way the library does: the
+// launcher snapshot when its token matches this exe, the lists otherwise.
+#define _GNU_SOURCE
+#include <limits.h>
+#include <link.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nh-core.h"
+
+enum { AUDIT_UNDECIDED = 0, AUDIT_ACTIVE, AUDIT_INACTIVE };
+static int g_state = AUDIT_UNDECIDED;
+static int g_debug = 0;
+
+static void audit_dbg(const char *what, const char *name) {
+    if (!g_debug) return;
+    char line[PATH_MAX + 64];
+    int n = snprintf(line, sizeof(line), "[libnvidia-hide-audit] %s %s\n", what, name);
+    if (n > 0) (void)!write(STDERR_FILENO, line, (size_t)n < sizeof(line) ? (size_t)n : sizeof(line) - 1);
+}
+
+// rtld is single-threaded while it searches (it holds the load lock)
+static int audit_active(void) {
+    if (g_state != AUDIT_UNDECIDED) return g_state == AUDIT_ACTIVE;
+    const char *dbg = getenv("LIBNVIDIAHIDE_DEBUG");
+    g_debug = dbg && *dbg && strcmp(dbg, "0");
+
+    int active = 1;
+    unsigned rules = NH_RULE_ALL;
+    uint64_t token = 0;
+    struct nh_topo t;
+    char exe[PATH_MAX];
+    ssize_t n = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if (n > 0) exe[n] = 0;
+    const char *snap = getenv(NH_SNAPSHOT_ENV);
+    if (n > 0 && !(snap && *snap && nh_snapshot_decode(snap, &token, &active, &rules, &t) == 0 &&
+                   token == nh_policy_token(exe))) {
+        struct nh_policy pol;
+        nh_policy_eval(exe, &pol);
+        active = pol.active;
+        rules = pol.rules;
+    }
+    // a learned profile without dlopen leaves NVIDIA libraries loadable
+    active = active && (rules & NH_RULE_DLOPEN);
+    g_state = active ? AUDIT_ACTIVE : AUDIT_INACTIVE;
+    if (!active) audit_dbg("inactive for", "this process");
+    return active;
+}
+
+unsigned int la_version(unsigned int version) {
+    return version ? LAV_CURRENT : 0;
+}
+
+// Called with the name as requested (LA_SER_ORIG) and then with every
+// candidate path; NULL ends the search for that object.
+char *la_objsearch(const char *name, uintptr_t *cookie, unsigned int flag) {
+    (void)cookie;
+    if (!name || !nh_lib_is_nvidia(name) || !audit_active()) return (char*)name;
+    audit_dbg(flag == LA_SER_ORIG ? "drop" : "drop candidate", name);
+    return NULL;
+}
@@ -3,31 +3,37 @@
 #include <errno.h>
 #include <dirent.h>
 #include <fcntl.h>
-#include <fnmatch.h>
+#include <pthread.h>
+#include <sched.h>
 #include <limits.h>
+#include <link.h>
+#include <linux/futex.h>
+#include <linux/io_uring.h>
 #include <linux/limits.h>
-#include <sched.h>
 #include <stdarg.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
 #include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <time.h>
+#include <ucontext.h>
 #include <unistd.h>
+#include <unwind.h>
 
-static void dbg(const char *fmt, ...);
-static void trim(char *s);
-
+#include "nh-core.h"
 
-static void trim(char *s) {
-    if (!s) return;
-    size_t n = strlen(s);
-    while (n && (s[n-1] == '\n' || s[n-1] == '\r' || s[n-1] == ' ' || s[n-1] == '\t')) s[--n] = 0;
-    size_t i = 0;
-    while (s[i] == ' ' || s[i] == '\t') i++;
-    if (i) memmove(s, s+i, strlen(s+i)+1);
-}
+static void dbg(const char *fmt, ...);
+static void build_matcher(void);
+static void record_known_dirs(void);
+static int raw_fstatat(int dirfd, const char *p, void *st, int flags);
+static void sud_init(void);
 
 
 #if __has_include(<linux/openat2.h>)
@@ -37,28 +43,47 @@ struct open_how { uint64_t flags, mode, resolve; };
 #endif
 
 // --------- config ---------
-// LIBNVIDIAHIDE_DEBUG=1 prints one-time init info
+// LIBNVIDIAHIDE_DEBUG=1 records init info and hook decisions in the event log
+// (see log_init); LIBNVIDIAHIDE_DEBUG=stderr prints init info synchronously.
 
-static int g_debug = 0;
+enum { DEBUG_OFF = 0, DEBUG_STDERR, DEBUG_LOG };
+static int g_debug = DEBUG_OFF;
+static void log_init(void);
+static void log_msg(const char *s);
 
 // --------- init guards ---------
-static volatile int g_inited = 0;
-static volatile int g_initializing = 0;
+// One-time init state, published with release semantics. Only the thread
+// that wins UNINIT -> RUNNING initializes; the others sleep on the futex
+// (RUNNING_WAITERS tells the winner a wake is needed).
+enum { NH_UNINIT = 0, NH_RUNNING, NH_RUNNING_WAITERS, NH_READY_ACTIVE, NH_READY_INACTIVE };
+static int g_state = NH_UNINIT;
+static __thread int t_in_init;  // hooks re-entered from our own init pass through
+
+// what init cost, for the statistics: the winner's run, and how many callers
+// slept on the futex for how long in total
+static int g_stats;
+static inline uint64_t stats_now(void);
+static uint64_t g_init_ns, g_init_wait_ns;
+static uint32_t g_init_waits;
 
-// --------- detected NVIDIA DRM nodes ---------
-// store basenames like "card1", "renderD129"
 // --------- policy (allow/deny) ----------
-// If allowlist is non-empty, the library is active only when /proc/self/exe matches.
-// If denylist matches, the library is disabled for that process.
-static int g_active = 1;
-
-
-static const char *base_name(const char *p) {
-    if (!p) return p;
-    const char *s = strrchr(p, '/');
-    return s ? s+1 : p;
+// see nh_policy_eval; evaluated against /proc/self/exe
+static int g_active = 1;    // atomic: the policy stage and replay store it
+static unsigned g_rules = NH_RULE_ALL;  // groups a learned profile left on
+
+static inline int nh_active(void) { return __atomic_load_n(&g_active, __ATOMIC_RELAXED); }
+
+// What hooks test. A hook re-entered from our own init (t_in_init) passes
+// straight through: g_match and g_topo are half built until g_state is
+// published. Past init the TLS read is never reached.
+static inline int hooks_on(void) {
+    if (!nh_active()) return 0;
+    return __builtin_expect(__atomic_load_n(&g_state, __ATOMIC_ACQUIRE) >= NH_READY_ACTIVE, 1) || !t_in_init;
 }
 
+// --------- detected NVIDIA DRM nodes / PCI BDFs ---------
+static struct nh_topo g_topo;
+
 static int read_self_exe(char *out, size_t out_sz) {
     if (!out || out_sz == 0) return -1;
     ssize_t n = readlink("/proc/self/exe", out, out_sz - 1);
@@ -67,460 +92,2607 @@ static int read_self_exe(char *out, size_t out_sz) {
     return 0;
 }
 
-// Match a single pattern against either full exe path (if pattern has '/')
-// or basename (if pattern has no '/').
-static int match_pat(const char *pat, const char *exe_full, const char *exe_base) {
-    if (!pat || !*pat) return 0;
-    const char *target = (strchr(pat, '/') != NULL) ? exe_full : exe_base;
-    if (!target) return 0;
-    // FNM_PATHNAME would make '*' not cross '/', but we want typical shell-glob semantics.
-    return fnmatch(pat, target, 0) == 0;
-}
-
-// Env list is colon-separated patterns.
-static int env_list_has_match(const char *envval, const char *exe_full, const char *exe_base) {
-    if (!envval || !*envval) return 0;
-    const char *p = envval;
-    while (*p) {
-        const char *q = strchr(p, ':');
-        size_t len = q ? (size_t)(q - p) : strlen(p);
-        if (len) {
-            char buf[PATH_MAX];
-            if (len >= sizeof(buf)) len = sizeof(buf) - 1;
-            memcpy(buf, p, len);
-            buf[len] = 0;
-            trim(buf);
-            if (match_pat(buf, exe_full, exe_base)) return 1;
-        }
-        if (!q) break;
-        p = q + 1;
+static void apply_policy_from_exe(void) {
+    char exe_full[PATH_MAX];
+    if (read_self_exe(exe_full, sizeof(exe_full)) < 0) {
+        // If we cannot read /proc/self/exe, keep active (fail open).
+        return;
+    }
+
+    struct nh_policy pol;
+    nh_policy_eval(exe_full, &pol);
+    __atomic_store_n(&g_active, pol.active, __ATOMIC_RELAXED);
+    g_rules = pol.rules;
+
+    if (g_debug) {
+        char rules[256];
+        nh_rules_format(rules, sizeof(rules), g_rules);
+        dbg("policy: exe=%s%s", exe_full, pol.compiled ? " (policy.bin)" : "");
+        dbg("policy: active=%d (has_allow=%d allow_match=%d deny_match=%d)",
+            nh_active(), pol.has_allow, pol.allow_match, pol.deny_match);
+        dbg("policy: rules %s%s", rules[0] ? rules : "(none)", pol.profile ? " (profile)" : "");
     }
-    return 0;
 }
 
-static int file_list_has_match(const char *path, const char *exe_full, const char *exe_base, int *out_had_entries) {
-    if (out_had_entries) *out_had_entries = 0;
-    if (!path || !*path) return 0;
-    FILE *f = fopen(path, "r");
-    if (!f) return 0;
-    char line[PATH_MAX];
-    while (fgets(line, sizeof(line), f)) {
-        trim(line);
-        if (!line[0] || line[0] == '#') continue;
-        if (out_had_entries) *out_had_entries = 1;
-        if (match_pat(line, exe_full, exe_base)) {
-            fclose(f);
-            return 1;
-        }
+// Adopt what nvidia-hide run (or an ancestor) already computed.
+// Returns a mask of SNAP_TOPO (g_topo filled) and SNAP_POLICY (g_active decided).
+#define SNAP_TOPO   1
+#define SNAP_POLICY 2
+
+static int adopt_snapshot(void) {
+    const char *env = getenv(NH_SNAPSHOT_ENV);
+    if (!env || !*env) return 0;
+
+    uint64_t token = 0;
+    int active = 1;
+    unsigned rules;
+    struct nh_topo t;
+    memset(&t, 0, sizeof(t));
+    if (nh_snapshot_decode(env, &token, &active, &rules, &t) != 0) {
+        dbg("snapshot: ignoring malformed %s", NH_SNAPSHOT_ENV);
+        return 0;
     }
-    fclose(f);
-    return 0;
+    g_topo = t;
+
+    // A re-exec'd or different binary must get its own policy decision.
+    char exe[PATH_MAX];
+    if (read_self_exe(exe, sizeof(exe)) < 0 || token != nh_policy_token(exe)) {
+        dbg("snapshot: topology adopted, policy token mismatch");
+        return SNAP_TOPO;
+    }
+    __atomic_store_n(&g_active, active, __ATOMIC_RELAXED);
+    g_rules = rules;
+    dbg("snapshot: adopted (active=%d rules=%#x)", nh_active(), g_rules);
+    return SNAP_TOPO | SNAP_POLICY;
 }
 
-static void build_xdg_path(char *out, size_t out_sz, const char *leaf) {
-    if (!out || out_sz == 0) return;
-    out[0] = 0;
-    const char *xdg = getenv("XDG_CONFIG_HOME");
-    const char *home = getenv("HOME");
-    if (xdg && *xdg) {
-        snprintf(out, out_sz, "%s/nvidia-hide/%s", xdg, leaf);
-    } else if (home && *home) {
-        snprintf(out, out_sz, "%s/.config/nvidia-hide/%s", home, leaf);
+static void dbg(const char *fmt, ...) {
+    if (!g_debug) return;
+    va_list ap; va_start(ap, fmt);
+    if (g_debug == DEBUG_LOG) {
+        char line[512];
+        vsnprintf(line, sizeof(line), fmt, ap);
+        log_msg(line);
     } else {
-        snprintf(out, out_sz, "/nonexistent/%s", leaf);
+        fprintf(stderr, "[libnvidia-hide] ");
+        vfprintf(stderr, fmt, ap);
+        fprintf(stderr, "\n");
     }
+    va_end(ap);
 }
 
-static void apply_policy_from_exe(void) {
-    char exe_full[PATH_MAX];
-    if (read_self_exe(exe_full, sizeof(exe_full)) < 0) {
-        // If we cannot read /proc/self/exe, keep active (fail open).
-        return;
-    }
-    const char *exe_base = base_name(exe_full);
+// --------- policy stage ---------
+// Runs from the constructor, so every hook of an inactive process sees
+// g_active == 0 from its first call. If another DSO's constructor calls a
+// hook before ours ran, nh_init gets here first instead.
+static int g_policy_done = 0;
+static int g_snap = 0;
+
+// nvidia-hide run pointed the whole tree at the Mesa-only vendor lists; a
+// process the policy leaves alone gets the loaders' own search back. Only the
+// variables it names are touched, and each was unset before the run.
+static void restore_vendor_env(void) {
+    static const char *const known[] = {
+        "VK_DRIVER_FILES", "VK_ICD_FILENAMES", "__EGL_VENDOR_LIBRARY_FILENAMES", "__GLX_VENDOR_LIBRARY_NAME", NULL
+    };
+    const char *env = getenv(NH_VENDOR_ENV);
+    if (!env) return;
+    char names[512];
+    snprintf(names, sizeof(names), "%s", env);
+    for (char *save = NULL, *tok = strtok_r(names, ":", &save); tok; tok = strtok_r(NULL, ":", &save))
+        for (int i = 0; known[i]; i++)
+            if (!strcmp(tok, known[i])) unsetenv(tok);
+    unsetenv(NH_VENDOR_ENV);
+    dbg("init: vendor lists of nvidia-hide run dropped");
+}
+
+static void nh_policy_init(void) {
+    if (__atomic_load_n(&g_policy_done, __ATOMIC_ACQUIRE)) return;
 
-    const char *env_allow = getenv("LIBNVIDIAHIDE_ALLOWLIST");
-    const char *env_deny  = getenv("LIBNVIDIAHIDE_DENYLIST");
+    log_init();
 
-    char allow_path[PATH_MAX], deny_path[PATH_MAX];
-    build_xdg_path(allow_path, sizeof(allow_path), "allowlist");
-    build_xdg_path(deny_path, sizeof(deny_path), "denylist");
+    __atomic_store_n(&g_active, 1, __ATOMIC_RELAXED);
+    g_snap = adopt_snapshot();
+    if (!(g_snap & SNAP_POLICY)) apply_policy_from_exe();
+    if (!nh_active()) {
+        dbg("init: inactive for this process; hooks pass through");
+        restore_vendor_env();
+    }
 
-    int file_allow_had = 0;
-    int file_deny_had  = 0;
+    __atomic_store_n(&g_policy_done, 1, __ATOMIC_RELEASE);
+}
 
-    int allow_match_env = env_list_has_match(env_allow, exe_full, exe_base);
-    int deny_match_env  = env_list_has_match(env_deny,  exe_full, exe_base);
+// daemon segment (optional); see shm_check
+static const struct nh_shm *g_shm;
+static uint32_t g_shm_seq;
+static inline void shm_check(void);
 
-    int allow_match_file = file_list_has_match(allow_path, exe_full, exe_base, &file_allow_had);
-    int deny_match_file  = file_list_has_match(deny_path,  exe_full, exe_base, &file_deny_had);
+static void nh_futex_wait(int *addr, int val) {
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
 
-    int has_allow = (env_allow && *env_allow) || file_allow_had;
-    int allow_match = allow_match_env || allow_match_file;
+static void nh_futex_wake_all(int *addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
 
-    // If allowlist exists and we don't match it => disable.
-    if (has_allow && !allow_match) g_active = 0;
+static void nh_init_run(void) {
+    nh_policy_init();
+    if (!nh_active()) return;
 
-    // Denylist always wins if matched.
-    if (deny_match_env || deny_match_file) g_active = 0;
+    // a running daemon's live topology beats the snapshot and the cache
+    g_shm = nh_shm_map();
+    if (g_shm && nh_shm_read(g_shm, &g_topo, &g_shm_seq) == 0) dbg("init: topology from daemon (seq %u)", g_shm_seq);
+    else if (!(g_snap & SNAP_TOPO) && nh_discover(&g_topo)) dbg("init: discovery from cache");
 
     if (g_debug) {
-        dbg("policy: exe=%s", exe_full);
-        dbg("policy: active=%d (has_allow=%d allow_match=%d deny_match=%d)",
-            g_active, has_allow, allow_match, (deny_match_env || deny_match_file));
+        char name[32];
+        dbg("init: nvidia_nodes=%d nvidia_bdfs=%d", nh_topo_nodes_n(&g_topo), g_topo.bdfs_n);
+        for (int k = 0; k < NH_NODE_TYPES; k++)
+            for (int bit = 0; bit < 64; bit++)
+                if ((g_topo.nodes[k] >> bit) & 1) { nh_node_format(name, sizeof(name), k, bit); dbg("  node: %s", name); }
+        for (int i = 0; i < g_topo.bdfs_n; i++) { nh_bdf_format(name, sizeof(name), g_topo.bdfs[i]); dbg("  bdf:  %s", name); }
     }
+
+    build_matcher();
+    record_known_dirs();
 }
 
-#define MAX_NODES 64
-static char g_nodes[MAX_NODES][NAME_MAX];
-static int  g_nodes_n = 0;
+static void nh_init(void) {
+    int s = __atomic_load_n(&g_state, __ATOMIC_ACQUIRE);
+    if (s >= NH_READY_ACTIVE || t_in_init) return;
+
+    if (s == NH_UNINIT &&
+        __atomic_compare_exchange_n(&g_state, &s, NH_RUNNING, 0, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+        uint64_t t0 = g_stats ? stats_now() : 0;
+        t_in_init = 1;
+        nh_init_run();
+        t_in_init = 0;
+        if (g_stats) g_init_ns = stats_now() - t0;
+        int prev = __atomic_exchange_n(&g_state, nh_active() ? NH_READY_ACTIVE : NH_READY_INACTIVE,
+                                       __ATOMIC_RELEASE);
+        if (prev == NH_RUNNING_WAITERS) nh_futex_wake_all(&g_state);
+        return;
+    }
+
+    uint64_t t0 = g_stats ? stats_now() : 0;
+    while (s < NH_READY_ACTIVE) {
+        if (s == NH_RUNNING &&
+            !__atomic_compare_exchange_n(&g_state, &s, NH_RUNNING_WAITERS, 0,
+                                         __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+            continue;   // s was reloaded: maybe published already
+        nh_futex_wait(&g_state, NH_RUNNING_WAITERS);
+        s = __atomic_load_n(&g_state, __ATOMIC_ACQUIRE);
+    }
+    if (g_stats) {
+        __atomic_fetch_add(&g_init_waits, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&g_init_wait_ns, stats_now() - t0, __ATOMIC_RELAXED);
+    }
+}
 
-// --------- detected NVIDIA PCI BDFs ---------
-// store "0000:01:00.0" etc (used only to hide by-path entries and optionally sysfs config)
-#define MAX_BDFS 8
-static char g_bdfs[MAX_BDFS][32];
-static int  g_bdfs_n = 0;
+static inline void ensure_init(void) {
+    if (__builtin_expect(__atomic_load_n(&g_state, __ATOMIC_ACQUIRE) < NH_READY_ACTIVE, 0)) nh_init();
+    if (g_shm) shm_check();
+}
 
-// linux_dirent64 for getdents64
-struct linux_dirent64 {
-    uint64_t d_ino;
-    int64_t  d_off;
-    unsigned short d_reclen;
-    unsigned char  d_type;
-    char d_name[];
+// ---------- compiled path matcher ----------
+// The deny-literal DFA is built once by nh_init. The topology it is checked
+// against is double-buffered: when the daemon's seq moves, the next check
+// fills the other buffer and publishes it. A reader that loaded g_live
+// before two swaps may still be inside the buffer being refilled, so each
+// buffer carries a seqlock (odd while written) and every decision made
+// against a buffer is retried if its seq moved meanwhile.
+struct topo_buf {
+    uint32_t seq;
+    struct nh_topo t;
 };
+static struct nh_matcher g_match;
+static struct topo_buf g_topos[2];
+static struct topo_buf *g_live = &g_topos[0];
+static int g_live_busy;
+static uint32_t g_vgen = 1;     // verdict cache generation, see match_cached
+static int g_vcache_on = 1;
+
+static void build_matcher(void) {
+    const char *env = getenv("LIBNVIDIAHIDE_VCACHE");
+    g_vcache_on = !(env && !strcmp(env, "0"));
+    nh_matcher_build(&g_match, g_rules);
+    g_topos[0].t = g_topo;
+}
 
-static void dbg(const char *fmt, ...) {
-    if (!g_debug) return;
-    va_list ap; va_start(ap, fmt);
-    fprintf(stderr, "[libnvidia-hide] ");
-    vfprintf(stderr, fmt, ap);
-    fprintf(stderr, "\n");
-    va_end(ap);
+static inline const struct topo_buf *topo_begin(uint32_t *seq) {
+    for (;;) {
+        const struct topo_buf *b = __atomic_load_n(&g_live, __ATOMIC_ACQUIRE);
+        uint32_t s = __atomic_load_n(&b->seq, __ATOMIC_ACQUIRE);
+        if (__builtin_expect(!(s & 1u), 1)) { *seq = s; return b; }
+    }
 }
 
+static inline int topo_retry(const struct topo_buf *b, uint32_t seq) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __builtin_expect(__atomic_load_n(&b->seq, __ATOMIC_RELAXED) != seq, 0);
+}
 
-static int read_file_raw(const char *path, char *buf, size_t bufsz) {
-    int fd = (int)syscall(SYS_openat, AT_FDCWD, path, O_RDONLY | O_CLOEXEC, 0);
-    if (fd < 0) return -1;
-    ssize_t n = read(fd, buf, bufsz - 1);
-    close(fd);
-    if (n <= 0) return -1;
-    buf[n] = 0;
-    trim(buf);
-    return 0;
+// for callers that hold the topology across a loop or a syscall
+static void live_topo_copy(struct nh_topo *out) {
+    const struct topo_buf *b;
+    uint32_t seq;
+    do { b = topo_begin(&seq); memcpy(out, &b->t, sizeof(*out)); } while (topo_retry(b, seq));
 }
 
-static int parse_hex(const char *s, unsigned *out) {
-    unsigned v = 0;
-    if (sscanf(s, "0x%x", &v) == 1 || sscanf(s, "%x", &v) == 1) { *out = v; return 0; }
-    return -1;
+// a hint only: pci_devices_memfd filters against its own copy
+static inline int live_bdfs_n(void) {
+    return __atomic_load_n(&__atomic_load_n(&g_live, __ATOMIC_ACQUIRE)->t.bdfs_n, __ATOMIC_RELAXED);
 }
 
-static void add_node(const char *name) {
-    if (!name || !*name) return;
-    for (int i=0;i<g_nodes_n;i++) if (!strcmp(g_nodes[i], name)) return;
-    if (g_nodes_n >= MAX_NODES) return;
-    snprintf(g_nodes[g_nodes_n++], NAME_MAX, "%s", name);
+// writers are serialized by g_live_busy (or run before any reader)
+static inline void topo_write_begin(struct topo_buf *b) {
+    __atomic_store_n(&b->seq, b->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
 }
 
-static int is_node(const char *name) {
-    if (!name) return 0;
-    for (int i=0;i<g_nodes_n;i++) if (!strcmp(g_nodes[i], name)) return 1;
-    return 0;
+static inline void topo_write_end(struct topo_buf *b) {
+    __atomic_store_n(&b->seq, b->seq + 1, __ATOMIC_RELEASE);
 }
 
-static void add_bdf(const char *bdf) {
-    if (!bdf || !*bdf) return;
-    for (int i=0;i<g_bdfs_n;i++) if (!strcmp(g_bdfs[i], bdf)) return;
-    if (g_bdfs_n >= MAX_BDFS) return;
-    snprintf(g_bdfs[g_bdfs_n++], sizeof(g_bdfs[g_bdfs_n-1]), "%s", bdf);
+static void shm_refresh(void) {
+    // one thread refreshes; the others keep checking against the current set
+    if (__atomic_exchange_n(&g_live_busy, 1, __ATOMIC_ACQUIRE)) return;
+    struct topo_buf *next = __atomic_load_n(&g_live, __ATOMIC_RELAXED) == &g_topos[0] ? &g_topos[1] : &g_topos[0];
+    uint32_t seq;
+    topo_write_begin(next);
+    int ok = nh_shm_read(g_shm, &next->t, &seq) == 0;
+    topo_write_end(next);
+    if (ok) {
+        __atomic_store_n(&g_live, next, __ATOMIC_RELEASE);
+        __atomic_store_n(&g_shm_seq, seq, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&g_vgen, 1, __ATOMIC_RELEASE);
+        dbg("daemon: topology update (seq %u, nodes=%d bdfs=%d)", seq, nh_topo_nodes_n(&next->t), next->t.bdfs_n);
+    }
+    __atomic_store_n(&g_live_busy, 0, __ATOMIC_RELEASE);
 }
 
-static int drm_entry_is_nvidia(const char *entry) {
-    char vendor_path[PATH_MAX];
-    snprintf(vendor_path, sizeof(vendor_path), "/sys/class/drm/%s/device/vendor", entry);
-    char buf[64];
-    if (read_file_raw(vendor_path, buf, sizeof(buf)) != 0) return 0;
-    unsigned v=0;
-    if (parse_hex(buf, &v) != 0) return 0;
-    return (v == 0x10de);
+static inline void shm_check(void) {
+    if (__builtin_expect(__atomic_load_n(&g_shm->seq, __ATOMIC_ACQUIRE) !=
+                         __atomic_load_n(&g_shm_seq, __ATOMIC_RELAXED), 0))
+        shm_refresh();
 }
 
-// scan /sys/class/drm via raw getdents64 (so we do NOT depend on libc readdir while initializing)
-static void scan_nodes_raw(void) {
-    int fd = (int)syscall(SYS_openat, AT_FDCWD, "/sys/class/drm", O_RDONLY|O_DIRECTORY|O_CLOEXEC, 0);
-    if (fd < 0) return;
+// ---------- per-thread verdict cache ----------
+// Candidate paths repeat constantly (sysfs CPU/cgroup files, library loads).
+// Each thread keeps a direct-mapped table of verdicts keyed by a word-at-a-
+// time hash of the path plus its length; the hash is cheaper than a rescan
+// and a 64-bit collision is not worth a string copy per slot. Entries carry
+// the generation they were decided under: a topology swap bumps g_vgen,
+// which retires every thread's table at once. LIBNVIDIAHIDE_VCACHE=0 turns
+// it off.
+#define VCACHE_SLOTS 256
+
+struct vcache_ent {
+    uint64_t hash;
+    uint32_t len;
+    uint32_t gen_verdict;   // gen << 1 | verdict; gen 0 never matches
+};
 
-    char buf[8192];
-    for (;;) {
-        int nread = (int)syscall(SYS_getdents64, fd, buf, (int)sizeof(buf));
-        if (nread <= 0) break;
-
-        int bpos = 0;
-        while (bpos < nread) {
-            struct linux_dirent64 *d = (struct linux_dirent64*)(buf + bpos);
-            const char *n = d->d_name;
-            if (n[0] != '.') {
-                if (!strncmp(n, "card", 4) || !strncmp(n, "renderD", 7)) {
-                    if (drm_entry_is_nvidia(n)) add_node(n);
-                }
-            }
-            bpos += d->d_reclen;
-        }
+static __thread struct vcache_ent t_vcache[VCACHE_SLOTS];
+static inline void stats_vcache(int hit);
+
+static inline uint64_t vcache_hash(const char *p, size_t n) {
+    uint64_t h = (uint64_t)n * 0x9e3779b97f4a7c15ull, w;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        memcpy(&w, p + i, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+    }
+    if (i < n) {
+        w = 0;
+        memcpy(&w, p + i, n - i);
+        h = (h ^ w) * 0xc4ceb9fe1a85ec53ull;
+    }
+    return h ^ (h >> 29);
+}
+
+static inline int dev_is_nvidia(const struct stat *st) {
+    if (!S_ISCHR(st->st_mode)) return 0;
+    const struct topo_buf *b;
+    uint32_t seq;
+    int v;
+    do { b = topo_begin(&seq); v = nh_topo_has_dev(&b->t, major(st->st_rdev), minor(st->st_rdev)); } while (topo_retry(b, seq));
+    return v;
+}
+
+// Other /dev/dri entries (udev symlinks that are neither a node name nor a
+// pci- by-path link) are decided by the device number they lead to: one
+// stat, never an open, and the verdict cache keeps it to one per path.
+static int decide_path(const char *p, int root) {
+    const struct topo_buf *b;
+    uint32_t seq;
+    int v;
+    do { b = topo_begin(&seq); v = nh_match_path(&g_match, &b->t, p, root); } while (topo_retry(b, seq));
+    if (v) return 1;
+    if (root != NH_ROOT_DEV || !(g_rules & NH_RULE_DRI) || strncmp(p, "/dev/dri/", 9)) return 0;
+    int type, bit;
+    if (nh_node_parse(p + 9, &type, &bit) == 0 || !strncmp(p + 9, "by-path/pci-", 12)) return 0;
+    struct stat st;
+    return nh_raw_stat(p, &st) == 0 && dev_is_nvidia(&st);
+}
+
+static int match_cached(const char *p, int root) {
+    size_t n = strlen(p);
+    uint64_t h = vcache_hash(p, n);
+    // gen before topology: a swap publishes g_live first, so a new gen implies the new set
+    uint32_t gen = __atomic_load_n(&g_vgen, __ATOMIC_ACQUIRE) & 0x7fffffffu;
+    struct vcache_ent *e = &t_vcache[h & (VCACHE_SLOTS - 1)];
+    if (e->hash == h && e->len == (uint32_t)n && e->gen_verdict >> 1 == gen) {
+        stats_vcache(1);
+        return (int)(e->gen_verdict & 1);
     }
-    close(fd);
+    stats_vcache(0);
+    int v = decide_path(p, root);
+    e->hash = h;
+    e->len = (uint32_t)n;
+    e->gen_verdict = gen << 1 | (uint32_t)v;
+    return v;
 }
 
-static void discover_bdfs_from_nodes(void) {
-    // resolve /sys/class/drm/<node>/device -> .../<BDF>
-    for (int i=0;i<g_nodes_n;i++) {
-        char linkpath[PATH_MAX];
-        snprintf(linkpath, sizeof(linkpath), "/sys/class/drm/%s/device", g_nodes[i]);
+// ---------- deny logic ----------
+
+static int is_nvidia_path(const char *p) {
+    if (!hooks_on()) return 0;
+    if (!p) return 0;
 
-        char target[PATH_MAX];
-        ssize_t n = readlink(linkpath, target, sizeof(target)-1);
-        if (n <= 0) continue;
-        target[n] = 0;
+    int root = nh_path_root(p);
+    if (root == NH_ROOT_NONE) return 0;
 
-        const char *base = strrchr(target, '/');
-        base = base ? base+1 : target;
+    ensure_init();
+    if (!hooks_on()) return 0;
+    if (g_vcache_on) return match_cached(p, root);
+    return decide_path(p, root);
+}
 
-        if (strchr(base, ':') && strchr(base, '.')) add_bdf(base);
+// Names any dirent rule below could hide; checked before init.
+static inline int dirent_maybe_nvidia(const char *name) {
+    switch (name[0]) {
+    case 'n': return !strncmp(name, "nvidia", 6);
+    case 'c': return !strncmp(name, "card", 4);
+    case 'r': return !strncmp(name, "renderD", 7);
+    case 'p': return !strncmp(name, "pci-", 4);  // by-path names carry the BDF
     }
+    return 0;
 }
 
-static void nh_init(void) {
-    if (__atomic_load_n(&g_inited, __ATOMIC_ACQUIRE)) return;
+// ---------- directory classification ----------
+// Directory entries are only filtered inside the directories that can list
+// NVIDIA nodes or ICDs. Each DIR* is classified once (dirfd -> dev/ino
+// against the known directories) and remembered in a small lock-free table;
+// closedir evicts it.
+
+enum { DIR_OTHER = 0, DIR_DEV, DIR_DRI, DIR_BYPATH, DIR_ICD };
+
+static const struct { const char *path; int cls; } g_dir_paths[] = {
+    { "/dev",                               DIR_DEV    },
+    { "/dev/dri",                           DIR_DRI    },
+    { "/dev/dri/by-path",                   DIR_BYPATH },
+    { "/usr/share/vulkan/icd.d",            DIR_ICD    },
+    { "/usr/share/vulkan/implicit_layer.d", DIR_ICD    },
+    { "/etc/vulkan/icd.d",                  DIR_ICD    },
+    { "/etc/vulkan/implicit_layer.d",       DIR_ICD    },
+};
+#define N_DIR_PATHS (sizeof(g_dir_paths)/sizeof(g_dir_paths[0]))
+
+static struct { dev_t dev; ino_t ino; int cls; } g_dirs[N_DIR_PATHS];
+static int g_dirs_n = 0;
+
+// called from nh_init
+static void record_known_dirs(void) {
+    g_dirs_n = 0;
+    for (size_t i = 0; i < N_DIR_PATHS; i++) {
+        struct stat st;
+        if (nh_raw_stat(g_dir_paths[i].path, &st) != 0 || !S_ISDIR(st.st_mode)) continue;
+        g_dirs[g_dirs_n].dev = st.st_dev;
+        g_dirs[g_dirs_n].ino = st.st_ino;
+        g_dirs[g_dirs_n].cls = g_dir_paths[i].cls;
+        g_dirs_n++;
+    }
+}
 
-    int expected = 0;
-    if (!__atomic_compare_exchange_n(&g_initializing, &expected, 1, 0,
-        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
-        while (!__atomic_load_n(&g_inited, __ATOMIC_ACQUIRE)) sched_yield();
-        return;
-        }
+static int classify_stat(const struct stat *st) {
+    for (int i=0;i<g_dirs_n;i++)
+        if (g_dirs[i].dev == st->st_dev && g_dirs[i].ino == st->st_ino) return g_dirs[i].cls;
+    return DIR_OTHER;
+}
+
+static int classify_fd(int fd) {
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) return DIR_OTHER;
+    return classify_stat(&st);
+}
 
-        const char *dbg_env = getenv("LIBNVIDIAHIDE_DEBUG");
-    if (dbg_env && strcmp(dbg_env, "0") != 0) g_debug = 1;
+static int classify_dir(DIR *dirp) {
+    return classify_fd(dirfd(dirp));
+}
 
-    g_active = 1;
-    apply_policy_from_exe();
+// Slots pack (DIR* | cls+1); DIR streams are malloc'ed, so the low bits are free.
+#define DIRTAB_SIZE   128
+#define DIRTAB_PROBES 8
+#define DIRTAB_TOMB   ((uintptr_t)1)
+#define DIRTAB_MASK   ((uintptr_t)7)
+static uintptr_t g_dirtab[DIRTAB_SIZE];
 
+static inline unsigned dirtab_slot(DIR *d) {
+    return (unsigned)((((uintptr_t)d >> 4) * 0x9E3779B97F4A7C15ull) >> 57) & (DIRTAB_SIZE - 1);
+}
 
-    if (!g_active) {
-        if (g_debug) dbg("init: inactive for this process; skipping discovery/hooks");
-        return;
+// returns the cached class, or -1
+static inline int dirtab_get(DIR *d) {
+    unsigned h = dirtab_slot(d);
+    for (int i = 0; i < DIRTAB_PROBES; i++) {
+        uintptr_t v = __atomic_load_n(&g_dirtab[(h + i) & (DIRTAB_SIZE - 1)], __ATOMIC_ACQUIRE);
+        if (!v) return -1;
+        if ((v & ~DIRTAB_MASK) == (uintptr_t)d) return (int)(v & DIRTAB_MASK) - 1;
     }
-    if (!g_active) {
-        if (g_debug) dbg("init: inactive for this process; skipping discovery");
-        return;
+    return -1;
+}
+
+static void dirtab_put(DIR *d, int cls) {
+    if ((uintptr_t)d & DIRTAB_MASK) return;
+    uintptr_t nv = (uintptr_t)d | (uintptr_t)(cls + 1);
+    unsigned h = dirtab_slot(d);
+    for (int i = 0; i < DIRTAB_PROBES; i++) {
+        uintptr_t *slot = &g_dirtab[(h + i) & (DIRTAB_SIZE - 1)];
+        uintptr_t v = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+        while (v == 0 || v == DIRTAB_TOMB) {
+            if (__atomic_compare_exchange_n(slot, &v, nv, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) return;
+        }
+        if ((v & ~DIRTAB_MASK) == (uintptr_t)d) return;
     }
+    // table full around this slot: the stream just gets classified again next time
+}
 
+static void dirtab_del(DIR *d) {
+    unsigned h = dirtab_slot(d);
+    for (int i = 0; i < DIRTAB_PROBES; i++) {
+        uintptr_t *slot = &g_dirtab[(h + i) & (DIRTAB_SIZE - 1)];
+        uintptr_t v = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+        if (!v) return;
+        if ((v & ~DIRTAB_MASK) == (uintptr_t)d) {
+            __atomic_compare_exchange_n(slot, &v, DIRTAB_TOMB, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+}
 
-    scan_nodes_raw();
-    discover_bdfs_from_nodes();
+// The per-directory hide rules; name already passed dirent_maybe_nvidia.
+static int dirent_hidden_topo(const struct nh_topo *t, int cls, const char *name) {
+    switch (cls) {
+    case DIR_DEV:
+    case DIR_ICD:
+        // /dev/nvidia* nodes, nvidia_icd.json / nvidia_layers.json
+        return !strncmp(name, "nvidia", 6);
+
+    case DIR_DRI:
+        // Hide discovered DRM nodes (cardX/renderD*)
+        return nh_topo_has_node(t, name);
+
+    case DIR_BYPATH: {
+        // by-path symlink names carry the BDF: pci-0000:01:00.0-render
+        uint32_t bdf;
+        return !strncmp(name, "pci-", 4) && nh_bdf_parse(name + 4, &bdf) && nh_topo_has_bdf(t, bdf);
+    }
+    }
+    return 0;
+}
 
-    dbg("init: nvidia_nodes=%d nvidia_bdfs=%d", g_nodes_n, g_bdfs_n);
-    for (int i=0;i<g_nodes_n;i++) dbg("  node: %s", g_nodes[i]);
-    for (int i=0;i<g_bdfs_n;i++) dbg("  bdf:  %s", g_bdfs[i]);
+static int dirent_hidden_in(int cls, const char *name) {
+    const struct topo_buf *b;
+    uint32_t seq;
+    int v;
+    do { b = topo_begin(&seq); v = dirent_hidden_topo(&b->t, cls, name); } while (topo_retry(b, seq));
+    return v;
+}
 
-    __atomic_store_n(&g_inited, 1, __ATOMIC_RELEASE);
-    __atomic_store_n(&g_initializing, 0, __ATOMIC_RELEASE);
+// Listings of a directory whose filter the profile left off pass unfiltered.
+static inline int listing_cls(int cls) {
+    return cls > DIR_OTHER && !(g_rules & (NH_RULE_LS_DEV << (cls - 1))) ? DIR_OTHER : cls;
 }
 
-static inline void ensure_init(void) { if (!__atomic_load_n(&g_inited, __ATOMIC_ACQUIRE)) nh_init(); }
+static int is_nvidia_dirent(DIR *dirp, const char *name) {
+    if (!hooks_on()) return 0;
+    if (!name) return 0;
+    if (!dirent_maybe_nvidia(name)) return 0;
+
+    int cls = dirtab_get(dirp);
+    if (cls == DIR_OTHER) return 0;
+    if (cls < 0) {
+        ensure_init();
+        if (!hooks_on()) return 0;
+        cls = listing_cls(classify_dir(dirp));
+        dirtab_put(dirp, cls);
+    }
 
-// ---------- deny logic ----------
+    return dirent_hidden_in(cls, name);
+}
 
-static int is_nvidia_path(const char *p) {
-    if (!g_active) return 0;
-    if (!p) return 0;
+// ---------- relative paths ----------
+// openat(dri_fd, "renderD129") and friends never reach the string rules.
+// Only a last component that could name a hidden entry is looked at: a bare
+// name is judged by its directory's class like a listing would be, anything
+// else by the device number it resolves to. At most two stats, no open.
+static int is_nvidia_relpath(int dirfd, const char *p) {
+    const char *base = strrchr(p, '/');
+    base = base ? base + 1 : p;
+    if (!dirent_maybe_nvidia(base)) return 0;
     ensure_init();
+    if (!hooks_on()) return 0;
+    struct stat st;
+    if (base == p) {
+        int cls = dirfd == AT_FDCWD ? (nh_raw_stat(".", &st) == 0 ? classify_stat(&st) : DIR_OTHER)
+                                    : classify_fd(dirfd);
+        if (cls != DIR_OTHER) return dirent_hidden_in(cls, p);
+    }
+    return raw_fstatat(dirfd, p, &st, 0) == 0 && dev_is_nvidia(&st);
+}
 
-    // Device nodes
-    if (!strncmp(p, "/dev/nvidia", 10)) return 1;
+static int is_nvidia_path_at(int dirfd, const char *p) {
+    if (!hooks_on() || !p) return 0;
+    if (p[0] == '/' || !p[0]) return is_nvidia_path(p);
+    return is_nvidia_relpath(dirfd, p);
+}
 
-    if (!strncmp(p, "/dev/dri/", 9)) {
-        const char *base = p + 9;
-        if (is_node(base)) return 1;
+// ---------- filtered /proc/bus/pci/devices ----------
+// libpci's proc method and some GPU info collectors enumerate this list and
+// then read config space per line. Read-only opens get a memfd copy without
+// the NVIDIA lines, so enumeration never leads back to the card.
+#define PCI_DEVICES_CHUNK 4096
+
+// "<bus><devfn>\t<vendor><device>\t...": both fields are fixed-width hex
+static int pci_devices_line_hidden(const struct nh_topo *t, const char *l, size_t n) {
+    if (n < 14 || l[4] != '\t' || strncmp(l + 5, "10de", 4)) return 0;
+    int v = 0;
+    for (int i = 0; i < 4; i++) {
+        int h = nh_hexval(l[i]);
+        if (h < 0) return 0;
+        v = v << 4 | h;
     }
+    // the list carries no domain: match bus and devfn on every domain
+    for (int i = 0; i < t->bdfs_n; i++)
+        if ((t->bdfs[i] & 0xffff) == (uint32_t)v) return 1;
+    return 0;
+}
 
-    // NVIDIA GBM/GL/Vulkan assets
-    if (strstr(p, "nvidia-drm_gbm.so")) return 1;
-    if (strstr(p, "libGLX_nvidia.so")) return 1;
-    if (strstr(p, "/usr/share/vulkan/implicit_layer.d/nvidia")) return 1;
-    if (strstr(p, "/usr/share/vulkan/icd.d/nvidia")) return 1;
+// Keeps the verdict of a line across chunks: a line longer than the buffer
+// is decided on its head, which holds both fields.
+struct pci_filter {
+    const struct nh_topo *t;
+    int fd;
+    int mid, hide;      // inside a line split across chunks, and its verdict
+};
 
-    // Extra: block libnvidia-* opens (still only via open/openat, no dlopen dependency)
-    if (strstr(p, "/usr/lib/libnvidia-")) return 1;
+static int pci_filter_put(struct pci_filter *f, const char *l, size_t n, int eol) {
+    if (!f->mid) f->hide = pci_devices_line_hidden(f->t, l, n);
+    f->mid = !eol;
+    return f->hide || write(f->fd, l, n) == (ssize_t)n ? 0 : -1;
+}
 
-    // Block PCI config reads through ANY sysfs path (bus or devices)
-    // matches ".../<BDF>/config" anywhere under /sys/
-    if (strstr(p, "/sys/") && strstr(p, "/config")) {
-        for (int i=0;i<g_bdfs_n;i++) {
-            char needle[64];
-            snprintf(needle, sizeof(needle), "/%s/config", g_bdfs[i]);
-            if (strstr(p, needle)) return 1;
+// Filters line by line while reading, so a list of any length is filtered.
+static int pci_devices_memfd(int flags) {
+    int src = (int)syscall(SYS_openat, AT_FDCWD, "/proc/bus/pci/devices", O_RDONLY | O_CLOEXEC, 0);
+    if (src < 0) return -1;
+    int fd = (int)syscall(SYS_memfd_create, "nvidia-hide:pci-devices", (flags & O_CLOEXEC) ? MFD_CLOEXEC : 0);
+    if (fd < 0) { close(src); return -1; }
+
+    struct nh_topo topo;
+    live_topo_copy(&topo);
+    struct pci_filter f = { &topo, fd, 0, 0 };
+    char buf[PCI_DEVICES_CHUNK];
+    size_t len = 0;
+    ssize_t n;
+    int err = 0;
+    while (!err && (n = read(src, buf + len, sizeof(buf) - len)) != 0) {
+        if (n < 0) { err = errno != EINTR; continue; }
+        len += (size_t)n;
+        size_t off = 0;
+        const char *nl;
+        while (!err && (nl = memchr(buf + off, '\n', len - off))) {
+            size_t ll = (size_t)(nl - (buf + off)) + 1;
+            err = pci_filter_put(&f, buf + off, ll, 1);
+            off += ll;
         }
+        if (!off && len == sizeof(buf)) {
+            err = pci_filter_put(&f, buf, len, 0);  // no newline in a full buffer
+            off = len;
+        }
+        memmove(buf, buf + off, len - off);
+        len -= off;
     }
-
-    return 0;
+    if (!err && len) err = pci_filter_put(&f, buf, len, 1);
+    close(src);
+    if (err) { close(fd); return -1; }
+    lseek(fd, 0, SEEK_SET);
+    return fd;
 }
 
-static int is_nvidia_dirent(DIR *dirp, const char *name) {
-    if (!g_active) return 0;
-    if (!name) return 0;
+// Open hooks call this after the deny check: a substitute fd, or -1 to
+// open the real file.
+static inline int open_substitute(const char *p, int flags) {
+    if (!p || p[0] != '/' || p[1] != 'p' || strcmp(p, "/proc/bus/pci/devices")) return -1;
+    if ((flags & O_ACCMODE) != O_RDONLY) return -1;
     ensure_init();
+    if (!hooks_on() || !(g_rules & NH_RULE_PROC_PCI) || !live_bdfs_n()) return -1;
+    return pci_devices_memfd(flags);
+}
+
+// ---------- runtime stats (LIBNVIDIAHIDE_STATS) ----------
+// Per-thread call/deny counters and log2(ns) histograms of the time spent
+// deciding. Each thread owns its block (no atomics on the hot path beyond
+// relaxed stores); blocks are chained once into a global list and summed by
+// the exit-time dump.
+//   LIBNVIDIAHIDE_STATS=1       -> $XDG_RUNTIME_DIR/nvidia-hide/stats/<pid>.stats
+//   LIBNVIDIAHIDE_STATS=/dir    -> /dir/<pid>.stats
+//   LIBNVIDIAHIDE_STATS=stderr  -> stderr, same format
+
+enum {
+    H_OPENAT, H_OPEN, H_OPEN64, H_OPENAT2, H_DLOPEN,
+    H_READDIR, H_READDIR64, H_GETDENTS64, H_SCANDIR,
+    H_STAT, H_STATX, H_ACCESS, H_FOPEN, H_URING,
+    H_MAX
+};
 
-    // If it scans /dev, hide /dev/nvidia* names
-    if (!strncmp(name, "nvidia", 5)) return 1;
+static const char *const g_hook_names[H_MAX] = {
+    "openat", "open", "open64", "openat2", "dlopen",
+    "readdir", "readdir64", "getdents64", "scandir",
+    "stat", "statx", "access", "fopen", "io_uring",
+};
 
-    // Hide discovered DRM nodes (cardX/renderD*)
-    if (is_node(name)) return 1;
+#define STAT_BUCKETS 32
 
-    // If scanning /dev/dri/by-path, often includes BDF in symlink name
-    // hide if matches
-    for (int i=0;i<g_bdfs_n;i++) {
-        if (strstr(name, g_bdfs[i])) return 1;
-        // also hide without domain "01:00.0" style
-        const char *colon = strchr(g_bdfs[i], ':');
-        if (colon && strstr(name, colon+1)) return 1;
-    }
+struct thread_stats {
+    struct thread_stats *next;
+    uint64_t calls[H_MAX];
+    uint64_t denied[H_MAX];
+    uint64_t ns[H_MAX];
+    uint64_t hist[H_MAX][STAT_BUCKETS];
+    uint64_t vcache_hits, vcache_misses;
+};
 
-    return 0;
+static int g_stats_fd = -1;     // stderr mode: dup taken at startup, apps often close fd 2 at exit
+static struct thread_stats *g_stats_head = NULL;
+static __thread struct thread_stats *t_stats = NULL;
+
+static inline uint64_t stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
 }
 
-static int deny_ret(void) { errno = ENOENT; return -1; }
+static inline uint64_t stats_t0(void) { return g_stats ? stats_now() : 0; }
+
+static struct thread_stats *stats_self(void) {
+    struct thread_stats *ts = t_stats;
+    if (ts) return ts;
+    // mmap, not malloc: hooks run inside malloc-sensitive contexts, and the
+    // block has to outlive its thread for the exit dump.
+    void *m = mmap(NULL, sizeof(*ts), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m == MAP_FAILED) return NULL;
+    ts = (struct thread_stats*)m;
+    ts->next = __atomic_load_n(&g_stats_head, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&g_stats_head, &ts->next, ts, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) { }
+    t_stats = ts;
+    return ts;
+}
 
-// ---------- hooks ----------
+static inline void stat_add(uint64_t *c, uint64_t v) {
+    __atomic_store_n(c, __atomic_load_n(c, __ATOMIC_RELAXED) + v, __ATOMIC_RELAXED);
+}
 
-typedef int (*openat_f)(int, const char*, int, ...);
-typedef int (*open_f)(const char*, int, ...);
+static void stats_note(int hook, int denied, uint64_t t0) {
+    struct thread_stats *ts = stats_self();
+    if (!ts) return;
+    uint64_t ns = stats_now() - t0;
+    int b = ns ? 64 - __builtin_clzll(ns) : 0;
+    if (b >= STAT_BUCKETS) b = STAT_BUCKETS - 1;
+    stat_add(&ts->calls[hook], 1);
+    if (denied) stat_add(&ts->denied[hook], 1);
+    stat_add(&ts->ns[hook], ns);
+    stat_add(&ts->hist[hook][b], 1);
+}
 
-int openat(int dirfd, const char *pathname, int flags, ...) {
-    static openat_f real_openat = NULL;
-    if (!real_openat) real_openat = (openat_f)dlsym(RTLD_NEXT, "openat");
+static inline void stats_vcache(int hit) {
+    struct thread_stats *ts;
+    if (!g_stats || !(ts = stats_self())) return;
+    stat_add(hit ? &ts->vcache_hits : &ts->vcache_misses, 1);
+}
+
+// forked children start from zero instead of inheriting the parent's counts
+static void stats_atfork_child(void) {
+    g_init_ns = g_init_wait_ns = 0;
+    g_init_waits = 0;
+    for (struct thread_stats *ts = g_stats_head; ts; ts = ts->next) {
+        struct thread_stats *next = ts->next;
+        memset(ts, 0, sizeof(*ts));
+        ts->next = next;
+    }
+}
 
-    if (is_nvidia_path(pathname)) return deny_ret();
+static void stats_dump(void) {
+    struct thread_stats sum;
+    memset(&sum, 0, sizeof(sum));
+    for (struct thread_stats *ts = __atomic_load_n(&g_stats_head, __ATOMIC_ACQUIRE); ts; ts = ts->next) {
+        for (int h = 0; h < H_MAX; h++) {
+            sum.calls[h]  += __atomic_load_n(&ts->calls[h], __ATOMIC_RELAXED);
+            sum.denied[h] += __atomic_load_n(&ts->denied[h], __ATOMIC_RELAXED);
+            sum.ns[h]     += __atomic_load_n(&ts->ns[h], __ATOMIC_RELAXED);
+            for (int b = 0; b < STAT_BUCKETS; b++)
+                sum.hist[h][b] += __atomic_load_n(&ts->hist[h][b], __ATOMIC_RELAXED);
+        }
+        sum.vcache_hits   += __atomic_load_n(&ts->vcache_hits, __ATOMIC_RELAXED);
+        sum.vcache_misses += __atomic_load_n(&ts->vcache_misses, __ATOMIC_RELAXED);
+    }
 
-    va_list ap;
-    va_start(ap, flags);
-    int fd;
-    if (flags & O_CREAT) {
-        mode_t mode = va_arg(ap, mode_t);
-        fd = real_openat(dirfd, pathname, flags, mode);
+    const char *env = getenv("LIBNVIDIAHIDE_STATS");
+    char path[PATH_MAX];
+    int fd = -1;
+    if (env && !strcmp(env, "stderr")) {
+        if ((fd = g_stats_fd) < 0) return;
     } else {
-        fd = real_openat(dirfd, pathname, flags);
+        char dir[PATH_MAX];
+        const char *rt = getenv("XDG_RUNTIME_DIR");
+        if (env && env[0] == '/') snprintf(dir, sizeof(dir), "%s", env);
+        else if (rt && rt[0] == '/') {
+            snprintf(dir, sizeof(dir), "%s/nvidia-hide", rt);
+            mkdir(dir, 0700);
+            snprintf(dir, sizeof(dir), "%s/nvidia-hide/stats", rt);
+        } else return;
+        mkdir(dir, 0700);
+        if (snprintf(path, sizeof(path), "%s/%d.stats", dir, (int)getpid()) >= (int)sizeof(path)) return;
+        fd = (int)syscall(SYS_openat, AT_FDCWD, path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0) return;
     }
-    va_end(ap);
-    return fd;
+
+    char exe[PATH_MAX];
+    if (read_self_exe(exe, sizeof(exe)) < 0) snprintf(exe, sizeof(exe), "?");
+    dprintf(fd, "nvidia-hide-stats 1\npid %d\nppid %d\nactive %d\nexe %s\n",
+            (int)getpid(), (int)getppid(), nh_active(), exe);
+    for (int h = 0; h < H_MAX; h++) {
+        if (!sum.calls[h]) continue;
+        dprintf(fd, "hook %s %llu %llu %llu", g_hook_names[h],
+                (unsigned long long)sum.calls[h], (unsigned long long)sum.denied[h],
+                (unsigned long long)sum.ns[h]);
+        for (int b = 0; b < STAT_BUCKETS; b++) dprintf(fd, " %llu", (unsigned long long)sum.hist[h][b]);
+        dprintf(fd, "\n");
+    }
+    if (g_init_ns || g_init_waits)
+        dprintf(fd, "init %llu %u %llu\n", (unsigned long long)g_init_ns,
+                __atomic_load_n(&g_init_waits, __ATOMIC_RELAXED),
+                (unsigned long long)__atomic_load_n(&g_init_wait_ns, __ATOMIC_RELAXED));
+    if (sum.vcache_hits || sum.vcache_misses)
+        dprintf(fd, "vcache %llu %llu\n", (unsigned long long)sum.vcache_hits,
+                (unsigned long long)sum.vcache_misses);
+    if (fd != g_stats_fd) close(fd);
 }
 
-// Also hook open/open64 for completeness (some paths use these)
-int open(const char *pathname, int flags, ...) {
-    static open_f real_open = NULL;
-    if (!real_open) real_open = (open_f)dlsym(RTLD_NEXT, "open");
+static void stats_init(void) {
+    const char *env = getenv("LIBNVIDIAHIDE_STATS");
+    if (!env || !*env || !strcmp(env, "0")) return;
+    g_stats = 1;
+    if (!strcmp(env, "stderr")) g_stats_fd = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 3);
+    pthread_atfork(NULL, NULL, stats_atfork_child);
+}
 
-    if (is_nvidia_path(pathname)) return deny_ret();
+__attribute__((destructor))
+static void stats_dtor(void) {
+    if (g_stats) stats_dump();
+}
 
-    va_list ap;
-    va_start(ap, flags);
-    int fd;
-    if (flags & O_CREAT) {
-        mode_t mode = va_arg(ap, mode_t);
-        fd = real_open(pathname, flags, mode);
-    } else {
-        fd = real_open(pathname, flags);
+// ---------- event log (LIBNVIDIAHIDE_DEBUG) ----------
+// A power-of-two ring of 64-byte slots (struct nh_log_event plus a commit
+// word). Writers claim a slot with one CAS on head, fill it and publish it
+// by storing pos + 1 into seq; a full ring drops the event and counts it,
+// writers never wait. Draining is done by whichever writer crosses the
+// half-full mark (one write(2) per batch, under a try-lock) and by the
+// destructor; there is no thread of our own.
+//   LIBNVIDIAHIDE_DEBUG=1       -> $XDG_RUNTIME_DIR/nvidia-hide/log/<pid>.log
+//   LIBNVIDIAHIDE_DEBUG=/dir    -> /dir/<pid>.log
+//   LIBNVIDIAHIDE_DEBUG=stderr  -> dbg() text on stderr, no hook events
+#define LOG_SLOTS 4096
+#define LOG_BATCH 32
+
+struct log_slot {
+    uint64_t seq;
+    struct nh_log_event ev;
+};
+_Static_assert(sizeof(struct log_slot) == 64, "one slot per cache line");
+_Static_assert(H_MAX <= NH_LOG_MAX_HOOKS, "hook names must fit the log header");
+
+static struct log_slot *g_log_ring = NULL;  // mmap'd by log_init
+static uint64_t g_log_head, g_log_tail, g_log_drops;
+static int g_log_flushing = 0;
+static int g_log_fd = -1;
+static char g_log_dir[PATH_MAX];
+static __thread uint32_t t_log_tid;
+static __thread uint32_t t_log_msgid;
+
+static struct nh_log_event *log_claim(uint64_t *pos) {
+    uint64_t h = __atomic_load_n(&g_log_head, __ATOMIC_RELAXED);
+    do {
+        if (h - __atomic_load_n(&g_log_tail, __ATOMIC_ACQUIRE) >= LOG_SLOTS) {
+            __atomic_fetch_add(&g_log_drops, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+    } while (!__atomic_compare_exchange_n(&g_log_head, &h, h + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    if (!t_log_tid) t_log_tid = (uint32_t)syscall(SYS_gettid);
+    struct nh_log_event *ev = &g_log_ring[h & (LOG_SLOTS - 1)].ev;
+    memset(ev, 0, sizeof(*ev));
+    ev->ts_ns = stats_now();
+    ev->tid = t_log_tid;
+    *pos = h;
+    return ev;
+}
+
+static int log_open(void) {
+    char path[PATH_MAX + 32];
+    if (nh_runtime_path(path, sizeof(path), NULL) == 0 && !strncmp(g_log_dir, path, strlen(path)))
+        mkdir(path, 0700);
+    mkdir(g_log_dir, 0700);
+    // an exec'd image keeps the pid: take the next free name instead of
+    // appending a second header
+    int fd = -1, pid = (int)getpid();
+    for (int k = 0; k < 16 && fd < 0; k++) {
+        if (k) snprintf(path, sizeof(path), "%s/%d-%d.log", g_log_dir, pid, k);
+        else snprintf(path, sizeof(path), "%s/%d.log", g_log_dir, pid);
+        fd = (int)syscall(SYS_openat, AT_FDCWD, path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (fd < 0 && errno != EEXIST) return -1;
     }
-    va_end(ap);
+    if (fd < 0) return -1;
+
+    struct nh_log_header hd;
+    memset(&hd, 0, sizeof(hd));
+    hd.magic = NH_LOG_MAGIC;
+    hd.version = NH_LOG_VERSION;
+    hd.pid = pid;
+    hd.ppid = (int32_t)getppid();
+    hd.event_size = sizeof(struct nh_log_event);
+    hd.nhooks = H_MAX;
+    for (int h = 0; h < H_MAX; h++) snprintf(hd.hooks[h], sizeof(hd.hooks[h]), "%s", g_hook_names[h]);
+    char exe[PATH_MAX];
+    if (read_self_exe(exe, sizeof(exe)) == 0) snprintf(hd.exe, sizeof(hd.exe), "%.*s", (int)sizeof(hd.exe) - 1, exe);
+    if (write(fd, &hd, sizeof(hd)) != (ssize_t)sizeof(hd)) { close(fd); return -1; }
     return fd;
 }
 
-int open64(const char *pathname, int flags, ...) {
-    static open_f real_open64 = NULL;
-    if (!real_open64) real_open64 = (open_f)dlsym(RTLD_NEXT, "open64");
+// Writes out every committed slot from tail on. Stops at the first slot
+// that is claimed but not yet published; its writer finishes it later.
+static void log_flush(void) {
+    if (!g_log_ring || __atomic_exchange_n(&g_log_flushing, 1, __ATOMIC_ACQUIRE)) return;
+    if (g_log_fd == -1) g_log_fd = log_open();
+    struct nh_log_event batch[LOG_BATCH];
+    uint64_t t = __atomic_load_n(&g_log_tail, __ATOMIC_RELAXED);
+    for (;;) {
+        int n = 0;
+        while (n < LOG_BATCH) {
+            const struct log_slot *s = &g_log_ring[(t + (uint64_t)n) & (LOG_SLOTS - 1)];
+            if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != t + (uint64_t)n + 1) break;
+            batch[n++] = s->ev;
+        }
+        if (n) {
+            // on a failed open or write the events are discarded: the ring must keep moving
+            if (g_log_fd >= 0 && write(g_log_fd, batch, (size_t)n * sizeof(batch[0])) < 0) {
+                close(g_log_fd);
+                g_log_fd = -2;
+            }
+            t += (uint64_t)n;
+            __atomic_store_n(&g_log_tail, t, __ATOMIC_RELEASE);
+            continue;
+        }
+        // the ring is drained: account for what was dropped, then write that out too
+        uint64_t lost = __atomic_exchange_n(&g_log_drops, 0, __ATOMIC_RELAXED), pos;
+        if (!lost) break;
+        struct nh_log_event *ev = log_claim(&pos);
+        if (!ev) { __atomic_fetch_add(&g_log_drops, lost, __ATOMIC_RELAXED); break; }
+        ev->kind = NH_LOG_DROP;
+        ev->hash = lost;
+        __atomic_store_n(&g_log_ring[pos & (LOG_SLOTS - 1)].seq, pos + 1, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&g_log_flushing, 0, __ATOMIC_RELEASE);
+}
+
+static void log_commit(uint64_t pos) {
+    __atomic_store_n(&g_log_ring[pos & (LOG_SLOTS - 1)].seq, pos + 1, __ATOMIC_RELEASE);
+    if (pos - __atomic_load_n(&g_log_tail, __ATOMIC_RELAXED) >= LOG_SLOTS / 2) log_flush();
+}
 
-    if (is_nvidia_path(pathname)) return deny_ret();
+static void log_msg(const char *s) {
+    if (!g_log_ring) return;
+    size_t n = strlen(s), off = 0;
+    uint32_t id = ++t_log_msgid;
+    for (int k = 0; ; k++) {
+        size_t c = n - off < NH_LOG_TEXT ? n - off : NH_LOG_TEXT;
+        uint64_t pos;
+        struct nh_log_event *ev = log_claim(&pos);
+        if (!ev) return;
+        ev->kind = NH_LOG_MSG;
+        ev->hash = id;
+        ev->hook = (uint8_t)k;
+        ev->verdict = off + c >= n;
+        memcpy(ev->text, s + off, c);
+        log_commit(pos);
+        if ((off += c) >= n) return;
+    }
+}
 
-    va_list ap;
-    va_start(ap, flags);
-    int fd;
-    if (flags & O_CREAT) {
-        mode_t mode = va_arg(ap, mode_t);
-        fd = real_open64(pathname, flags, mode);
+// Long paths keep their head and tail ("/sys/devices/..0000:01:00.0/config"):
+// the part in between is what every path under the same root shares.
+static void log_hook(int hook, int denied, const char *p) {
+    uint64_t pos;
+    struct nh_log_event *ev = log_claim(&pos);
+    if (!ev) return;
+    size_t n = strlen(p);
+    ev->kind = NH_LOG_HOOK;
+    ev->hook = (uint8_t)hook;
+    ev->verdict = (uint8_t)(denied != 0);
+    ev->hash = nh_hash64(NH_HASH_SEED, p, n);
+    if (n <= NH_LOG_TEXT) {
+        memcpy(ev->text, p, n);
     } else {
-        fd = real_open64(pathname, flags);
+        memcpy(ev->text, p, 12);
+        memcpy(ev->text + 12, "..", 2);
+        memcpy(ev->text + 14, p + n - (NH_LOG_TEXT - 14), NH_LOG_TEXT - 14);
     }
-    va_end(ap);
-    return fd;
+    log_commit(pos);
 }
 
-// Hook openat2 if present
-typedef int (*openat2_f)(int, const char*, const struct open_how*, size_t);
-int openat2(int dirfd, const char *pathname, const struct open_how *how, size_t size) {
-    static openat2_f real_openat2 = NULL;
-    if (!real_openat2) real_openat2 = (openat2_f)dlsym(RTLD_NEXT, "openat2");
+// forked children drop whatever the parent had not flushed yet and log to their own file
+static void log_atfork_child(void) {
+    __atomic_store_n(&g_log_tail, __atomic_load_n(&g_log_head, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_store_n(&g_log_drops, 0, __ATOMIC_RELAXED);
+    g_log_flushing = 0;
+    if (g_log_fd >= 0) close(g_log_fd);
+    g_log_fd = -1;
+    t_log_tid = 0;
+}
 
-    if (is_nvidia_path(pathname)) return deny_ret();
+static void log_init(void) {
+    static int done;
+    if (done) return;
+    done = 1;
+    const char *env = getenv("LIBNVIDIAHIDE_DEBUG");
+    if (!env || !*env || !strcmp(env, "0")) return;
+    g_debug = DEBUG_STDERR;
+    if (!strcmp(env, "stderr")) return;
+    if (env[0] == '/') snprintf(g_log_dir, sizeof(g_log_dir), "%s", env);
+    else if (nh_runtime_path(g_log_dir, sizeof(g_log_dir), "log") != 0) return;  // no runtime dir: stderr
+    void *m = mmap(NULL, LOG_SLOTS * sizeof(struct log_slot), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m == MAP_FAILED) return;
+    g_log_ring = (struct log_slot*)m;
+    g_debug = DEBUG_LOG;
+    pthread_atfork(NULL, NULL, log_atfork_child);
+}
 
-    if (real_openat2) return real_openat2(dirfd, pathname, how, size);
-    #ifdef SYS_openat2
-    return (int)syscall(SYS_openat2, dirfd, pathname, how, size);
-    #else
-    errno = ENOSYS;
-    return -1;
-    #endif
+__attribute__((destructor))
+static void log_dtor(void) {
+    if (g_log_ring) log_flush();
 }
 
-/* ---- Block dlopen of NVIDIA libs ---- */
-typedef void* (*dlopen_f)(const char*, int);
+// ---------- denial call sites (LIBNVIDIAHIDE_TRACE) ----------
+// Each denial captures a short backtrace with _Unwind_Backtrace and counts
+// it in a fixed table of unique (hook, stack) pairs. Nothing is symbolized
+// until the exit dump, which resolves frames with dladdr and writes folded
+// stacks ("root;...;leaf;[hook] count") ready for flamegraph.pl.
+//   LIBNVIDIAHIDE_TRACE=1       -> $XDG_RUNTIME_DIR/nvidia-hide/trace/<pid>.folded
+//   LIBNVIDIAHIDE_TRACE=/dir    -> /dir/<pid>.folded
+//   LIBNVIDIAHIDE_TRACE=stderr  -> stderr, same format
+#define TRACE_SLOTS  1024
+#define TRACE_PROBES 16
+#define TRACE_DEPTH  24
+
+struct trace_ent {
+    uint64_t key;           // 0 = free; hash of hook and pcs
+    uint64_t count;
+    int      ready;         // pcs/depth published
+    int      hook, depth;
+    uintptr_t pcs[TRACE_DEPTH];
+};
 
-void *dlopen(const char *filename, int flags) {
-    static dlopen_f real_dlopen = NULL;
-    static __thread int in_hook = 0;
-
-    if (!real_dlopen) {
-        if (in_hook) { errno = ENOENT; return NULL; }
-        in_hook = 1;
-        real_dlopen = (dlopen_f)dlsym(RTLD_NEXT, "dlopen");
-        in_hook = 0;
-    }
-
-    if (filename && (
-        strstr(filename, "nvidia") ||
-        strstr(filename, "libGLX_nvidia") ||
-        strstr(filename, "nvidia-drm_gbm.so") ||
-        strstr(filename, "libnvidia-")
-    )) {
-        errno = ENOENT;
-        return NULL;
+static struct trace_ent *g_trace = NULL;    // mmap'd by trace_init
+static uint64_t g_trace_lost;               // table full
+static int g_trace_fd = -1;                 // stderr mode: dup taken at startup
+
+struct trace_walk {
+    uintptr_t *pcs;
+    int n;
+};
+
+static _Unwind_Reason_Code trace_frame(struct _Unwind_Context *ctx, void *arg) {
+    struct trace_walk *w = arg;
+    uintptr_t ip = (uintptr_t)_Unwind_GetIP(ctx);
+    if (!ip) return _URC_END_OF_STACK;
+    w->pcs[w->n++] = ip - 1;    // return address -> inside the call
+    return w->n < TRACE_DEPTH ? _URC_NO_REASON : _URC_END_OF_STACK;
+}
+
+static void trace_note(int hook) {
+    uintptr_t pcs[TRACE_DEPTH];
+    struct trace_walk w = { pcs, 0 };
+    _Unwind_Backtrace(trace_frame, &w);
+    if (!w.n) return;
+    uint64_t key = nh_hash64(nh_hash64(NH_HASH_SEED, &hook, sizeof(hook)), pcs, (size_t)w.n * sizeof(pcs[0]));
+    if (!key) key = 1;
+    for (unsigned i = 0, h = (unsigned)(key >> 32); i < TRACE_PROBES; i++) {
+        struct trace_ent *e = &g_trace[(h + i) & (TRACE_SLOTS - 1)];
+        uint64_t k = __atomic_load_n(&e->key, __ATOMIC_ACQUIRE);
+        if (!k && __atomic_compare_exchange_n(&e->key, &k, key, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            e->hook = hook;
+            e->depth = w.n;
+            memcpy(e->pcs, pcs, (size_t)w.n * sizeof(pcs[0]));
+            __atomic_store_n(&e->ready, 1, __ATOMIC_RELEASE);
+            k = key;
+        }
+        if (k == key) {
+            __atomic_fetch_add(&e->count, 1, __ATOMIC_RELAXED);
+            return;
+        }
     }
+    __atomic_fetch_add(&g_trace_lost, 1, __ATOMIC_RELAXED);
+}
 
-    return real_dlopen ? real_dlopen(filename, flags) : NULL;
+// "libfoo.so.1`symbol", or "libfoo.so.1+0x1234" without a dynamic symbol
+static void trace_frame_name(char *out, size_t out_sz, uintptr_t pc) {
+    Dl_info di;
+    if (!dladdr((void*)pc, &di) || !di.dli_fname) { snprintf(out, out_sz, "0x%lx", (unsigned long)pc); return; }
+    const char *dso = nh_base_name(di.dli_fname);
+    if (!*dso) dso = "[exe]";
+    if (di.dli_sname) snprintf(out, out_sz, "%s`%s", dso, di.dli_sname);
+    else snprintf(out, out_sz, "%s+0x%lx", dso, (unsigned long)(pc - (uintptr_t)di.dli_fbase));
 }
 
-/* ---- Hide NVIDIA entries from directory enumeration ---- */
-typedef struct dirent *(*readdir_f)(DIR*);
-typedef struct dirent64 *(*readdir64_f)(DIR*);
+static void trace_dump(void) {
+    const char *env = getenv("LIBNVIDIAHIDE_TRACE");
+    int fd = -1;
+    if (env && !strcmp(env, "stderr")) {
+        if ((fd = g_trace_fd) < 0) return;
+    } else {
+        char dir[PATH_MAX], path[PATH_MAX + 32];
+        if (env && env[0] == '/') snprintf(dir, sizeof(dir), "%s", env);
+        else if (nh_runtime_path(dir, sizeof(dir), NULL) == 0) {
+            mkdir(dir, 0700);
+            if (nh_runtime_path(dir, sizeof(dir), "trace") != 0) return;
+        } else return;
+        mkdir(dir, 0700);
+        snprintf(path, sizeof(path), "%s/%d.folded", dir, (int)getpid());
+        fd = (int)syscall(SYS_openat, AT_FDCWD, path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0) return;
+    }
 
-struct dirent *readdir(DIR *dirp) {
-    static readdir_f real_readdir = NULL;
-    if (!real_readdir) real_readdir = (readdir_f)dlsym(RTLD_NEXT, "readdir");
+    Dl_info self;
+    void *self_base = dladdr((void*)trace_dump, &self) ? self.dli_fbase : NULL;
+    char exe[PATH_MAX], frame[512];
+    if (read_self_exe(exe, sizeof(exe)) < 0) snprintf(exe, sizeof(exe), "?");
+    for (int i = 0; i < TRACE_SLOTS; i++) {
+        const struct trace_ent *e = &g_trace[i];
+        if (!__atomic_load_n(&e->ready, __ATOMIC_ACQUIRE)) continue;
+        // our own frames (hook, decision, capture) sit at the leaf end
+        int top = 0;
+        Dl_info di;
+        while (top < e->depth && dladdr((void*)e->pcs[top], &di) && di.dli_fbase == self_base) top++;
+        // root first; the process is the root frame so trees from many pids merge per exe
+        dprintf(fd, "%s", nh_base_name(exe));
+        for (int k = e->depth - 1; k >= top; k--) {
+            trace_frame_name(frame, sizeof(frame), e->pcs[k]);
+            for (char *c = frame; *c; c++) if (*c == ';' || *c == ' ') *c = '_';
+            dprintf(fd, ";%s", frame);
+        }
+        dprintf(fd, ";[%s] %llu\n", g_hook_names[e->hook],
+                (unsigned long long)__atomic_load_n(&e->count, __ATOMIC_RELAXED));
+    }
+    uint64_t lost = __atomic_load_n(&g_trace_lost, __ATOMIC_RELAXED);
+    if (lost) dprintf(fd, "%s;[table_full] %llu\n", nh_base_name(exe), (unsigned long long)lost);
+    if (fd != g_trace_fd) close(fd);
+}
 
-    struct dirent *ent;
-    while ((ent = real_readdir(dirp)) != NULL) {
-        if (!is_nvidia_dirent(dirp, ent->d_name)) return ent;
+// forked children count their own denials
+static void trace_atfork_child(void) {
+    memset(g_trace, 0, TRACE_SLOTS * sizeof(*g_trace));
+    g_trace_lost = 0;
+}
+
+static void trace_init(void) {
+    const char *env = getenv("LIBNVIDIAHIDE_TRACE");
+    if (!env || !*env || !strcmp(env, "0")) return;
+    void *m = mmap(NULL, TRACE_SLOTS * sizeof(struct trace_ent), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m == MAP_FAILED) return;
+    if (!strcmp(env, "stderr")) g_trace_fd = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 3);
+    g_trace = (struct trace_ent*)m;
+    pthread_atfork(NULL, NULL, trace_atfork_child);
+}
+
+__attribute__((destructor))
+static void trace_dtor(void) {
+    if (g_trace) trace_dump();
+}
+
+// ---------- path recording (LIBNVIDIAHIDE_RECORD) ----------
+// Every decided path goes into one process-wide buffer under a spinlock and
+// is written out when the buffer fills and at exit. Recording is for
+// building replay corpora, not for production: a full buffer costs the
+// caller one write(2). A hook re-entered on the same thread (a signal
+// handler) drops its record rather than spin on its own lock.
+//   LIBNVIDIAHIDE_RECORD=1      -> $XDG_RUNTIME_DIR/nvidia-hide/record/<pid>.rec
+//   LIBNVIDIAHIDE_RECORD=/dir   -> /dir/<pid>.rec
+#define REC_BUF (256 * 1024)
+
+static char *g_rec_buf = NULL;      // mmap'd by rec_init
+static size_t g_rec_used;
+static int g_rec_lock = 0;
+static int g_rec_fd = -1;
+static char g_rec_dir[PATH_MAX];
+static __thread int t_in_rec;
+
+static int rec_open(void) {
+    char path[PATH_MAX + 32];
+    if (nh_runtime_path(path, sizeof(path), NULL) == 0 && !strncmp(g_rec_dir, path, strlen(path)))
+        mkdir(path, 0700);
+    mkdir(g_rec_dir, 0700);
+    int fd = -1, pid = (int)getpid();
+    for (int k = 0; k < 16 && fd < 0; k++) {
+        if (k) snprintf(path, sizeof(path), "%s/%d-%d.rec", g_rec_dir, pid, k);
+        else snprintf(path, sizeof(path), "%s/%d.rec", g_rec_dir, pid);
+        fd = (int)syscall(SYS_openat, AT_FDCWD, path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (fd < 0 && errno != EEXIST) return -1;
     }
-    return NULL;
+    if (fd < 0) return -1;
+
+    struct nh_rec_header hd;
+    memset(&hd, 0, sizeof(hd));
+    hd.magic = NH_REC_MAGIC;
+    hd.version = NH_REC_VERSION;
+    hd.pid = pid;
+    hd.ppid = (int32_t)getppid();
+    hd.nhooks = H_MAX;
+    for (int h = 0; h < H_MAX; h++) snprintf(hd.hooks[h], sizeof(hd.hooks[h]), "%s", g_hook_names[h]);
+    // the first flush may come before any candidate triggered discovery
+    ensure_init();
+    struct nh_topo topo;
+    live_topo_copy(&topo);
+    nh_snapshot_encode(hd.snapshot, sizeof(hd.snapshot), 0, 1, g_rules, &topo);
+    char exe[PATH_MAX];
+    if (read_self_exe(exe, sizeof(exe)) == 0) snprintf(hd.exe, sizeof(hd.exe), "%.*s", (int)sizeof(hd.exe) - 1, exe);
+    if (write(fd, &hd, sizeof(hd)) != (ssize_t)sizeof(hd)) { close(fd); return -1; }
+    return fd;
 }
 
-struct dirent64 *readdir64(DIR *dirp) {
-    static readdir64_f real_readdir64 = NULL;
-    if (!real_readdir64) real_readdir64 = (readdir64_f)dlsym(RTLD_NEXT, "readdir64");
+// caller holds g_rec_lock; a failed open or write discards and stops recording
+static void rec_flush_locked(void) {
+    if (!g_rec_used) return;
+    if (g_rec_fd == -1) g_rec_fd = rec_open();
+    if (g_rec_fd >= 0 && write(g_rec_fd, g_rec_buf, g_rec_used) != (ssize_t)g_rec_used) {
+        close(g_rec_fd);
+        g_rec_fd = -2;
+    }
+    g_rec_used = 0;
+}
 
-    struct dirent64 *ent;
-    while ((ent = real_readdir64(dirp)) != NULL) {
-        if (!is_nvidia_dirent(dirp, ent->d_name)) return ent;
+static void rec_note(int hook, int verdict, int dircls, const char *p) {
+    if (t_in_rec || !p) return;
+    size_t n = strlen(p);
+    if (n > UINT16_MAX) return;
+    t_in_rec = 1;
+    while (__atomic_exchange_n(&g_rec_lock, 1, __ATOMIC_ACQUIRE)) sched_yield();
+    if (g_rec_used + sizeof(struct nh_rec) + n > REC_BUF) rec_flush_locked();
+    // entry and library names are not paths; only paths resolve against a directory
+    int relative = p[0] != '/' && hook != H_DLOPEN && (hook < H_READDIR || hook > H_SCANDIR);
+    struct nh_rec r = { (uint8_t)hook, (uint8_t)(verdict != 0), (uint8_t)(dircls > 0 ? dircls : 0),
+                        (uint8_t)relative, (uint16_t)n };
+    memcpy(g_rec_buf + g_rec_used, &r, sizeof(r));
+    memcpy(g_rec_buf + g_rec_used + sizeof(r), p, n);
+    g_rec_used += sizeof(r) + n;
+    __atomic_store_n(&g_rec_lock, 0, __ATOMIC_RELEASE);
+    t_in_rec = 0;
+}
+
+// forked children record to their own file, without the parent's backlog
+static void rec_atfork_child(void) {
+    g_rec_lock = 0;
+    g_rec_used = 0;
+    if (g_rec_fd >= 0) close(g_rec_fd);
+    g_rec_fd = -1;
+}
+
+static void rec_init(void) {
+    const char *env = getenv("LIBNVIDIAHIDE_RECORD");
+    if (!env || !*env || !strcmp(env, "0")) return;
+    if (env[0] == '/') snprintf(g_rec_dir, sizeof(g_rec_dir), "%s", env);
+    else if (nh_runtime_path(g_rec_dir, sizeof(g_rec_dir), "record") != 0) return;
+    void *m = mmap(NULL, REC_BUF, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (m == MAP_FAILED) return;
+    g_rec_buf = (char*)m;
+    pthread_atfork(NULL, NULL, rec_atfork_child);
+}
+
+__attribute__((destructor))
+static void rec_dtor(void) {
+    if (!g_rec_buf) return;
+    while (__atomic_exchange_n(&g_rec_lock, 1, __ATOMIC_ACQUIRE)) sched_yield();
+    rec_flush_locked();
+    __atomic_store_n(&g_rec_lock, 0, __ATOMIC_RELEASE);
+}
+
+// Hook-side entry points: the decision plus its accounting.
+// Relative paths resolve against dirfd (AT_FDCWD for the non-at calls).
+static inline int path_denied(int hook, int dirfd, const char *p) {
+    uint64_t t0 = stats_t0();
+    int deny = is_nvidia_path_at(dirfd, p);
+    if (g_stats) stats_note(hook, deny, t0);
+    if (g_log_ring && p && (nh_path_root(p) != NH_ROOT_NONE || deny)) log_hook(hook, deny, p);
+    if (g_trace && deny) trace_note(hook);
+    if (g_rec_buf && p) rec_note(hook, deny, 0, p);
+    return deny;
+}
+
+// Recordings carry the class of every listed directory, not only of those a
+// candidate name made us classify, so learn sees which listings were filtered
+// whatever entries this machine has.
+static int rec_dircls(DIR *dirp) {
+    int cls = dirtab_get(dirp);
+    if (cls < 0) {
+        ensure_init();
+        cls = hooks_on() ? listing_cls(classify_dir(dirp)) : DIR_OTHER;
+        dirtab_put(dirp, cls);
     }
-    return NULL;
+    return cls;
 }
+
+static inline int dirent_denied(int hook, DIR *dirp, const char *name) {
+    uint64_t t0 = stats_t0();
+    int deny = is_nvidia_dirent(dirp, name);
+    if (g_stats) stats_note(hook, deny, t0);
+    if (g_log_ring && name && dirent_maybe_nvidia(name)) log_hook(hook, deny, name);
+    if (g_trace && deny) trace_note(hook);
+    if (g_rec_buf && name) rec_note(hook, deny, rec_dircls(dirp), name);
+    return deny;
+}
+
+static int is_nvidia_lib(const char *filename) {
+    if (!hooks_on()) return 0;
+    // Names without "nvidia" never trigger init.
+    if (!filename || !nh_lib_is_nvidia(filename)) return 0;
+    ensure_init();
+    return hooks_on() && (g_rules & NH_RULE_DLOPEN);
+}
+
+static int deny_ret(void) { errno = ENOENT; return -1; }
+
+// ---------- replay entry points (bench/replay) ----------
+// bench/replay dlopens the library RTLD_LOCAL, so none of the hooks are
+// interposed on it, and drives the decision functions directly with
+// recorded paths. Nothing in a preloaded process calls these.
+
+// Hook id for a name from a recording's header; -1 if this build lacks it.
+int nh_replay_hook(const char *name) {
+    for (int h = 0; h < H_MAX; h++) if (!strcmp(g_hook_names[h], name)) return h;
+    return -1;
+}
+
+// Forces the library active, swaps in a recording's topology and rule
+// groups and sets the verdict cache; every call retires the per-thread
+// caches. 0 on success.
+int nh_replay_setup(const char *snapshot, int vcache) {
+    struct nh_topo t;
+    uint64_t token;
+    int active;
+    unsigned rules = NH_RULE_ALL;
+    memset(&t, 0, sizeof(t));
+    if (snapshot && *snapshot && nh_snapshot_decode(snapshot, &token, &active, &rules, &t) != 0) return -1;
+    ensure_init();
+    if (__atomic_load_n(&g_state, __ATOMIC_ACQUIRE) == NH_READY_INACTIVE) {
+        // the policy turned the harness off: build what init skipped
+        build_matcher();
+        record_known_dirs();
+        __atomic_store_n(&g_state, NH_READY_ACTIVE, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&g_active, 1, __ATOMIC_RELAXED);
+    g_shm = NULL;   // a running daemon must not swap the topology mid-replay
+    if (rules != g_rules) nh_matcher_build(&g_match, g_rules = rules);
+    g_topo = t;
+    topo_write_begin(&g_topos[0]);
+    g_topos[0].t = t;
+    topo_write_end(&g_topos[0]);
+    __atomic_store_n(&g_live, &g_topos[0], __ATOMIC_RELEASE);
+    __atomic_add_fetch(&g_vgen, 1, __ATOMIC_RELEASE);
+    g_vcache_on = vcache;
+    return 0;
+}
+
+// The hook's verdict for one record. Entry names skip the DIR* lookup of
+// is_nvidia_dirent and take the directory class the recording saw.
+int nh_replay_decide(int hook, int dircls, const char *p) {
+    switch (hook) {
+    case H_DLOPEN:
+        return is_nvidia_lib(p);
+    case H_READDIR: case H_READDIR64: case H_GETDENTS64: case H_SCANDIR:
+        return dirent_maybe_nvidia(p) && listing_cls(dircls) != DIR_OTHER && dirent_hidden_in(dircls, p);
+    default:
+        return is_nvidia_path_at(AT_FDCWD, p);
+    }
+}
+
+// ---------- hooks ----------
+// Every real entry point is resolved once, by the constructor, into g_real.
+// In an inactive process each hook is then one predictable branch on
+// hooks_on() plus the forward. IFUNC resolvers were not an option: they run
+// during relocation, before the environment and the policy can be read.
+
+typedef int (*openat_f)(int, const char*, int, ...);
+typedef int (*open_f)(const char*, int, ...);
+typedef int (*openat2_f)(int, const char*, const struct open_how*, size_t);
+typedef int (*open_2_f)(const char*, int);
+typedef int (*openat_2_f)(int, const char*, int);
+typedef FILE *(*fopen_f)(const char*, const char*);
+typedef void* (*dlopen_f)(const char*, int);
+typedef struct dirent *(*readdir_f)(DIR*);
+typedef struct dirent64 *(*readdir64_f)(DIR*);
+typedef ssize_t (*getdents64_f)(int, void*, size_t);
+typedef int (*scandir_filter_f)(const struct dirent*);
+typedef int (*scandir_cmp_f)(const struct dirent**, const struct dirent**);
+typedef int (*scandir_f)(const char*, struct dirent***, scandir_filter_f, scandir_cmp_f);
+typedef int (*scandir64_filter_f)(const struct dirent64*);
+typedef int (*scandir64_cmp_f)(const struct dirent64**, const struct dirent64**);
+typedef int (*scandir64_f)(const char*, struct dirent64***, scandir64_filter_f, scandir64_cmp_f);
+typedef int (*closedir_f)(DIR*);
+typedef int (*stat_f)(const char*, struct stat*);
+typedef int (*fstatat_f)(int, const char*, struct stat*, int);
+typedef int (*stat64_f)(const char*, struct stat64*);
+typedef int (*fstatat64_f)(int, const char*, struct stat64*, int);
+typedef int (*statx_f)(int, const char*, int, unsigned int, struct statx*);
+typedef int (*access_f)(const char*, int);
+typedef int (*faccessat_f)(int, const char*, int, int);
+typedef int (*xstat_f)(int, const char*, struct stat*);
+typedef int (*fxstatat_f)(int, int, const char*, struct stat*, int);
+typedef int (*xstat64_f)(int, const char*, struct stat64*);
+typedef int (*fxstatat64_f)(int, int, const char*, struct stat64*, int);
+typedef long (*syscall_f)(long, ...);
+typedef int (*close_f)(int);
+typedef int (*uring_submit_f)(void*);
+typedef int (*uring_submit_wait_f)(void*, unsigned);
+typedef int (*uring_submit_wait_timeout_f)(void*, void**, unsigned, void*, void*);
+typedef int (*pthread_create_f)(pthread_t*, const pthread_attr_t*, void *(*)(void*), void*);
+typedef int (*sigaction_f)(int, const struct sigaction*, struct sigaction*);
+
+static struct {
+    openat_f     openat;
+    open_f       open;
+    open_f       open64;
+    openat_f     openat64;
+    openat2_f    openat2;      // may stay NULL (older glibc): raw syscall then
+    // _FORTIFY_SOURCE callers of open/openat land in these instead
+    open_2_f     open_2;
+    open_2_f     open64_2;
+    openat_2_f   openat_2;
+    openat_2_f   openat64_2;
+    // glibc's stdio opens through internal, non-interposable calls
+    fopen_f      fopen;
+    fopen_f      fopen64;
+    dlopen_f     dlopen;
+    readdir_f    readdir;
+    readdir64_f  readdir64;
+    getdents64_f getdents64;   // may stay NULL (older glibc): raw syscall then
+    scandir_f    scandir;
+    scandir64_f  scandir64;
+    closedir_f   closedir;
+    // stat family; the __xstat entry points only exist for binaries built
+    // against glibc < 2.33, where stat() was an inline wrapper around them
+    stat_f       stat;
+    stat_f       lstat;
+    fstatat_f    fstatat;
+    stat64_f     stat64;
+    stat64_f     lstat64;
+    fstatat64_f  fstatat64;
+    statx_f      statx;
+    access_f     access;
+    faccessat_f  faccessat;
+    xstat_f      xstat;
+    xstat_f      lxstat;
+    fxstatat_f   fxstatat;
+    xstat64_f    xstat64;
+    xstat64_f    lxstat64;
+    fxstatat64_f fxstatat64;
+    // io_uring: raw io_uring_setup/enter/register go through syscall(); the
+    // liburing submit calls are looked up again on first use if it loads late
+    syscall_f    syscall;
+    close_f      close;
+    uring_submit_f              uring_submit;
+    uring_submit_wait_f         uring_submit_and_wait;
+    uring_submit_wait_timeout_f uring_submit_and_wait_timeout;
+    uring_submit_f              uring_submit_and_get_events;
+    // LIBNVIDIAHIDE_SUD: new threads arm dispatch, SIGSYS handlers are chained
+    pthread_create_f pthread_create;
+    sigaction_f      sigaction;
+} g_real;
+static int g_resolved = 0;      // g_real is filled in and published
+static int g_resolving = 0;     // one thread runs resolve_real
+static __thread int t_in_resolve;
+
+// Only the thread that wins g_resolving looks the symbols up, into a local
+// table that is published in one go. Until then REAL() yields NULL: on that
+// thread when dlsym re-enters a hook, on the others while it runs.
+static void resolve_real(void) {
+    int idle = 0;
+    if (t_in_resolve || !__atomic_compare_exchange_n(&g_resolving, &idle, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return;
+    t_in_resolve = 1;
+    __typeof__(g_real) r;
+    memset(&r, 0, sizeof(r));
+    // first: everything below, dlsym included, may call syscall()
+    r.syscall    = (syscall_f)dlsym(RTLD_NEXT, "syscall");
+    r.close      = (close_f)dlsym(RTLD_NEXT, "close");
+    r.uring_submit = (uring_submit_f)dlsym(RTLD_NEXT, "io_uring_submit");
+    r.uring_submit_and_wait = (uring_submit_wait_f)dlsym(RTLD_NEXT, "io_uring_submit_and_wait");
+    r.uring_submit_and_wait_timeout =
+        (uring_submit_wait_timeout_f)dlsym(RTLD_NEXT, "io_uring_submit_and_wait_timeout");
+    r.uring_submit_and_get_events = (uring_submit_f)dlsym(RTLD_NEXT, "io_uring_submit_and_get_events");
+    r.pthread_create = (pthread_create_f)dlsym(RTLD_NEXT, "pthread_create");
+    r.sigaction  = (sigaction_f)dlsym(RTLD_NEXT, "sigaction");
+    r.openat     = (openat_f)dlsym(RTLD_NEXT, "openat");
+    r.open       = (open_f)dlsym(RTLD_NEXT, "open");
+    r.open64     = (open_f)dlsym(RTLD_NEXT, "open64");
+    r.openat64   = (openat_f)dlsym(RTLD_NEXT, "openat64");
+    r.openat2    = (openat2_f)dlsym(RTLD_NEXT, "openat2");
+    r.open_2     = (open_2_f)dlsym(RTLD_NEXT, "__open_2");
+    r.open64_2   = (open_2_f)dlsym(RTLD_NEXT, "__open64_2");
+    r.openat_2   = (openat_2_f)dlsym(RTLD_NEXT, "__openat_2");
+    r.openat64_2 = (openat_2_f)dlsym(RTLD_NEXT, "__openat64_2");
+    r.fopen      = (fopen_f)dlsym(RTLD_NEXT, "fopen");
+    r.fopen64    = (fopen_f)dlsym(RTLD_NEXT, "fopen64");
+    r.dlopen     = (dlopen_f)dlsym(RTLD_NEXT, "dlopen");
+    r.readdir    = (readdir_f)dlsym(RTLD_NEXT, "readdir");
+    r.readdir64  = (readdir64_f)dlsym(RTLD_NEXT, "readdir64");
+    r.getdents64 = (getdents64_f)dlsym(RTLD_NEXT, "getdents64");
+    r.scandir    = (scandir_f)dlsym(RTLD_NEXT, "scandir");
+    r.scandir64  = (scandir64_f)dlsym(RTLD_NEXT, "scandir64");
+    r.closedir   = (closedir_f)dlsym(RTLD_NEXT, "closedir");
+    r.stat       = (stat_f)dlsym(RTLD_NEXT, "stat");
+    r.lstat      = (stat_f)dlsym(RTLD_NEXT, "lstat");
+    r.fstatat    = (fstatat_f)dlsym(RTLD_NEXT, "fstatat");
+    r.stat64     = (stat64_f)dlsym(RTLD_NEXT, "stat64");
+    r.lstat64    = (stat64_f)dlsym(RTLD_NEXT, "lstat64");
+    r.fstatat64  = (fstatat64_f)dlsym(RTLD_NEXT, "fstatat64");
+    r.statx      = (statx_f)dlsym(RTLD_NEXT, "statx");
+    r.access     = (access_f)dlsym(RTLD_NEXT, "access");
+    r.faccessat  = (faccessat_f)dlsym(RTLD_NEXT, "faccessat");
+    r.xstat      = (xstat_f)dlsym(RTLD_NEXT, "__xstat");
+    r.lxstat     = (xstat_f)dlsym(RTLD_NEXT, "__lxstat");
+    r.fxstatat   = (fxstatat_f)dlsym(RTLD_NEXT, "__fxstatat");
+    r.xstat64    = (xstat64_f)dlsym(RTLD_NEXT, "__xstat64");
+    r.lxstat64   = (xstat64_f)dlsym(RTLD_NEXT, "__lxstat64");
+    r.fxstatat64 = (fxstatat64_f)dlsym(RTLD_NEXT, "__fxstatat64");
+    memcpy(&g_real, &r, sizeof(g_real));
+    __atomic_store_n(&g_resolved, 1, __ATOMIC_RELEASE);
+    t_in_resolve = 0;
+}
+
+static const __typeof__(g_real) g_real_none;
+
+static const __typeof__(g_real) *real_slow(void) {
+    resolve_real();
+    return __atomic_load_n(&g_resolved, __ATOMIC_ACQUIRE) ? &g_real : &g_real_none;
+}
+
+#define REAL(fn) (__builtin_expect(__atomic_load_n(&g_resolved, __ATOMIC_ACQUIRE), 1) \
+                  ? g_real.fn : real_slow()->fn)
+
+// For hooks without a syscall to fall back on: a thread that lost the race
+// looks its own symbol up; a call re-entered from resolve_real gets NULL.
+static void *real_next(const char *name) {
+    return t_in_resolve ? NULL : dlsym(RTLD_NEXT, name);
+}
+#define REAL_NEXT(fn, name) (REAL(fn) ? REAL(fn) : (__typeof__(g_real.fn))real_next(name))
+
+// The kernel directly, for syscall() itself while REAL(syscall) is NULL;
+// every other raw fallback goes through syscall().
+static long raw_syscall6(long nr, long a0, long a1, long a2, long a3, long a4, long a5) {
+    long ret;
+#if defined(__x86_64__)
+    register long r10 __asm__("r10") = a3, r8 __asm__("r8") = a4, r9 __asm__("r9") = a5;
+    __asm__ volatile("syscall" : "=a"(ret) : "a"(nr), "D"(a0), "S"(a1), "d"(a2), "r"(r10), "r"(r8), "r"(r9)
+                     : "rcx", "r11", "memory");
+#elif defined(__aarch64__)
+    register long x8 __asm__("x8") = nr, x0 __asm__("x0") = a0, x1 __asm__("x1") = a1, x2 __asm__("x2") = a2;
+    register long x3 __asm__("x3") = a3, x4 __asm__("x4") = a4, x5 __asm__("x5") = a5;
+    __asm__ volatile("svc 0" : "+r"(x0) : "r"(x8), "r"(x1), "r"(x2), "r"(x3), "r"(x4), "r"(x5) : "memory");
+    ret = x0;
+#else
+    (void)nr; (void)a0; (void)a1; (void)a2; (void)a3; (void)a4; (void)a5;
+    ret = -ENOSYS;
+#endif
+    if (ret < 0 && ret > -4096) {
+        errno = (int)-ret;
+        return -1;
+    }
+    return ret;
+}
+
+static int find_text(struct dl_phdr_info *info, size_t size, void *arg) {
+    (void)size;
+    uintptr_t *want = arg;     // in: an address; out: the executable segment holding it
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+        if (ph->p_type != PT_LOAD || !(ph->p_flags & PF_X)) continue;
+        uintptr_t lo = info->dlpi_addr + ph->p_vaddr;
+        if (want[0] >= lo && want[0] - lo < ph->p_memsz) { want[0] = lo; want[1] = ph->p_memsz; return 1; }
+    }
+    return 0;
+}
+
+// Our own text: syscall() made by the library itself (raw fallbacks of the
+// hooks, log and recording files) is never checked again.
+static uintptr_t g_self_text[2];
+
+static inline int from_self(const void *ra) {
+    return (uintptr_t)ra - g_self_text[0] < g_self_text[1];
+}
+
+__attribute__((constructor))
+static void nh_ctor(void) {
+    uintptr_t text[2] = { (uintptr_t)&raw_syscall6, 0 };
+    if (dl_iterate_phdr(find_text, text)) { g_self_text[0] = text[0]; g_self_text[1] = text[1]; }
+    if (!g_resolved) resolve_real();
+    stats_init();
+    trace_init();
+    rec_init();
+    nh_policy_init();
+    sud_init();
+}
+
+// open(2) reads the mode argument for O_CREAT and O_TMPFILE
+#define OPEN_NEEDS_MODE(f) (((f) & O_CREAT) || ((f) & O_TMPFILE) == O_TMPFILE)
+#define OPEN_MODE_ARG(flags, mode) do {                                  \
+        if (OPEN_NEEDS_MODE(flags)) {                                    \
+            va_list ap;                                                  \
+            va_start(ap, flags);                                         \
+            mode = va_arg(ap, mode_t);                                   \
+            va_end(ap);                                                  \
+        }                                                                \
+    } while (0)
+
+static int raw_openat(int dirfd, const char *p, int flags, mode_t mode) {
+    return (int)syscall(SYS_openat, dirfd, p, flags, mode);
+}
+
+int openat(int dirfd, const char *pathname, int flags, ...) {
+    mode_t mode = 0;
+    OPEN_MODE_ARG(flags, mode);
+    if (hooks_on() && path_denied(H_OPENAT, dirfd, pathname)) return deny_ret();
+    int fd;
+    if (hooks_on() && (fd = open_substitute(pathname, flags)) >= 0) return fd;
+    openat_f real = REAL(openat);
+    return real ? real(dirfd, pathname, flags, mode) : raw_openat(dirfd, pathname, flags, mode);
+}
+
+// Also hook open/open64 for completeness (some paths use these)
+int open(const char *pathname, int flags, ...) {
+    mode_t mode = 0;
+    OPEN_MODE_ARG(flags, mode);
+    if (hooks_on() && path_denied(H_OPEN, AT_FDCWD, pathname)) return deny_ret();
+    int fd;
+    if (hooks_on() && (fd = open_substitute(pathname, flags)) >= 0) return fd;
+    open_f real = REAL(open);
+    return real ? real(pathname, flags, mode) : raw_openat(AT_FDCWD, pathname, flags, mode);
+}
+
+int open64(const char *pathname, int flags, ...) {
+    mode_t mode = 0;
+    OPEN_MODE_ARG(flags, mode);
+    if (hooks_on() && path_denied(H_OPEN64, AT_FDCWD, pathname)) return deny_ret();
+    int fd;
+    if (hooks_on() && (fd = open_substitute(pathname, flags)) >= 0) return fd;
+    open_f real = REAL(open64);
+    return real ? real(pathname, flags, mode) : raw_openat(AT_FDCWD, pathname, flags, mode);
+}
+
+int openat64(int dirfd, const char *pathname, int flags, ...) {
+    mode_t mode = 0;
+    OPEN_MODE_ARG(flags, mode);
+    if (hooks_on() && path_denied(H_OPENAT, dirfd, pathname)) return deny_ret();
+    int fd;
+    if (hooks_on() && (fd = open_substitute(pathname, flags)) >= 0) return fd;
+    openat_f real = REAL(openat64);
+    if (!real) real = REAL(openat);
+    return real ? real(dirfd, pathname, flags, mode) : raw_openat(dirfd, pathname, flags, mode);
+}
+
+/* ---- _FORTIFY_SOURCE entry points: open(2) without a mode argument ---- */
+// Counted under the hook they fortify. The real ones abort on O_CREAT
+// without a mode, so they are always forwarded rather than re-routed.
+int __open_2(const char *pathname, int flags) {
+    if (hooks_on() && path_denied(H_OPEN, AT_FDCWD, pathname)) return deny_ret();
+    int fd;
+    if (hooks_on() && (fd = open_substitute(pathname, flags)) >= 0) return fd;
+    open_2_f real = REAL(open_2);
+    return real ? real(pathname, flags) : raw_openat(AT_FDCWD, pathname, flags, 0);
+}
+
+int __open64_2(const char *pathname, int flags) {
+    if (hooks_on() && path_denied(H_OPEN64, AT_FDCWD, pathname)) return deny_ret();
+    int fd;
+    if (hooks_on() && (fd = open_substitute(pathname, flags)) >= 0) return fd;
+    open_2_f real = REAL(open64_2);
+    return real ? real(pathname, flags) : raw_openat(AT_FDCWD, pathname, flags, 0);
+}
+
+int __openat_2(int dirfd, const char *pathname, int flags) {
+    if (hooks_on() && path_denied(H_OPENAT, dirfd, pathname)) return deny_ret();
+    int fd;
+    if (hooks_on() && (fd = open_substitute(pathname, flags)) >= 0) return fd;
+    openat_2_f real = REAL(openat_2);
+    return real ? real(dirfd, pathname, flags) : raw_openat(dirfd, pathname, flags, 0);
+}
+
+int __openat64_2(int dirfd, const char *pathname, int flags) {
+    if (hooks_on() && path_denied(H_OPENAT, dirfd, pathname)) return deny_ret();
+    int fd;
+    if (hooks_on() && (fd = open_substitute(pathname, flags)) >= 0) return fd;
+    openat_2_f real = REAL(openat64_2);
+    return real ? real(dirfd, pathname, flags) : raw_openat(dirfd, pathname, flags, 0);
+}
+
+/* ---- stdio: fopen never goes through the open() symbol ---- */
+// fopen's "r" (optionally "e") maps onto a read-only open for open_substitute
+static FILE *fopen_substitute(const char *pathname, const char *mode) {
+    if (!mode || mode[0] != 'r' || strchr(mode, '+')) return NULL;
+    int fd = open_substitute(pathname, O_RDONLY | (strchr(mode, 'e') ? O_CLOEXEC : 0));
+    if (fd < 0) return NULL;
+    FILE *f = fdopen(fd, mode);
+    if (!f) close(fd);
+    return f;
+}
+
+FILE *fopen(const char *pathname, const char *mode) {
+    if (hooks_on() && path_denied(H_FOPEN, AT_FDCWD, pathname)) { errno = ENOENT; return NULL; }
+    FILE *f;
+    if (hooks_on() && (f = fopen_substitute(pathname, mode))) return f;
+    fopen_f real = REAL_NEXT(fopen, "fopen");
+    if (!real) { errno = ENOSYS; return NULL; }
+    return real(pathname, mode);
+}
+
+FILE *fopen64(const char *pathname, const char *mode) {
+    if (hooks_on() && path_denied(H_FOPEN, AT_FDCWD, pathname)) { errno = ENOENT; return NULL; }
+    FILE *f;
+    if (hooks_on() && (f = fopen_substitute(pathname, mode))) return f;
+    fopen_f real = REAL_NEXT(fopen64, "fopen64");
+    if (!real) real = REAL_NEXT(fopen, "fopen");
+    if (!real) { errno = ENOSYS; return NULL; }
+    return real(pathname, mode);
+}
+
+// Hook openat2 if present
+int openat2(int dirfd, const char *pathname, const struct open_how *how, size_t size) {
+    if (hooks_on() && path_denied(H_OPENAT2, dirfd, pathname)) return deny_ret();
+    int fd;
+    if (hooks_on() && how && (fd = open_substitute(pathname, (int)how->flags)) >= 0) return fd;
+
+    openat2_f real_openat2 = REAL(openat2);
+    if (real_openat2) return real_openat2(dirfd, pathname, how, size);
+    #ifdef SYS_openat2
+    return (int)syscall(SYS_openat2, dirfd, pathname, how, size);
+    #else
+    errno = ENOSYS;
+    return -1;
+    #endif
+}
+
+/* ---- stat/access family: a hidden node must not exist for probes either ---- */
+// Same decision as open. Missing real symbols (stat64 on some libcs, the
+// __xstat compat entry points) fall back to the newfstatat syscall, which
+// has the struct stat layout on every 64-bit target.
+static int raw_fstatat(int dirfd, const char *p, void *st, int flags) {
+    return (int)syscall(SYS_newfstatat, dirfd, p, st, flags);
+}
+
+int stat(const char *pathname, struct stat *st) {
+    if (hooks_on() && path_denied(H_STAT, AT_FDCWD, pathname)) return deny_ret();
+    stat_f real_stat = REAL(stat);
+    return real_stat ? real_stat(pathname, st) : raw_fstatat(AT_FDCWD, pathname, st, 0);
+}
+
+int lstat(const char *pathname, struct stat *st) {
+    if (hooks_on() && path_denied(H_STAT, AT_FDCWD, pathname)) return deny_ret();
+    stat_f real_lstat = REAL(lstat);
+    return real_lstat ? real_lstat(pathname, st)
+                      : raw_fstatat(AT_FDCWD, pathname, st, AT_SYMLINK_NOFOLLOW);
+}
+
+int fstatat(int dirfd, const char *pathname, struct stat *st, int flags) {
+    if (hooks_on() && path_denied(H_STAT, dirfd, pathname)) return deny_ret();
+    fstatat_f real_fstatat = REAL(fstatat);
+    return real_fstatat ? real_fstatat(dirfd, pathname, st, flags)
+                        : raw_fstatat(dirfd, pathname, st, flags);
+}
+
+int stat64(const char *pathname, struct stat64 *st) {
+    if (hooks_on() && path_denied(H_STAT, AT_FDCWD, pathname)) return deny_ret();
+    stat64_f real_stat64 = REAL(stat64);
+    return real_stat64 ? real_stat64(pathname, st) : raw_fstatat(AT_FDCWD, pathname, st, 0);
+}
+
+int lstat64(const char *pathname, struct stat64 *st) {
+    if (hooks_on() && path_denied(H_STAT, AT_FDCWD, pathname)) return deny_ret();
+    stat64_f real_lstat64 = REAL(lstat64);
+    return real_lstat64 ? real_lstat64(pathname, st)
+                        : raw_fstatat(AT_FDCWD, pathname, st, AT_SYMLINK_NOFOLLOW);
+}
+
+int fstatat64(int dirfd, const char *pathname, struct stat64 *st, int flags) {
+    if (hooks_on() && path_denied(H_STAT, dirfd, pathname)) return deny_ret();
+    fstatat64_f real_fstatat64 = REAL(fstatat64);
+    return real_fstatat64 ? real_fstatat64(dirfd, pathname, st, flags)
+                          : raw_fstatat(dirfd, pathname, st, flags);
+}
+
+int statx(int dirfd, const char *pathname, int flags, unsigned int mask, struct statx *stx) {
+    if (hooks_on() && path_denied(H_STATX, dirfd, pathname)) return deny_ret();
+    statx_f real_statx = REAL(statx);
+    if (real_statx) return real_statx(dirfd, pathname, flags, mask, stx);
+    return (int)syscall(SYS_statx, dirfd, pathname, flags, mask, stx);
+}
+
+int access(const char *pathname, int mode) {
+    if (hooks_on() && path_denied(H_ACCESS, AT_FDCWD, pathname)) return deny_ret();
+    access_f real = REAL(access);
+    return real ? real(pathname, mode) : (int)syscall(SYS_faccessat, AT_FDCWD, pathname, mode);
+}
+
+int faccessat(int dirfd, const char *pathname, int mode, int flags) {
+    if (hooks_on() && path_denied(H_ACCESS, dirfd, pathname)) return deny_ret();
+    faccessat_f real = REAL(faccessat);
+    if (real) return real(dirfd, pathname, mode, flags);
+    return flags ? (int)syscall(SYS_faccessat2, dirfd, pathname, mode, flags)
+                 : (int)syscall(SYS_faccessat, dirfd, pathname, mode);
+}
+
+// glibc < 2.33 compat: stat() and friends compile to calls to these
+int __xstat(int ver, const char *pathname, struct stat *st);
+int __lxstat(int ver, const char *pathname, struct stat *st);
+int __fxstatat(int ver, int dirfd, const char *pathname, struct stat *st, int flags);
+int __xstat64(int ver, const char *pathname, struct stat64 *st);
+int __lxstat64(int ver, const char *pathname, struct stat64 *st);
+int __fxstatat64(int ver, int dirfd, const char *pathname, struct stat64 *st, int flags);
+
+int __xstat(int ver, const char *pathname, struct stat *st) {
+    if (hooks_on() && path_denied(H_STAT, AT_FDCWD, pathname)) return deny_ret();
+    xstat_f real_xstat = REAL(xstat);
+    return real_xstat ? real_xstat(ver, pathname, st) : raw_fstatat(AT_FDCWD, pathname, st, 0);
+}
+
+int __lxstat(int ver, const char *pathname, struct stat *st) {
+    if (hooks_on() && path_denied(H_STAT, AT_FDCWD, pathname)) return deny_ret();
+    xstat_f real_lxstat = REAL(lxstat);
+    return real_lxstat ? real_lxstat(ver, pathname, st)
+                       : raw_fstatat(AT_FDCWD, pathname, st, AT_SYMLINK_NOFOLLOW);
+}
+
+int __fxstatat(int ver, int dirfd, const char *pathname, struct stat *st, int flags) {
+    if (hooks_on() && path_denied(H_STAT, dirfd, pathname)) return deny_ret();
+    fxstatat_f real_fxstatat = REAL(fxstatat);
+    return real_fxstatat ? real_fxstatat(ver, dirfd, pathname, st, flags)
+                         : raw_fstatat(dirfd, pathname, st, flags);
+}
+
+int __xstat64(int ver, const char *pathname, struct stat64 *st) {
+    if (hooks_on() && path_denied(H_STAT, AT_FDCWD, pathname)) return deny_ret();
+    xstat64_f real_xstat64 = REAL(xstat64);
+    return real_xstat64 ? real_xstat64(ver, pathname, st) : raw_fstatat(AT_FDCWD, pathname, st, 0);
+}
+
+int __lxstat64(int ver, const char *pathname, struct stat64 *st) {
+    if (hooks_on() && path_denied(H_STAT, AT_FDCWD, pathname)) return deny_ret();
+    xstat64_f real_lxstat64 = REAL(lxstat64);
+    return real_lxstat64 ? real_lxstat64(ver, pathname, st)
+                         : raw_fstatat(AT_FDCWD, pathname, st, AT_SYMLINK_NOFOLLOW);
+}
+
+int __fxstatat64(int ver, int dirfd, const char *pathname, struct stat64 *st, int flags) {
+    if (hooks_on() && path_denied(H_STAT, dirfd, pathname)) return deny_ret();
+    fxstatat64_f real_fxstatat64 = REAL(fxstatat64);
+    return real_fxstatat64 ? real_fxstatat64(ver, dirfd, pathname, st, flags)
+                           : raw_fstatat(dirfd, pathname, st, flags);
+}
+
+/* ---- Block dlopen of NVIDIA libs ---- */
+void *dlopen(const char *filename, int flags) {
+    dlopen_f real_dlopen = REAL_NEXT(dlopen, "dlopen");
+    if (!real_dlopen) { errno = ENOENT; return NULL; }  // dlsym recursed into us
+    if (!hooks_on()) return real_dlopen(filename, flags);
+
+    uint64_t t0 = stats_t0();
+    int deny = is_nvidia_lib(filename);
+    if (g_stats) stats_note(H_DLOPEN, deny, t0);
+    if (g_log_ring && filename && nh_lib_is_nvidia(filename)) log_hook(H_DLOPEN, deny, filename);
+    if (g_trace && deny) trace_note(H_DLOPEN);
+    if (g_rec_buf && filename) rec_note(H_DLOPEN, deny, 0, filename);
+    if (deny) {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    return real_dlopen(filename, flags);
+}
+
+/* ---- Hide NVIDIA entries from directory enumeration ---- */
+struct dirent *readdir(DIR *dirp) {
+    readdir_f real_readdir = REAL_NEXT(readdir, "readdir");
+    if (!real_readdir) { errno = ENOSYS; return NULL; }
+    if (!hooks_on()) return real_readdir(dirp);
+
+    struct dirent *ent;
+    while ((ent = real_readdir(dirp)) != NULL) {
+        if (!dirent_denied(H_READDIR, dirp, ent->d_name)) return ent;
+    }
+    return NULL;
+}
+
+struct dirent64 *readdir64(DIR *dirp) {
+    readdir64_f real_readdir64 = REAL_NEXT(readdir64, "readdir64");
+    if (!real_readdir64) { errno = ENOSYS; return NULL; }
+    if (!hooks_on()) return real_readdir64(dirp);
+
+    struct dirent64 *ent;
+    while ((ent = real_readdir64(dirp)) != NULL) {
+        if (!dirent_denied(H_READDIR64, dirp, ent->d_name)) return ent;
+    }
+    return NULL;
+}
+
+/* ---- Filter getdents64 buffers in place ---- */
+// For callers that read directories without readdir (libuv, custom walkers).
+// glibc's own readdir/scandir/glob/nftw use an internal getdents and are not
+// routed through here; readdir/readdir64/scandir are hooked separately.
+static void rec_dirents(int fd, const char *buf, size_t from, size_t to) {
+    if (from >= to) return;
+    ensure_init();
+    int cls = hooks_on() ? listing_cls(classify_fd(fd)) : DIR_OTHER;
+    for (size_t r = from; r < to; r += ((const struct linux_dirent64*)(buf + r))->d_reclen)
+        rec_note(H_GETDENTS64, 0, cls, ((const struct linux_dirent64*)(buf + r))->d_name);
+}
+
+static size_t filter_dirent_buf(int fd, char *buf, size_t len) {
+    // Cheap pass first: most buffers hold nothing that could be hidden.
+    size_t pos = 0;
+    while (pos < len) {
+        const struct linux_dirent64 *d = (const struct linux_dirent64*)(buf + pos);
+        if (dirent_maybe_nvidia(d->d_name)) break;
+        pos += d->d_reclen;
+    }
+    if (g_rec_buf) rec_dirents(fd, buf, 0, pos);
+    if (pos >= len) return len;
+
+    ensure_init();
+    int cls = hooks_on() ? listing_cls(classify_fd(fd)) : DIR_OTHER;
+    if (cls == DIR_OTHER) {
+        if (g_rec_buf) rec_dirents(fd, buf, pos, len);
+        return len;
+    }
+
+    // Compact: entries before the first hidden one never move.
+    size_t w = pos;
+    for (size_t r = pos; r < len; ) {
+        struct linux_dirent64 *d = (struct linux_dirent64*)(buf + r);
+        size_t rl = d->d_reclen;
+        int hide = dirent_maybe_nvidia(d->d_name) && dirent_hidden_in(cls, d->d_name);
+        if (g_rec_buf) rec_note(H_GETDENTS64, hide, cls, d->d_name);
+        if (!hide) {
+            if (w != r) memmove(buf + w, buf + r, rl);
+            w += rl;
+        } else if (g_log_ring) {
+            log_hook(H_GETDENTS64, 1, d->d_name);
+        }
+        r += rl;
+    }
+    return w;
+}
+
+ssize_t getdents64(int fd, void *dirp, size_t count) {
+    getdents64_f real_getdents64 = REAL(getdents64);
+
+    for (;;) {
+        ssize_t n = real_getdents64 ? real_getdents64(fd, dirp, count)
+                                    : (ssize_t)syscall(SYS_getdents64, fd, dirp, count);
+        if (n <= 0 || !hooks_on()) return n;
+        uint64_t t0 = stats_t0();
+        size_t kept = filter_dirent_buf(fd, (char*)dirp, (size_t)n);
+        if (g_stats) stats_note(H_GETDENTS64, kept != (size_t)n, t0);
+        if (g_trace && kept != (size_t)n) trace_note(H_GETDENTS64);
+        // an all-hidden buffer must not look like end-of-directory
+        if (kept) return (ssize_t)kept;
+    }
+}
+
+/* ---- scandir: glibc reads the entries internally, so filter via the callback ---- */
+// State of the scandir call running on this thread. The directory is only
+// stat'ed (and init only triggered) once a name that could be hidden shows up.
+struct scan_ctx {
+    const char *dir;
+    int cls;                // -1 until classified
+    scandir_filter_f user;
+    scandir64_filter_f user64;
+};
+static __thread struct scan_ctx *t_scan;
+
+static void scan_classify(struct scan_ctx *c) {
+    struct stat st;
+    ensure_init();
+    c->cls = (hooks_on() && nh_raw_stat(c->dir, &st) == 0) ? listing_cls(classify_stat(&st)) : DIR_OTHER;
+}
+
+static int scan_decide(const char *name) {
+    struct scan_ctx *c = t_scan;
+    if (!c || !dirent_maybe_nvidia(name)) return 0;
+    if (c->cls < 0) scan_classify(c);
+    return c->cls != DIR_OTHER && dirent_hidden_in(c->cls, name);
+}
+
+static int scan_hides(const char *name) {
+    uint64_t t0 = stats_t0();
+    int deny = scan_decide(name);
+    if (g_stats) stats_note(H_SCANDIR, deny, t0);
+    if (g_rec_buf && t_scan && t_scan->cls < 0) scan_classify(t_scan);
+    if (g_rec_buf) rec_note(H_SCANDIR, deny, t_scan ? t_scan->cls : 0, name);
+    return deny;
+}
+
+static int scan_filter(const struct dirent *d) {
+    if (scan_hides(d->d_name)) return 0;
+    return t_scan->user ? t_scan->user(d) : 1;
+}
+
+static int scan_filter64(const struct dirent64 *d) {
+    if (scan_hides(d->d_name)) return 0;
+    return t_scan->user64 ? t_scan->user64(d) : 1;
+}
+
+int scandir(const char *dir, struct dirent ***namelist, scandir_filter_f filter, scandir_cmp_f compar) {
+    scandir_f real_scandir = REAL_NEXT(scandir, "scandir");
+    if (!real_scandir) { errno = ENOSYS; return -1; }
+
+    if (!hooks_on()) return real_scandir(dir, namelist, filter, compar);
+
+    struct scan_ctx ctx = { dir, -1, filter, NULL }, *prev = t_scan;
+    t_scan = &ctx;
+    int rc = real_scandir(dir, namelist, scan_filter, compar);
+    t_scan = prev;
+    return rc;
+}
+
+int scandir64(const char *dir, struct dirent64 ***namelist, scandir64_filter_f filter, scandir64_cmp_f compar) {
+    scandir64_f real_scandir64 = REAL_NEXT(scandir64, "scandir64");
+    if (!real_scandir64) { errno = ENOSYS; return -1; }
+
+    if (!hooks_on()) return real_scandir64(dir, namelist, filter, compar);
+
+    struct scan_ctx ctx = { dir, -1, NULL, filter }, *prev = t_scan;
+    t_scan = &ctx;
+    int rc = real_scandir64(dir, namelist, scan_filter64, compar);
+    t_scan = prev;
+    return rc;
+}
+
+int closedir(DIR *dirp) {
+    if (hooks_on()) dirtab_del(dirp);
+    closedir_f real = REAL_NEXT(closedir, "closedir");
+    if (!real) { errno = ENOSYS; return -1; }
+    return real(dirp);
+}
+
+/* ---- io_uring: opens submitted as SQEs never reach the open hooks ---- */
+// Rings created through syscall(SYS_io_uring_setup) (libuv, the Rust crates)
+// are tracked by fd: the SQ ring and SQE array are mapped a second time
+// here, and io_uring_enter scans the entries it is about to submit. liburing
+// sets its rings up with inline syscalls, so its submit calls are hooked
+// instead and read the pending entries from the struct io_uring it passes.
+// A denied OPENAT/OPENAT2/STATX gets an empty path, so the kernel itself
+// completes it with -ENOENT. The kernel copies the path at submission, so
+// nothing can change it after the check.
+#ifndef IORING_SETUP_NO_MMAP
+#define IORING_SETUP_NO_MMAP      (1U << 14)
+#endif
+#ifndef IORING_SETUP_NO_SQARRAY
+#define IORING_SETUP_NO_SQARRAY   (1U << 16)
+#endif
+#define URING_MAX 32
+
+// the opcodes that take a path; every other SQE costs one table load
+static const uint8_t g_uring_path_op[256] = {
+    [IORING_OP_OPENAT] = 1, [IORING_OP_OPENAT2] = 1, [IORING_OP_STATX] = 1,
+};
+
+struct uring {
+    int fd;                 // -1: free slot
+    int reg;                // IORING_REGISTER_RING_FDS index, -1 if none
+    unsigned flags;         // IORING_SETUP_*
+    unsigned entries;
+    const unsigned *khead, *ktail, *kmask, *array;
+    char *sqes;
+    void *ring_map;
+    size_t ring_sz, sqes_sz;
+};
+
+static struct uring g_urings[URING_MAX];
+static int g_urings_n = 0;      // slots ever used; 0 keeps close() at one branch
+static int g_uring_lock = 0;
+static __thread int t_uring_held;   // deciding under the lock may run init, which closes fds
+
+static void uring_lock(void) {
+    while (__atomic_exchange_n(&g_uring_lock, 1, __ATOMIC_ACQUIRE)) sched_yield();
+    t_uring_held = 1;
+}
+
+static void uring_unlock(void) {
+    t_uring_held = 0;
+    __atomic_store_n(&g_uring_lock, 0, __ATOMIC_RELEASE);
+}
+
+static inline size_t uring_sqe_size(unsigned flags) {
+    return (flags & IORING_SETUP_SQE128) ? 2 * sizeof(struct io_uring_sqe) : sizeof(struct io_uring_sqe);
+}
+
+static void uring_filter_sqe(struct io_uring_sqe *sqe) {
+    if (__builtin_expect(!g_uring_path_op[sqe->opcode], 1)) return;
+    const char *p = (const char*)(uintptr_t)sqe->addr;
+    if (!p) return;
+    // a fixed-file dirfd is a table index: only absolute paths can be judged
+    int fixed = (sqe->flags & IOSQE_FIXED_FILE) != 0;
+    if (fixed && p[0] != '/') return;
+    if (!path_denied(H_URING, fixed ? AT_FDCWD : sqe->fd, p)) return;
+    sqe->addr = (uintptr_t)"";
+    if (sqe->opcode == IORING_OP_STATX) sqe->statx_flags &= ~(uint32_t)AT_EMPTY_PATH;
+}
+
+// caller holds g_uring_lock
+static struct uring *uring_find(int fd, int registered) {
+    for (int i = 0; i < g_urings_n; i++) {
+        struct uring *u = &g_urings[i];
+        if (u->fd >= 0 && (registered ? u->reg == fd : u->fd == fd)) return u;
+    }
+    return NULL;
+}
+
+static void uring_release(struct uring *u) {
+    if (u->ring_map) munmap(u->ring_map, u->ring_sz);
+    if (u->sqes) munmap(u->sqes, u->sqes_sz);
+    memset(u, 0, sizeof(*u));
+    u->fd = -1;
+}
+
+static void uring_track(int fd, const struct io_uring_params *p) {
+    size_t ring_sz, sqes_sz = (size_t)p->sq_entries * uring_sqe_size(p->flags);
+    if (p->flags & IORING_SETUP_NO_SQARRAY) {
+        ring_sz = p->sq_off.head;
+        if (p->sq_off.tail > ring_sz) ring_sz = p->sq_off.tail;
+        if (p->sq_off.ring_mask > ring_sz) ring_sz = p->sq_off.ring_mask;
+        ring_sz += sizeof(unsigned);
+    } else {
+        ring_sz = p->sq_off.array + (size_t)p->sq_entries * sizeof(unsigned);
+    }
+    char *ring = mmap(NULL, ring_sz, PROT_READ, MAP_SHARED, fd, IORING_OFF_SQ_RING);
+    if (ring == MAP_FAILED) { dbg("io_uring: fd %d: cannot map the SQ ring, not filtered", fd); return; }
+    char *sqes = mmap(NULL, sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) { munmap(ring, ring_sz); dbg("io_uring: fd %d: cannot map the SQEs, not filtered", fd); return; }
+
+    uring_lock();
+    struct uring *u = uring_find(fd, 0);
+    if (u) uring_release(u);
+    for (int i = 0; !u && i < URING_MAX; i++)
+        if (i >= g_urings_n || g_urings[i].fd < 0) u = &g_urings[i];
+    if (u) {
+        u->fd = fd;
+        u->reg = -1;
+        u->flags = p->flags;
+        u->entries = p->sq_entries;
+        u->khead = (const unsigned*)(ring + p->sq_off.head);
+        u->ktail = (const unsigned*)(ring + p->sq_off.tail);
+        u->kmask = (const unsigned*)(ring + p->sq_off.ring_mask);
+        u->array = (p->flags & IORING_SETUP_NO_SQARRAY) ? NULL : (const unsigned*)(ring + p->sq_off.array);
+        u->sqes = sqes;
+        u->ring_map = ring;
+        u->ring_sz = ring_sz;
+        u->sqes_sz = sqes_sz;
+        if (u - g_urings >= g_urings_n) __atomic_store_n(&g_urings_n, (int)(u - g_urings) + 1, __ATOMIC_RELEASE);
+    }
+    uring_unlock();
+    if (!u) {
+        munmap(ring, ring_sz);
+        munmap(sqes, sqes_sz);
+        dbg("io_uring: fd %d: too many rings, not filtered", fd);
+    }
+}
+
+// The entries io_uring_enter is about to consume: from the kernel's head
+// up to the tail the application published, at most to_submit of them.
+static void uring_scan_enter(int fd, unsigned to_submit, unsigned flags) {
+    if (!to_submit || !__atomic_load_n(&g_urings_n, __ATOMIC_ACQUIRE)) return;
+    uring_lock();
+    struct uring *u = uring_find(fd, (flags & IORING_ENTER_REGISTERED_RING) != 0);
+    if (u) {
+        unsigned head = __atomic_load_n(u->khead, __ATOMIC_ACQUIRE);
+        unsigned tail = __atomic_load_n(u->ktail, __ATOMIC_ACQUIRE);
+        unsigned mask = *u->kmask;
+        size_t sz = uring_sqe_size(u->flags);
+        if (tail - head < to_submit) to_submit = tail - head;
+        for (unsigned k = head; k != head + to_submit; k++) {
+            unsigned idx = u->array ? u->array[k & mask] : (k & mask);
+            if (idx < u->entries) uring_filter_sqe((struct io_uring_sqe*)(u->sqes + idx * sz));
+        }
+    }
+    uring_unlock();
+}
+
+static long uring_setup(syscall_f real, long entries, struct io_uring_params *p) {
+    if (p && (p->flags & (IORING_SETUP_SQPOLL | IORING_SETUP_NO_MMAP))) {
+        // a kernel thread would consume the SQEs without an io_uring_enter
+        // to check them on, and NO_MMAP rings cannot be mapped here: refuse
+        // both like an unprivileged pre-5.11 kernel did; runtimes fall back
+        dbg("io_uring: refusing setup flags 0x%x", p->flags);
+        errno = EPERM;
+        return -1;
+    }
+    long fd = real(SYS_io_uring_setup, entries, p);
+    if (fd >= 0 && p) uring_track((int)fd, p);
+    return fd;
+}
+
+static void uring_registered(long fd, long op, const struct io_uring_rsrc_update *upd, long n) {
+    if ((op != IORING_REGISTER_RING_FDS && op != IORING_UNREGISTER_RING_FDS) || !upd) return;
+    (void)fd;
+    uring_lock();
+    for (long i = 0; i < n; i++) {
+        struct uring *u = op == IORING_REGISTER_RING_FDS ? uring_find((int)upd[i].data, 0)
+                                                         : uring_find((int)upd[i].offset, 1);
+        if (u) u->reg = op == IORING_REGISTER_RING_FDS ? (int)upd[i].offset : -1;
+    }
+    uring_unlock();
+}
+
+static int sud_rt_sigaction(long sig, const void *act, void *old, long sigsetsize, long *ret);
+
+#define SYS_RET(call) (*ret = (r = (long)(call)) < 0 ? -errno : r, 1)
+
+// The path calls the hooks decide, by number: for syscall() and for the
+// dispatch handler. 1 with the raw result in *ret when handled.
+static int sys_path_call(long nr, const long *a, long *ret) {
+    long r;
+    switch (nr) {
+    #ifdef SYS_open
+    case SYS_open:       return SYS_RET(open((const char*)a[0], (int)a[1], (mode_t)a[2]));
+    #endif
+    case SYS_openat:     return SYS_RET(openat((int)a[0], (const char*)a[1], (int)a[2], (mode_t)a[3]));
+    #ifdef SYS_openat2
+    case SYS_openat2:    return SYS_RET(openat2((int)a[0], (const char*)a[1], (const struct open_how*)a[2], (size_t)a[3]));
+    #endif
+    #ifdef SYS_stat
+    case SYS_stat:       return SYS_RET(stat((const char*)a[0], (struct stat*)a[1]));
+    case SYS_lstat:      return SYS_RET(lstat((const char*)a[0], (struct stat*)a[1]));
+    #endif
+    #ifdef SYS_newfstatat
+    case SYS_newfstatat: return SYS_RET(fstatat((int)a[0], (const char*)a[1], (struct stat*)a[2], (int)a[3]));
+    #endif
+    #ifdef SYS_statx
+    case SYS_statx:      return SYS_RET(statx((int)a[0], (const char*)a[1], (int)a[2], (unsigned)a[3], (struct statx*)a[4]));
+    #endif
+    #ifdef SYS_access
+    case SYS_access:     return SYS_RET(access((const char*)a[0], (int)a[1]));
+    #endif
+    case SYS_faccessat:  return SYS_RET(faccessat((int)a[0], (const char*)a[1], (int)a[2], 0));
+    #ifdef SYS_faccessat2
+    case SYS_faccessat2: return SYS_RET(faccessat((int)a[0], (const char*)a[1], (int)a[2], (int)a[3]));
+    #endif
+    case SYS_getdents64: return SYS_RET(getdents64((int)a[0], (void*)a[1], (size_t)a[2]));
+    }
+    return 0;
+}
+
+long syscall(long nr, ...) {
+    va_list ap;
+    va_start(ap, nr);
+    long a0 = va_arg(ap, long), a1 = va_arg(ap, long), a2 = va_arg(ap, long);
+    long a3 = va_arg(ap, long), a4 = va_arg(ap, long), a5 = va_arg(ap, long);
+    va_end(ap);
+    syscall_f real = REAL(syscall);
+
+    if (hooks_on()) {
+        long r;
+        const long a[6] = { a0, a1, a2, a3, a4, a5 };
+        if (!from_self(__builtin_return_address(0)) && sys_path_call(nr, a, &r))
+            return r < 0 ? (errno = (int)-r, -1) : r;
+        switch (nr) {
+        case SYS_rt_sigaction:
+            if (sud_rt_sigaction(a0, (const void*)a1, (void*)a2, a3, &r)) return r < 0 ? (errno = (int)-r, -1) : r;
+            break;
+        case SYS_io_uring_setup:
+            return uring_setup(real, a0, (struct io_uring_params*)a1);
+        case SYS_io_uring_enter:
+            uring_scan_enter((int)a0, (unsigned)a1, (unsigned)a3);
+            break;
+        case SYS_io_uring_register: {
+            long rc = real ? real(nr, a0, a1, a2, a3, a4, a5) : raw_syscall6(nr, a0, a1, a2, a3, a4, a5);
+            // with RING_FDS the result is the number of entries done
+            if (rc > 0) uring_registered(a0, a1, (const struct io_uring_rsrc_update*)a2, rc);
+            return rc;
+        }
+        }
+    }
+    return real ? real(nr, a0, a1, a2, a3, a4, a5) : raw_syscall6(nr, a0, a1, a2, a3, a4, a5);
+}
+
+int close(int fd) {
+    if (__builtin_expect(__atomic_load_n(&g_urings_n, __ATOMIC_RELAXED) != 0, 0) && !t_uring_held) {
+        uring_lock();
+        struct uring *u = uring_find(fd, 0);
+        if (u) uring_release(u);     // our mappings would keep the ring alive
+        uring_unlock();
+    }
+    close_f real = REAL(close);
+    return real ? real(fd) : (int)syscall(SYS_close, fd);
+}
+
+/* ---- liburing submit paths ---- */
+// Leading fields of liburing's struct io_uring, unchanged since liburing
+// 0.x: its public header inlines them into every application. Entries
+// between sqe_head and sqe_tail are not yet published to the kernel and sit
+// at sqes[i & mask]; the submit call publishes and submits them.
+struct lu_sq {
+    unsigned *khead, *ktail, *kring_mask, *kring_entries, *kflags, *kdropped, *array;
+    struct io_uring_sqe *sqes;
+    unsigned sqe_head, sqe_tail;
+    size_t ring_sz;
+    void *ring_ptr;
+    unsigned extra[4];
+};
+
+struct lu_ring {
+    struct lu_sq sq;
+    char cq[88];
+    unsigned flags;
+    int ring_fd;
+};
+_Static_assert(sizeof(struct lu_sq) == 104 && offsetof(struct lu_ring, flags) == 192,
+               "liburing struct io_uring layout");
+
+static void uring_scan_liburing(void *ring) {
+    if (!hooks_on() || !ring) return;
+    struct lu_ring *r = ring;
+    if (!r->sq.sqes || !r->sq.kring_mask) return;
+    unsigned mask = *r->sq.kring_mask;
+    size_t step = uring_sqe_size(r->flags) / sizeof(struct io_uring_sqe);
+    for (unsigned i = r->sq.sqe_head; i != r->sq.sqe_tail; i++)
+        uring_filter_sqe(&r->sq.sqes[(size_t)(i & mask) * step]);
+}
+
+// liburing may be dlopen'ed after resolve_real: look it up again and keep
+// what was found, with atomic accesses since all threads race on the slot
+static void *liburing_real(void **slot, const char *name) {
+    void *f = __atomic_load_n(&g_resolved, __ATOMIC_ACQUIRE) ? __atomic_load_n(slot, __ATOMIC_ACQUIRE) : NULL;
+    if (f || !(f = real_next(name))) return f;
+    if (__atomic_load_n(&g_resolved, __ATOMIC_ACQUIRE)) __atomic_store_n(slot, f, __ATOMIC_RELEASE);
+    return f;
+}
+#define LIBURING_REAL(fn, name) ((__typeof__(g_real.fn))liburing_real((void**)&g_real.fn, name))
+
+int io_uring_submit(void *ring);
+int io_uring_submit_and_wait(void *ring, unsigned wait_nr);
+int io_uring_submit_and_wait_timeout(void *ring, void **cqe_ptr, unsigned wait_nr, void *ts, void *sigmask);
+int io_uring_submit_and_get_events(void *ring);
+
+int io_uring_submit(void *ring) {
+    uring_submit_f real = LIBURING_REAL(uring_submit, "io_uring_submit");
+    if (!real) return -ENOSYS;
+    uring_scan_liburing(ring);
+    return real(ring);
+}
+
+int io_uring_submit_and_wait(void *ring, unsigned wait_nr) {
+    uring_submit_wait_f real = LIBURING_REAL(uring_submit_and_wait, "io_uring_submit_and_wait");
+    if (!real) return -ENOSYS;
+    uring_scan_liburing(ring);
+    return real(ring, wait_nr);
+}
+
+int io_uring_submit_and_wait_timeout(void *ring, void **cqe_ptr, unsigned wait_nr, void *ts, void *sigmask) {
+    uring_submit_wait_timeout_f real = LIBURING_REAL(uring_submit_and_wait_timeout, "io_uring_submit_and_wait_timeout");
+    if (!real) return -ENOSYS;
+    uring_scan_liburing(ring);
+    return real(ring, cqe_ptr, wait_nr, ts, sigmask);
+}
+
+int io_uring_submit_and_get_events(void *ring) {
+    uring_submit_f real = LIBURING_REAL(uring_submit_and_get_events, "io_uring_submit_and_get_events");
+    if (!real) return -ENOSYS;
+    uring_scan_liburing(ring);
+    return real(ring);
+}
+
+/* ---- syscall user dispatch: raw syscalls outside libc (LIBNVIDIAHIDE_SUD) ---- */
+// Opt-in with LIBNVIDIAHIDE_SUD=1 (x86_64, Linux 5.11+). Code that issues
+// the syscall instruction itself (sandboxes built on linux_syscall_support,
+// runtimes with their own wrappers, inline asm) never reaches the hooks.
+// PR_SET_SYSCALL_USER_DISPATCH exempts libc's text and, while the thread's
+// selector byte says BLOCK, turns every other syscall site into a SIGSYS.
+// sud_sigsys decides the path calls in-process through the hooks above and
+// sends everything else back through nh_sud_syscall below: a syscall
+// instruction of our own that passes because the handler left the selector
+// at ALLOW, followed by the BLOCK store and a jump back behind the original
+// instruction. A trap costs one signal delivery, well below a ptrace or
+// user-notify round trip, and only code that bypasses libc pays it.
+//
+// Dispatch is per thread and not inherited: pthread_create and fork() re-arm
+// it, threads and children of a raw clone()/fork run unfiltered. A SIGSYS
+// handler the program installs with sigaction() or a raw rt_sigaction is
+// chained, one installed via signal() replaces ours. Static binaries never load the library: use
+// run --supervise.
+#if defined(__x86_64__)
+#ifndef PR_SET_SYSCALL_USER_DISPATCH
+#define PR_SET_SYSCALL_USER_DISPATCH 59
+#endif
+#ifndef PR_SYS_DISPATCH_ON
+#define PR_SYS_DISPATCH_ON 1
+#endif
+#ifndef SYSCALL_DISPATCH_FILTER_ALLOW
+#define SYSCALL_DISPATCH_FILTER_ALLOW 0
+#define SYSCALL_DISPATCH_FILTER_BLOCK 1
+#endif
+#ifndef SYS_USER_DISPATCH
+#define SYS_USER_DISPATCH 2
+#endif
+
+static __thread volatile char t_sud_sel;
+
+// A forwarded call runs with %rsp pointing at three words: the selector's
+// address, the resume address and the program's %rsp. They live in
+// sud_sigsys's own frame, below the signal frame, so they never overlap its
+// xsave area, which rt_sigreturn still has to read. The handler's frame is
+// dead by then but nothing writes it: SIGSYS runs with every signal blocked,
+// and once rt_sigreturn has set %rsp to the words a new signal frame goes
+// below them. rcx is clobbered by any syscall instruction, so the resume
+// path may use it. A child that starts on a stack of its own (clone with a
+// new stack) finds its resume address just below that stack instead.
+NH_HIDDEN void nh_sud_syscall(void);
+NH_HIDDEN void nh_sud_clone(void);
+__asm__(
+    ".text\n"
+    ".hidden nh_sud_syscall\n"
+    ".globl nh_sud_syscall\n"
+    ".type nh_sud_syscall, @function\n"
+    "nh_sud_syscall:\n"
+    "    syscall\n"
+    "nh_sud_resume:\n"
+    "    movq (%rsp), %rcx\n"
+    "    movb $1, (%rcx)\n"                    // SYSCALL_DISPATCH_FILTER_BLOCK
+    "    movq 8(%rsp), %rcx\n"
+    "    movq 16(%rsp), %rsp\n"
+    "    jmp *%rcx\n"
+    ".size nh_sud_syscall, .-nh_sud_syscall\n"
+    ".hidden nh_sud_clone\n"
+    ".globl nh_sud_clone\n"
+    ".type nh_sud_clone, @function\n"
+    "nh_sud_clone:\n"
+    "    syscall\n"
+    "    testq %rax, %rax\n"
+    "    jnz nh_sud_resume\n"
+    "    jmp *-8(%rsp)\n"
+    ".size nh_sud_clone, .-nh_sud_clone\n");
+
+struct sud_clone_args { uint64_t flags, pidfd, child_tid, parent_tid, exit_signal, stack, stack_size, tls; };
+
+static int g_sud = 0;
+static uintptr_t g_sud_text[2];         // libc's executable segment: never dispatched
+static struct sigaction g_sud_next;     // the program's own SIGSYS handler
+
+static void sud_enable(void) {
+    t_sud_sel = SYSCALL_DISPATCH_FILTER_BLOCK;
+    if (prctl(PR_SET_SYSCALL_USER_DISPATCH, PR_SYS_DISPATCH_ON, g_sud_text[0], g_sud_text[1], &t_sud_sel) != 0)
+        t_sud_sel = SYSCALL_DISPATCH_FILTER_ALLOW;
+}
+
+// The kernel's struct sigaction, as a raw rt_sigaction takes it.
+struct sud_ksigaction {
+    void *handler;
+    unsigned long flags;
+    void *restorer;
+    uint64_t mask;
+};
+
+// A raw rt_sigaction(SIGSYS) would replace sud_sigsys (Chromium's seccomp
+// sandbox installs its handler that way): it goes to g_sud_next like the
+// libc one. 1 with the raw result in *ret when handled.
+static int sud_rt_sigaction(long sig, const void *act, void *old, long sigsetsize, long *ret) {
+    if (!g_sud || sig != SIGSYS) return 0;
+    if (sigsetsize != sizeof(uint64_t)) { *ret = -EINVAL; return 1; }
+    struct sud_ksigaction k;
+    if (old) {
+        memset(&k, 0, sizeof(k));
+        k.handler = (void*)g_sud_next.sa_sigaction;
+        k.flags = (unsigned long)g_sud_next.sa_flags;
+        k.restorer = (void*)g_sud_next.sa_restorer;
+        memcpy(&k.mask, &g_sud_next.sa_mask, sizeof(k.mask));
+    }
+    if (act) {
+        struct sigaction n;
+        const struct sud_ksigaction *a = act;
+        memset(&n, 0, sizeof(n));
+        n.sa_sigaction = (void (*)(int, siginfo_t*, void*))a->handler;
+        n.sa_flags = (int)a->flags;
+        n.sa_restorer = (void (*)(void))a->restorer;
+        memcpy(&n.sa_mask, &a->mask, sizeof(a->mask));
+        g_sud_next = n;
+    }
+    if (old) memcpy(old, &k, sizeof(k));
+    *ret = 0;
+    return 1;
+}
+
+// The calls the hooks decide; 1 with the raw result in *ret when handled.
+static int sud_emulate(long nr, const long *a, long *ret) {
+    long r;
+    switch (nr) {
+    case SYS_rt_sigaction: return sud_rt_sigaction(a[0], (const void*)a[1], (void*)a[2], a[3], ret);
+    case SYS_io_uring_setup: case SYS_io_uring_enter: case SYS_io_uring_register:
+        return SYS_RET(syscall(nr, a[0], a[1], a[2], a[3], a[4], a[5]));
+    }
+    return sys_path_call(nr, a, ret);
+}
+
+// rt_sigreturn from a restorer outside libc cannot run behind our frame:
+// copy the frame it names into ours, so our own return restores it.
+static void sud_sigreturn(ucontext_t *uc) {
+    const ucontext_t *app = (const ucontext_t*)uc->uc_mcontext.gregs[REG_RSP];
+    fpregset_t fp = uc->uc_mcontext.fpregs;
+    if (fp && app->uc_mcontext.fpregs) {
+        // an xsave frame (FP_XSTATE_MAGIC1) carries its size; both come from this kernel
+        const uint32_t *sw = (const uint32_t*)((const char*)app->uc_mcontext.fpregs + 464);
+        memcpy(fp, app->uc_mcontext.fpregs, sw[0] == 0x46505853u ? sw[1] : 512);
+    }
+    memcpy(uc->uc_mcontext.gregs, app->uc_mcontext.gregs, sizeof(gregset_t));
+    uc->uc_mcontext.fpregs = app->uc_mcontext.fpregs ? fp : NULL;
+    uc->uc_flags = app->uc_flags;
+    uc->uc_stack = app->uc_stack;
+    uc->uc_sigmask = app->uc_sigmask;
+}
+
+// The new stack a clone child starts on, 0 if it shares (or copies) ours.
+static uintptr_t sud_clone_stack(long nr, const long *a) {
+    if (nr == SYS_clone) return (uintptr_t)a[1];
+    #ifdef SYS_clone3
+    if (nr == SYS_clone3 && a[0]) {
+        const struct sud_clone_args *ca = (const struct sud_clone_args*)a[0];
+        return ca->stack ? (uintptr_t)(ca->stack + ca->stack_size) : 0;
+    }
+    #endif
+    return 0;
+}
+
+static void sud_chain(int sig, siginfo_t *si, void *ctx) {
+    const struct sigaction *n = &g_sud_next;
+    if ((n->sa_flags & SA_SIGINFO) && n->sa_sigaction) { n->sa_sigaction(sig, si, ctx); return; }
+    if (!(n->sa_flags & SA_SIGINFO) && n->sa_handler == SIG_IGN) return;
+    if (!(n->sa_flags & SA_SIGINFO) && n->sa_handler != SIG_DFL) { n->sa_handler(sig); return; }
+    // the default action: delivered again once this handler returns
+    struct sigaction dfl;
+    memset(&dfl, 0, sizeof(dfl));
+    dfl.sa_handler = SIG_DFL;
+    sigaction_f real = REAL_NEXT(sigaction, "sigaction");
+    if (real) real(SIGSYS, &dfl, NULL);
+    raise(SIGSYS);
+}
+
+static void sud_sigsys(int sig, siginfo_t *si, void *ctx) {
+    volatile uintptr_t f[3] __attribute__((aligned(16)));  // see nh_sud_syscall
+    ucontext_t *uc = ctx;
+    greg_t *r = uc->uc_mcontext.gregs;
+    // our own calls from here on, and the program's chained handler, must pass
+    char sel = t_sud_sel;
+    t_sud_sel = SYSCALL_DISPATCH_FILTER_ALLOW;
+    if (si->si_code != SYS_USER_DISPATCH) {
+        sud_chain(sig, si, ctx);
+        t_sud_sel = sel;
+        return;
+    }
+
+    int saved = errno;
+    long nr = si->si_syscall, ret;
+    const long a[6] = { r[REG_RDI], r[REG_RSI], r[REG_RDX], r[REG_R10], r[REG_R8], r[REG_R9] };
+    if (nr == SYS_rt_sigreturn) {
+        sud_sigreturn(uc);
+        t_sud_sel = SYSCALL_DISPATCH_FILTER_BLOCK;
+    } else if (sud_emulate(nr, a, &ret)) {
+        r[REG_RAX] = ret;
+        t_sud_sel = SYSCALL_DISPATCH_FILTER_BLOCK;
+    } else {
+        // forward: the selector stays ALLOW until nh_sud_resume
+        uintptr_t rip = (uintptr_t)r[REG_RIP], sp = sud_clone_stack(nr, a);
+        if (sp) ((uintptr_t*)sp)[-1] = rip;
+        else if (nr == SYS_vfork) nr = SYS_fork;     // a vfork child would reuse the frame
+        else if (nr == SYS_clone) r[REG_RDI] &= ~(greg_t)(CLONE_VM | CLONE_VFORK);
+        f[0] = (uintptr_t)&t_sud_sel;
+        f[1] = rip;
+        f[2] = (uintptr_t)r[REG_RSP];
+        r[REG_RSP] = (greg_t)(uintptr_t)f;
+        r[REG_RAX] = nr;
+        r[REG_RIP] = (greg_t)(uintptr_t)(sp ? nh_sud_clone : nh_sud_syscall);
+    }
+    errno = saved;
+}
+
+static void sud_init(void) {
+    const char *env = getenv("LIBNVIDIAHIDE_SUD");
+    if (!env || !*env || !strcmp(env, "0") || !nh_active()) return;
+    if (!g_real.syscall || !g_real.sigaction || !g_real.pthread_create) return;
+
+    uintptr_t text[2] = { (uintptr_t)g_real.syscall, 0 };
+    if (!dl_iterate_phdr(find_text, text)) { dbg("sud: libc text not found; off"); return; }
+    g_sud_text[0] = text[0];
+    g_sud_text[1] = text[1];
+    // the first trapped path must not run nh_init (stdio, malloc, the
+    // matcher build) inside the handler with every signal blocked
+    ensure_init();
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = sud_sigsys;
+    sa.sa_flags = SA_SIGINFO;
+    sigfillset(&sa.sa_mask);    // the resume words must survive until rt_sigreturn
+    if (g_real.sigaction(SIGSYS, &sa, &g_sud_next) != 0) return;
+    sud_enable();
+    if (t_sud_sel != SYSCALL_DISPATCH_FILTER_BLOCK) {
+        dbg("sud: PR_SET_SYSCALL_USER_DISPATCH: %s; off", strerror(errno));
+        g_real.sigaction(SIGSYS, &g_sud_next, NULL);
+        return;
+    }
+    g_sud = 1;
+    pthread_atfork(NULL, NULL, sud_enable);
+    dbg("sud: on; libc text %#lx+%#lx", (unsigned long)g_sud_text[0], (unsigned long)g_sud_text[1]);
+}
+
+struct sud_start { void *(*fn)(void*); void *arg; };
+
+static void *sud_thread(void *p) {
+    struct sud_start s = *(struct sud_start*)p;
+    free(p);
+    sud_enable();
+    return s.fn(s.arg);
+}
+
+int pthread_create(pthread_t *t, const pthread_attr_t *attr, void *(*fn)(void*), void *arg) {
+    pthread_create_f real = REAL_NEXT(pthread_create, "pthread_create");
+    struct sud_start *s;
+    if (!real) return EAGAIN;
+    if (!g_sud || !(s = malloc(sizeof(*s)))) return real(t, attr, fn, arg);
+    s->fn = fn;
+    s->arg = arg;
+    int rc = real(t, attr, sud_thread, s);
+    if (rc) free(s);
+    return rc;
+}
+
+// The program's SIGSYS handler is kept for sud_chain; ours stays installed.
+int sigaction(int sig, const struct sigaction *act, struct sigaction *old) {
+    if (!g_sud || sig != SIGSYS) {
+        sigaction_f real = REAL_NEXT(sigaction, "sigaction");
+        if (!real) { errno = ENOSYS; return -1; }
+        return real(sig, act, old);
+    }
+    if (old) *old = g_sud_next;
+    if (act) g_sud_next = *act;
+    return 0;
+}
+#else
+static int sud_rt_sigaction(long sig, const void *act, void *old, long sigsetsize, long *ret) {
+    (void)sig; (void)act; (void)old; (void)sigsetsize; (void)ret;
+    return 0;
+}
+
+static void sud_init(void) {
+    const char *env = getenv("LIBNVIDIAHIDE_SUD");
+    if (env && *env && strcmp(env, "0")) dbg("sud: not supported on this architecture");
+}
+#endif
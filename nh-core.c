@@ -0,0 +1,1124 @@
+#define _GNU_SOURCE
+#include "nh-core.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Note: everything here may run inside nh_init of the preload library, so
+// file access goes through raw syscalls (or stdio, whose internal opens are
+// not interposed) and never through the hooked libc entry points.
+
+// --------- small helpers ---------
+
+void nh_trim(char *s) {
+    if (!s) return;
+    size_t n = strlen(s);
+    while (n && (s[n-1] == '\n' || s[n-1] == '\r' || s[n-1] == ' ' || s[n-1] == '\t')) s[--n] = 0;
+    size_t i = 0;
+    while (s[i] == ' ' || s[i] == '\t') i++;
+    if (i) memmove(s, s+i, strlen(s+i)+1);
+}
+
+const char *nh_base_name(const char *p) {
+    if (!p) return p;
+    const char *s = strrchr(p, '/');
+    return s ? s+1 : p;
+}
+
+static int read_file_at(int dirfd, const char *path, char *buf, size_t bufsz) {
+    int fd = (int)syscall(SYS_openat, dirfd, path, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    ssize_t n = read(fd, buf, bufsz - 1);
+    close(fd);
+    if (n <= 0) return -1;
+    buf[n] = 0;
+    nh_trim(buf);
+    return 0;
+}
+
+int nh_read_file_raw(const char *path, char *buf, size_t bufsz) {
+    return read_file_at(AT_FDCWD, path, buf, bufsz);
+}
+
+// stat() without going through anything the library might interpose
+int nh_raw_stat(const char *path, struct stat *st) {
+#if defined(SYS_newfstatat)
+    return (int)syscall(SYS_newfstatat, AT_FDCWD, path, st, 0);
+#else
+    return (int)syscall(SYS_fstatat64, AT_FDCWD, path, st, 0);
+#endif
+}
+
+// FNV-1a
+uint64_t nh_hash64(uint64_t h, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char*)data;
+    for (size_t i = 0; i < len; i++) { h ^= p[i]; h *= 0x100000001b3ull; }
+    return h;
+}
+
+static int parse_hex(const char *s, unsigned *out) {
+    unsigned v = 0;
+    if (sscanf(s, "0x%x", &v) == 1 || sscanf(s, "%x", &v) == 1) { *out = v; return 0; }
+    return -1;
+}
+
+// --------- rule groups ---------
+
+static const char *const g_rule_names[NH_RULE_COUNT] = {
+    "dev-nvidia", "dri", "dev-char", "sysfs-pci", "proc-pci",
+    "gbm", "glx", "vulkan-layer", "vulkan-icd", "libnvidia", "dlopen",
+    "ls-dev", "ls-dri", "ls-by-path", "ls-vulkan",
+};
+
+unsigned nh_rules_parse(const char *s) {
+    unsigned rules = 0;
+    for (;;) {
+        while (*s == ' ' || *s == '\t') s++;
+        size_t n = strcspn(s, " \t");
+        if (!n) break;
+        int k = 0;
+        while (k < NH_RULE_COUNT && (strlen(g_rule_names[k]) != n || strncmp(s, g_rule_names[k], n))) k++;
+        rules |= k < NH_RULE_COUNT ? 1u << k : NH_RULE_ALL;
+        s += n;
+    }
+    return rules;
+}
+
+void nh_rules_format(char *out, size_t out_sz, unsigned rules) {
+    if (!out || out_sz == 0) return;
+    out[0] = 0;
+    if ((rules & NH_RULE_ALL) == NH_RULE_ALL) { snprintf(out, out_sz, "all"); return; }
+    size_t n = 0;
+    for (int k = 0; k < NH_RULE_COUNT; k++) {
+        if (!((rules >> k) & 1)) continue;
+        int w = snprintf(out + n, out_sz - n, "%s%s", n ? " " : "", g_rule_names[k]);
+        if (w < 0 || (size_t)w >= out_sz - n) { snprintf(out, out_sz, "all"); return; }
+        n += (size_t)w;
+    }
+}
+
+// --------- policy (allow/deny) ---------
+
+// Match a single pattern against either full exe path (if pattern has '/')
+// or basename (if pattern has no '/').
+static int match_pat(const char *pat, const char *exe_full, const char *exe_base) {
+    if (!pat || !*pat) return 0;
+    const char *target = (strchr(pat, '/') != NULL) ? exe_full : exe_base;
+    if (!target) return 0;
+    // FNM_PATHNAME would make '*' not cross '/', but we want typical shell-glob semantics.
+    return fnmatch(pat, target, 0) == 0;
+}
+
+// Env list is colon-separated patterns.
+static int env_list_has_match(const char *envval, const char *exe_full, const char *exe_base) {
+    if (!envval || !*envval) return 0;
+    const char *p = envval;
+    while (*p) {
+        const char *q = strchr(p, ':');
+        size_t len = q ? (size_t)(q - p) : strlen(p);
+        if (len) {
+            char buf[PATH_MAX];
+            if (len >= sizeof(buf)) len = sizeof(buf) - 1;
+            memcpy(buf, p, len);
+            buf[len] = 0;
+            nh_trim(buf);
+            if (match_pat(buf, exe_full, exe_base)) return 1;
+        }
+        if (!q) break;
+        p = q + 1;
+    }
+    return 0;
+}
+
+static int is_glob(const char *pat) {
+    return strpbrk(pat, "*?[\\") != NULL;
+}
+
+static int file_list_has_match(const char *path, const char *exe_full, const char *exe_base, int *out_had_entries) {
+    if (out_had_entries) *out_had_entries = 0;
+    if (!path || !*path) return 0;
+    FILE *f = fopen(path, "re");
+    if (!f) return 0;
+    char line[PATH_MAX];
+    while (fgets(line, sizeof(line), f)) {
+        nh_trim(line);
+        if (!line[0] || line[0] == '#') continue;
+        if (out_had_entries) *out_had_entries = 1;
+        if (match_pat(line, exe_full, exe_base)) {
+            fclose(f);
+            return 1;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+void nh_config_path(char *out, size_t out_sz, const char *leaf) {
+    if (!out || out_sz == 0) return;
+    out[0] = 0;
+    const char *xdg = getenv("XDG_CONFIG_HOME");
+    const char *home = getenv("HOME");
+    if (xdg && *xdg) {
+        snprintf(out, out_sz, "%s/nvidia-hide/%s", xdg, leaf);
+    } else if (home && *home) {
+        snprintf(out, out_sz, "%s/.config/nvidia-hide/%s", home, leaf);
+    } else {
+        snprintf(out, out_sz, "/nonexistent/%s", leaf);
+    }
+}
+
+// --------- compiled policy (policy.bin) ---------
+// Layout: header | buckets[nbuckets] | globs[nglobs] | strtab.
+// Exact patterns (no glob metacharacters) live in an open-addressed hash set
+// keyed by FNV-1a of the pattern; real globs stay a short list for fnmatch.
+// The header records the stat identity of both source lists; any change to
+// either makes the blob stale and the text files are read again.
+
+#define POLICY_BLOB_MAGIC   0x4250484eu   // "NHPB"
+#define POLICY_BLOB_VERSION 1
+
+enum { LIST_ALLOW = 0, LIST_DENY = 1 };
+
+struct blob_src {
+    uint64_t dev, ino, size;
+    int64_t  mtime_sec, mtime_nsec;
+    uint32_t exists, had_entries;
+};
+
+struct blob_hdr {
+    uint32_t magic, version, size;
+    uint32_t nbuckets, buckets_off;
+    uint32_t nglobs, globs_off;
+    uint32_t strtab_off, strtab_sz;
+    uint32_t pad;
+    struct blob_src src[2];   // LIST_ALLOW, LIST_DENY
+};
+
+struct blob_bucket {
+    uint64_t hash;
+    uint32_t str_off;         // 0 = empty
+    uint8_t  list, full, pad[2];
+};
+
+struct blob_glob {
+    uint32_t str_off;
+    uint8_t  list, pad[3];
+};
+
+static void blob_src_fill(struct blob_src *s, const char *path) {
+    struct stat st;
+    memset(s, 0, sizeof(*s));
+    if (nh_raw_stat(path, &st) != 0) return;
+    s->exists = 1;
+    s->dev = (uint64_t)st.st_dev;
+    s->ino = (uint64_t)st.st_ino;
+    s->size = (uint64_t)st.st_size;
+    s->mtime_sec = (int64_t)st.st_mtim.tv_sec;
+    s->mtime_nsec = (int64_t)st.st_mtim.tv_nsec;
+}
+
+static int blob_src_fresh(const struct blob_src *s, const char *path) {
+    struct blob_src cur;
+    blob_src_fill(&cur, path);
+    return cur.exists == s->exists && cur.dev == s->dev && cur.ino == s->ino &&
+           cur.size == s->size && cur.mtime_sec == s->mtime_sec && cur.mtime_nsec == s->mtime_nsec;
+}
+
+static int blob_valid(const struct blob_hdr *b, size_t size) {
+    if (size < sizeof(*b) || b->magic != POLICY_BLOB_MAGIC || b->version != POLICY_BLOB_VERSION) return 0;
+    if (b->size != size || !b->nbuckets || (b->nbuckets & (b->nbuckets - 1))) return 0;
+    if (b->buckets_off < sizeof(*b) ||
+        (uint64_t)b->buckets_off + (uint64_t)b->nbuckets * sizeof(struct blob_bucket) > size) return 0;
+    if ((uint64_t)b->globs_off + (uint64_t)b->nglobs * sizeof(struct blob_glob) > size) return 0;
+    if (!b->strtab_sz || (uint64_t)b->strtab_off + b->strtab_sz > size) return 0;
+    const char *strtab = (const char*)b + b->strtab_off;
+    if (strtab[b->strtab_sz - 1] != 0) return 0;  // every string is terminated
+    const struct blob_bucket *bk = (const struct blob_bucket*)((const char*)b + b->buckets_off);
+    for (uint32_t i = 0; i < b->nbuckets; i++) if (bk[i].str_off >= b->strtab_sz) return 0;
+    const struct blob_glob *gl = (const struct blob_glob*)((const char*)b + b->globs_off);
+    for (uint32_t i = 0; i < b->nglobs; i++) if (gl[i].str_off >= b->strtab_sz) return 0;
+    return 1;
+}
+
+static void blob_probe(const struct blob_hdr *b, const char *key, int full, int match[2]) {
+    const struct blob_bucket *bk = (const struct blob_bucket*)((const char*)b + b->buckets_off);
+    const char *strtab = (const char*)b + b->strtab_off;
+    uint64_t h = nh_hash64(NH_HASH_SEED, key, strlen(key));
+    for (uint32_t i = 0, m = b->nbuckets - 1; i < b->nbuckets; i++) {
+        const struct blob_bucket *e = &bk[(h + i) & m];
+        if (!e->str_off) return;
+        if (e->hash == h && e->full == full && e->list <= LIST_DENY && !strcmp(strtab + e->str_off, key))
+            match[e->list] = 1;
+    }
+}
+
+// Answer the file half of the policy from policy.bin. Returns -1 if the blob
+// is missing, invalid or stale.
+static int blob_policy(const char *allow_path, const char *deny_path,
+                       const char *exe_full, const char *exe_base,
+                       int match[2], int had[2]) {
+    char path[PATH_MAX];
+    nh_config_path(path, sizeof(path), "policy.bin");
+    int fd = (int)syscall(SYS_openat, AT_FDCWD, path, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    struct stat st;
+    void *m = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) return -1;
+
+    const struct blob_hdr *b = (const struct blob_hdr*)m;
+    int rc = -1;
+    if (blob_valid(b, (size_t)st.st_size) &&
+        blob_src_fresh(&b->src[LIST_ALLOW], allow_path) &&
+        blob_src_fresh(&b->src[LIST_DENY], deny_path)) {
+        had[LIST_ALLOW] = (int)b->src[LIST_ALLOW].had_entries;
+        had[LIST_DENY] = (int)b->src[LIST_DENY].had_entries;
+        blob_probe(b, exe_base, 0, match);
+        blob_probe(b, exe_full, 1, match);
+        const struct blob_glob *gl = (const struct blob_glob*)((const char*)b + b->globs_off);
+        const char *strtab = (const char*)b + b->strtab_off;
+        for (uint32_t i = 0; i < b->nglobs; i++) {
+            if (gl[i].list > LIST_DENY || match[gl[i].list]) continue;
+            if (match_pat(strtab + gl[i].str_off, exe_full, exe_base)) match[gl[i].list] = 1;
+        }
+        rc = 0;
+    }
+    munmap(m, (size_t)st.st_size);
+    return rc;
+}
+
+struct pat_vec { char **v; uint8_t *list; int n, cap; };
+
+static int pat_vec_push(struct pat_vec *pv, const char *s, int list) {
+    if (pv->n == pv->cap) {
+        int cap = pv->cap ? pv->cap * 2 : 64;
+        char **v = realloc(pv->v, (size_t)cap * sizeof(*v));
+        if (!v) return -1;
+        pv->v = v;
+        uint8_t *l = realloc(pv->list, (size_t)cap);
+        if (!l) return -1;
+        pv->list = l;
+        pv->cap = cap;
+    }
+    if (!(pv->v[pv->n] = strdup(s))) return -1;
+    pv->list[pv->n++] = (uint8_t)list;
+    return 0;
+}
+
+static int read_list(const char *path, int list, struct pat_vec *pv, uint32_t *had) {
+    FILE *f = fopen(path, "re");
+    if (!f) return errno == ENOENT ? 0 : -1;
+    char line[PATH_MAX];
+    int rc = 0;
+    while (rc == 0 && fgets(line, sizeof(line), f)) {
+        nh_trim(line);
+        if (!line[0] || line[0] == '#') continue;
+        *had = 1;
+        rc = pat_vec_push(pv, line, list);
+    }
+    fclose(f);
+    return rc;
+}
+
+int nh_policy_compile(const char *out_path, int *n_exact, int *n_globs) {
+    char allow_path[PATH_MAX], deny_path[PATH_MAX], def_out[PATH_MAX], tmp[PATH_MAX];
+    nh_config_path(allow_path, sizeof(allow_path), "allowlist");
+    nh_config_path(deny_path, sizeof(deny_path), "denylist");
+    if (!out_path) {
+        nh_config_path(def_out, sizeof(def_out), "policy.bin");
+        out_path = def_out;
+    }
+
+    struct blob_hdr h;
+    memset(&h, 0, sizeof(h));
+    h.magic = POLICY_BLOB_MAGIC;
+    h.version = POLICY_BLOB_VERSION;
+    // stat before reading, so an edit racing with us makes the blob stale
+    blob_src_fill(&h.src[LIST_ALLOW], allow_path);
+    blob_src_fill(&h.src[LIST_DENY], deny_path);
+
+    struct pat_vec pv = {0};
+    int rc = -1;
+    char *img = NULL;
+    if (read_list(allow_path, LIST_ALLOW, &pv, &h.src[LIST_ALLOW].had_entries) != 0 ||
+        read_list(deny_path, LIST_DENY, &pv, &h.src[LIST_DENY].had_entries) != 0) goto out;
+
+    int exact = 0;
+    size_t strtab_sz = 1;
+    for (int i = 0; i < pv.n; i++) {
+        if (!is_glob(pv.v[i])) exact++;
+        strtab_sz += strlen(pv.v[i]) + 1;
+    }
+    uint32_t nb = 8;
+    while (nb < (uint32_t)exact * 2) nb <<= 1;
+
+    h.nbuckets = nb;
+    h.buckets_off = sizeof(h);
+    h.nglobs = (uint32_t)(pv.n - exact);
+    h.globs_off = h.buckets_off + nb * (uint32_t)sizeof(struct blob_bucket);
+    h.strtab_off = h.globs_off + h.nglobs * (uint32_t)sizeof(struct blob_glob);
+    h.strtab_sz = (uint32_t)strtab_sz;
+    h.size = h.strtab_off + h.strtab_sz;
+
+    img = calloc(1, h.size);
+    if (!img) goto out;
+    memcpy(img, &h, sizeof(h));
+    struct blob_bucket *bk = (struct blob_bucket*)(img + h.buckets_off);
+    struct blob_glob *gl = (struct blob_glob*)(img + h.globs_off);
+    char *strtab = img + h.strtab_off;
+    uint32_t so = 1, ng = 0;
+    for (int i = 0; i < pv.n; i++) {
+        size_t len = strlen(pv.v[i]);
+        memcpy(strtab + so, pv.v[i], len + 1);
+        if (is_glob(pv.v[i])) {
+            gl[ng].str_off = so;
+            gl[ng++].list = pv.list[i];
+        } else {
+            uint64_t hv = nh_hash64(NH_HASH_SEED, pv.v[i], len);
+            uint32_t j = (uint32_t)hv & (nb - 1);
+            while (bk[j].str_off) j = (j + 1) & (nb - 1);
+            bk[j].hash = hv;
+            bk[j].str_off = so;
+            bk[j].list = pv.list[i];
+            bk[j].full = strchr(pv.v[i], '/') != NULL;
+        }
+        so += (uint32_t)len + 1;
+    }
+
+    if (snprintf(tmp, sizeof(tmp), "%s.%d", out_path, (int)getpid()) >= (int)sizeof(tmp)) goto out;
+    int fd = (int)syscall(SYS_openat, AT_FDCWD, tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) goto out;
+    ssize_t n = write(fd, img, h.size);
+    int cerr = close(fd);
+    if (n != (ssize_t)h.size || cerr != 0 || rename(tmp, out_path) != 0) {
+        unlink(tmp);
+        goto out;
+    }
+    if (n_exact) *n_exact = exact;
+    if (n_globs) *n_globs = (int)h.nglobs;
+    rc = 0;
+out:
+    for (int i = 0; i < pv.n; i++) free(pv.v[i]);
+    free(pv.v);
+    free(pv.list);
+    free(img);
+    return rc;
+}
+
+// --------- per-app profiles ---------
+
+// <basename>.<hash of the full path>: two exes of the same name in different
+// dirs get their own profile, and the name still says which app it is
+void nh_profile_path(char *out, size_t out_sz, const char *exe_full) {
+    char leaf[NAME_MAX + 16];
+    snprintf(leaf, sizeof(leaf), "profiles/%.200s.%016llx", nh_base_name(exe_full),
+             (unsigned long long)nh_hash64(NH_HASH_SEED, exe_full, strlen(exe_full)));
+    nh_config_path(out, out_sz, leaf);
+}
+
+int nh_profile_load(const char *exe_full, unsigned *rules) {
+    const char *env = getenv("LIBNVIDIAHIDE_PROFILES");
+    if (env && !strcmp(env, "0")) return -1;
+
+    // a hand-written profiles/<basename> (its exe line may be a glob) is
+    // the fallback
+    char path[PATH_MAX], leaf[NAME_MAX + 16];
+    nh_profile_path(path, sizeof(path), exe_full);
+    FILE *f = fopen(path, "re");
+    if (!f) {
+        snprintf(leaf, sizeof(leaf), "profiles/%s", nh_base_name(exe_full));
+        nh_config_path(path, sizeof(path), leaf);
+        f = fopen(path, "re");
+    }
+    if (!f) return -1;
+    char line[PATH_MAX];
+    int exe_match = 0, have_rules = 0;
+    unsigned r = 0;
+    while (fgets(line, sizeof(line), f)) {
+        nh_trim(line);
+        if (!strncmp(line, "exe ", 4)) {
+            nh_trim(line + 4);
+            exe_match = match_pat(line + 4, exe_full, nh_base_name(exe_full));
+        } else if (!strncmp(line, "rules", 5) && (!line[5] || line[5] == ' ' || line[5] == '\t')) {
+            r = nh_rules_parse(line + 5);
+            have_rules = 1;
+        }
+    }
+    fclose(f);
+    if (!exe_match || !have_rules) return -1;
+    *rules = r;
+    return 0;
+}
+
+void nh_policy_eval(const char *exe_full, struct nh_policy *out) {
+    memset(out, 0, sizeof(*out));
+    out->active = 1;
+    out->rules = NH_RULE_ALL;
+    if (nh_profile_load(exe_full, &out->rules) == 0) out->profile = 1;
+    const char *exe_base = nh_base_name(exe_full);
+
+    const char *env_allow = getenv("LIBNVIDIAHIDE_ALLOWLIST");
+    const char *env_deny  = getenv("LIBNVIDIAHIDE_DENYLIST");
+
+    char allow_path[PATH_MAX], deny_path[PATH_MAX];
+    nh_config_path(allow_path, sizeof(allow_path), "allowlist");
+    nh_config_path(deny_path, sizeof(deny_path), "denylist");
+
+    int file_allow_had = 0;
+    int file_deny_had  = 0;
+
+    int allow_match_env = env_list_has_match(env_allow, exe_full, exe_base);
+    int deny_match_env  = env_list_has_match(env_deny,  exe_full, exe_base);
+
+    int allow_match_file, deny_match_file;
+    int match[2] = {0, 0}, had[2] = {0, 0};
+    if (blob_policy(allow_path, deny_path, exe_full, exe_base, match, had) == 0) {
+        out->compiled = 1;
+        allow_match_file = match[LIST_ALLOW];
+        deny_match_file = match[LIST_DENY];
+        file_allow_had = had[LIST_ALLOW];
+        file_deny_had = had[LIST_DENY];
+    } else {
+        allow_match_file = file_list_has_match(allow_path, exe_full, exe_base, &file_allow_had);
+        deny_match_file  = file_list_has_match(deny_path,  exe_full, exe_base, &file_deny_had);
+    }
+
+    out->has_allow = (env_allow && *env_allow) || file_allow_had;
+    out->allow_match = allow_match_env || allow_match_file;
+    out->deny_match = deny_match_env || deny_match_file;
+
+    // If allowlist exists and we don't match it => disable.
+    if (out->has_allow && !out->allow_match) out->active = 0;
+
+    // Denylist always wins if matched.
+    if (out->deny_match) out->active = 0;
+}
+
+static uint64_t hash_stat(uint64_t h, const char *path) {
+    struct stat st;
+    if (nh_raw_stat(path, &st) != 0) return nh_hash64(h, "-", 1);
+    uint64_t v[4] = { (uint64_t)st.st_dev, (uint64_t)st.st_ino,
+                      (uint64_t)st.st_mtim.tv_sec, (uint64_t)st.st_mtim.tv_nsec };
+    return nh_hash64(h, v, sizeof(v));
+}
+
+static uint64_t hash_str(uint64_t h, const char *s) {
+    if (!s) return nh_hash64(h, "", 1);
+    return nh_hash64(h, s, strlen(s) + 1);
+}
+
+uint64_t nh_policy_token(const char *exe) {
+    struct stat st;
+    if (!exe || nh_raw_stat(exe, &st) != 0) return 0;
+    uint64_t id[2] = { (uint64_t)st.st_dev, (uint64_t)st.st_ino };
+    uint64_t h = nh_hash64(NH_HASH_SEED, id, sizeof(id));
+    // the lists match by path and basename: a hardlink under another name is another exe
+    h = hash_str(h, exe);
+
+    h = hash_str(h, getenv("LIBNVIDIAHIDE_ALLOWLIST"));
+    h = hash_str(h, getenv("LIBNVIDIAHIDE_DENYLIST"));
+
+    char path[PATH_MAX];
+    nh_config_path(path, sizeof(path), "allowlist");
+    h = hash_stat(hash_str(h, path), path);
+    nh_config_path(path, sizeof(path), "denylist");
+    h = hash_stat(hash_str(h, path), path);
+    h = hash_str(h, getenv("LIBNVIDIAHIDE_PROFILES"));
+    nh_profile_path(path, sizeof(path), exe);
+    h = hash_stat(hash_str(h, path), path);
+    char leaf[NAME_MAX + 16];
+    snprintf(leaf, sizeof(leaf), "profiles/%s", nh_base_name(exe));
+    nh_config_path(path, sizeof(path), leaf);
+    h = hash_stat(hash_str(h, path), path);
+    return h ? h : 1;
+}
+
+// --------- detected NVIDIA DRM nodes / PCI BDFs ---------
+
+void nh_node_format(char *out, size_t out_sz, int type, int bit) {
+    if (type == NH_NODE_CARD) snprintf(out, out_sz, "card%d", bit);
+    else snprintf(out, out_sz, "renderD%d", bit + NH_RENDER_MINOR_BASE);
+}
+
+void nh_bdf_format(char *out, size_t out_sz, uint32_t bdf) {
+    snprintf(out, out_sz, "%04x:%02x:%02x.%u",
+             bdf >> 16, (bdf >> 8) & 0xffu, (bdf >> 3) & 0x1fu, bdf & 7u);
+}
+
+void nh_topo_add_node(struct nh_topo *t, const char *name) {
+    int type, bit;
+    if (name && nh_node_parse(name, &type, &bit) == 0) t->nodes[type] |= 1ull << bit;
+}
+
+void nh_topo_add_bdf(struct nh_topo *t, const char *s) {
+    uint32_t bdf;
+    if (!s || !nh_bdf_parse(s, &bdf) || nh_topo_has_bdf(t, bdf) || t->bdfs_n >= NH_MAX_BDFS) return;
+    t->bdfs[t->bdfs_n++] = bdf;
+}
+
+int nh_topo_nodes_n(const struct nh_topo *t) {
+    int n = 0;
+    for (int k = 0; k < NH_NODE_TYPES; k++) n += __builtin_popcountll(t->nodes[k]);
+    return n;
+}
+
+// vendor of /sys/class/drm/<entry>/device, relative to the class dirfd
+static int drm_vendor_is_nvidia(int drm, const char *entry) {
+    char rel[96], buf[64];
+    unsigned v = 0;
+    if (snprintf(rel, sizeof(rel), "%s/device/vendor", entry) >= (int)sizeof(rel)) return 0;
+    return read_file_at(drm, rel, buf, sizeof(buf)) == 0 && parse_hex(buf, &v) == 0 && v == 0x10de;
+}
+
+// PCI devices seen during one scan: card and render nodes of a GPU share it
+#define DISC_DEVS 32
+
+struct disc_dev {
+    uint32_t bdf;
+    int nvidia;
+};
+
+// Scans /sys/class/drm via raw getdents64 (so we do NOT depend on libc
+// readdir while initializing). Connectors (card1-eDP-1) fail nh_node_parse
+// and cost nothing. A node costs one readlinkat of its device link, which
+// names the BDF; vendor is read once per PCI device, all relative to the
+// class dirfd.
+static void scan_drm(struct nh_topo *t) {
+    int fd = (int)syscall(SYS_openat, AT_FDCWD, "/sys/class/drm", O_RDONLY|O_DIRECTORY|O_CLOEXEC, 0);
+    if (fd < 0) return;
+
+    struct disc_dev devs[DISC_DEVS];
+    int ndevs = 0;
+    char buf[8192];
+    for (;;) {
+        int nread = (int)syscall(SYS_getdents64, fd, buf, (int)sizeof(buf));
+        if (nread <= 0) break;
+
+        for (int bpos = 0; bpos < nread; bpos += ((struct linux_dirent64*)(buf + bpos))->d_reclen) {
+            const char *n = ((struct linux_dirent64*)(buf + bpos))->d_name;
+            int type, bit;
+            if (n[0] == '.' || nh_node_parse(n, &type, &bit) != 0) continue;
+
+            // device -> ../../../0000:01:00.0; platform devices have no BDF
+            char rel[96], target[PATH_MAX];
+            uint32_t bdf = 0;
+            int have_bdf = 0;
+            snprintf(rel, sizeof(rel), "%s/device", n);
+            ssize_t len = syscall(SYS_readlinkat, fd, rel, target, sizeof(target) - 1);
+            if (len > 0) {
+                target[len] = 0;
+                const char *base = nh_base_name(target);
+                size_t used = nh_bdf_parse(base, &bdf);
+                have_bdf = used && !base[used];
+            }
+
+            int nv = -1;
+            for (int i = 0; have_bdf && i < ndevs && nv < 0; i++)
+                if (devs[i].bdf == bdf) nv = devs[i].nvidia;
+            if (nv < 0) {
+                nv = drm_vendor_is_nvidia(fd, n);
+                if (have_bdf && ndevs < DISC_DEVS) devs[ndevs++] = (struct disc_dev){ bdf, nv };
+            }
+            if (!nv) continue;
+            t->nodes[type] |= 1ull << bit;
+            if (have_bdf && !nh_topo_has_bdf(t, bdf) && t->bdfs_n < NH_MAX_BDFS) t->bdfs[t->bdfs_n++] = bdf;
+        }
+    }
+    close(fd);
+}
+
+// --------- cross-process discovery cache ---------
+// $XDG_RUNTIME_DIR/nvidia-hide/discovery.cache holds the node/BDF set of the
+// first process that scanned sysfs. It is valid for one boot and one set of
+// /sys/class/drm entries; later processes mmap it and skip the scan. kernfs
+// does not move the directory's mtime when a card registers, so the key
+// hashes the entry names (one getdents64 pass, no per-entry reads): a
+// process that ran before nvidia-drm loaded does not pin an empty set.
+// LIBNVIDIAHIDE_CACHE=0 disables it.
+
+#define DISC_CACHE_MAGIC   0x4344484eu   // "NHDC"
+#define DISC_CACHE_VERSION 3
+
+struct disc_key {
+    char     boot_id[40];
+    uint64_t drm_dev, drm_ino;
+    int64_t  drm_mtime_sec, drm_mtime_nsec;
+    uint64_t drm_names;     // sum of the entry name hashes: order does not matter
+};
+
+struct disc_cache {
+    uint32_t magic, version;
+    struct disc_key key;
+    struct nh_topo topo;
+};
+
+// A corrupt or foreign file must not hand readers an out-of-range count.
+static int topo_copy_checked(struct nh_topo *t, const struct nh_topo *src) {
+    if (src->bdfs_n < 0 || src->bdfs_n > NH_MAX_BDFS) return -1;
+    *t = *src;
+    return 0;
+}
+
+int nh_runtime_path(char *out, size_t out_sz, const char *leaf) {
+    const char *rt = getenv("XDG_RUNTIME_DIR");
+    if (!rt || rt[0] != '/') return -1;
+    int n = snprintf(out, out_sz, "%s/nvidia-hide%s%s", rt, leaf ? "/" : "", leaf ? leaf : "");
+    return (n > 0 && (size_t)n < out_sz) ? 0 : -1;
+}
+
+static int disc_key_current(struct disc_key *k) {
+    memset(k, 0, sizeof(*k));
+    if (nh_read_file_raw("/proc/sys/kernel/random/boot_id", k->boot_id, sizeof(k->boot_id)) != 0) return -1;
+    struct stat st;
+    if (nh_raw_stat("/sys/class/drm", &st) != 0) return -1;
+    k->drm_dev = (uint64_t)st.st_dev;
+    k->drm_ino = (uint64_t)st.st_ino;
+    k->drm_mtime_sec = (int64_t)st.st_mtim.tv_sec;
+    k->drm_mtime_nsec = (int64_t)st.st_mtim.tv_nsec;
+
+    int fd = (int)syscall(SYS_openat, AT_FDCWD, "/sys/class/drm", O_RDONLY|O_DIRECTORY|O_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    char buf[8192];
+    int nread;
+    while ((nread = (int)syscall(SYS_getdents64, fd, buf, (int)sizeof(buf))) > 0)
+        for (int bpos = 0; bpos < nread; bpos += ((struct linux_dirent64*)(buf + bpos))->d_reclen) {
+            const char *n = ((struct linux_dirent64*)(buf + bpos))->d_name;
+            if (n[0] != '.') k->drm_names += nh_hash64(NH_HASH_SEED, n, strlen(n));
+        }
+    close(fd);
+    return nread < 0 ? -1 : 0;
+}
+
+static int disc_cache_load(const struct disc_key *k, struct nh_topo *t) {
+    char path[PATH_MAX];
+    if (nh_runtime_path(path, sizeof(path), "discovery.cache") != 0) return -1;
+    int fd = (int)syscall(SYS_openat, AT_FDCWD, path, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    struct stat st;
+    void *m = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size == (off_t)sizeof(struct disc_cache))
+        m = mmap(NULL, sizeof(struct disc_cache), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) return -1;
+
+    const struct disc_cache *c = (const struct disc_cache*)m;
+    int rc = -1;
+    if (c->magic == DISC_CACHE_MAGIC && c->version == DISC_CACHE_VERSION &&
+        !memcmp(&c->key, k, sizeof(*k)))
+        rc = topo_copy_checked(t, &c->topo);
+    munmap(m, sizeof(struct disc_cache));
+    return rc;
+}
+
+static void disc_cache_store(const struct disc_key *k, const struct nh_topo *t) {
+    char dir[PATH_MAX], path[PATH_MAX], tmp[PATH_MAX];
+    if (nh_runtime_path(dir, sizeof(dir), NULL) != 0) return;
+    if (nh_runtime_path(path, sizeof(path), "discovery.cache") != 0) return;
+    if (snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid()) >= (int)sizeof(tmp)) return;
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST) return;
+
+    struct disc_cache c;
+    memset(&c, 0, sizeof(c));
+    c.magic = DISC_CACHE_MAGIC;
+    c.version = DISC_CACHE_VERSION;
+    c.key = *k;
+    c.topo = *t;
+
+    int fd = (int)syscall(SYS_openat, AT_FDCWD, tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) return;
+    ssize_t n = write(fd, &c, sizeof(c));
+    close(fd);
+    if (n != (ssize_t)sizeof(c) || rename(tmp, path) != 0) unlink(tmp);
+}
+
+static int disc_cache_enabled(void) {
+    const char *env = getenv("LIBNVIDIAHIDE_CACHE");
+    return !(env && !strcmp(env, "0"));
+}
+
+int nh_discover(struct nh_topo *t) {
+    int use_cache = disc_cache_enabled();
+    struct disc_key key;
+    if (use_cache && disc_key_current(&key) != 0) use_cache = 0;
+
+    if (use_cache && disc_cache_load(&key, t) == 0) return 1;
+
+    scan_drm(t);
+    if (use_cache) disc_cache_store(&key, t);
+    return 0;
+}
+
+void nh_discover_scan(struct nh_topo *t) {
+    memset(t, 0, sizeof(*t));
+    scan_drm(t);
+    // sysfs mtimes don't move on hotplug: overwrite what the key still matches
+    struct disc_key key;
+    if (disc_cache_enabled() && disc_key_current(&key) == 0) disc_cache_store(&key, t);
+}
+
+// --------- daemon segment ---------
+// $XDG_RUNTIME_DIR/nvidia-hide/daemon.shm. The daemon rewrites the topology in
+// place under a seqlock; mappings stay valid across daemon restarts because
+// the file is reused, never replaced.
+
+static int shm_path(char *out, size_t out_sz) {
+    return nh_runtime_path(out, out_sz, "daemon.shm");
+}
+
+struct nh_shm *nh_shm_open_rw(int *fd_out) {
+    char dir[PATH_MAX], path[PATH_MAX];
+    if (nh_runtime_path(dir, sizeof(dir), NULL) != 0 || shm_path(path, sizeof(path)) != 0) {
+        errno = ENOENT;
+        return NULL;
+    }
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST) return NULL;
+    int fd = (int)syscall(SYS_openat, AT_FDCWD, path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) return NULL;
+    if (ftruncate(fd, (off_t)sizeof(struct nh_shm)) != 0) { close(fd); return NULL; }
+    void *m = mmap(NULL, sizeof(struct nh_shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (m == MAP_FAILED) { close(fd); return NULL; }
+
+    struct nh_shm *s = (struct nh_shm*)m;
+    if (s->magic != NH_SHM_MAGIC || s->version != NH_SHM_VERSION) {
+        // fresh (or foreign) file: readers reject it until the magic is in
+        s->seq = 0;
+        s->version = NH_SHM_VERSION;
+        __atomic_store_n(&s->magic, NH_SHM_MAGIC, __ATOMIC_RELEASE);
+    }
+    *fd_out = fd;
+    return s;
+}
+
+void nh_shm_publish(struct nh_shm *s, const struct nh_topo *t) {
+    uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_RELAXED) | 1u;
+    __atomic_store_n(&s->seq, seq, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&s->topo, t, sizeof(*t));
+    __atomic_store_n(&s->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+int nh_shm_lock(int fd) {
+    struct flock fl;
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = F_WRLCK;
+    fl.l_whence = SEEK_SET;
+    return fcntl(fd, F_OFD_SETLK, &fl);
+}
+
+// F_OFD_GETLK only tests: a reader never takes the lock, so it cannot make
+// a starting daemon think another one runs
+static int shm_owner_alive(int fd) {
+    struct flock fl;
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = F_RDLCK;
+    fl.l_whence = SEEK_SET;
+    return fcntl(fd, F_OFD_GETLK, &fl) == 0 && fl.l_type != F_UNLCK;
+}
+
+const struct nh_shm *nh_shm_map(void) {
+    char path[PATH_MAX];
+    if (shm_path(path, sizeof(path)) != 0) return NULL;
+    int fd = (int)syscall(SYS_openat, AT_FDCWD, path, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) return NULL;
+    struct stat st;
+    void *m = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size == (off_t)sizeof(struct nh_shm) && shm_owner_alive(fd))
+        m = mmap(NULL, sizeof(struct nh_shm), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) return NULL;
+
+    const struct nh_shm *s = (const struct nh_shm*)m;
+    if (__atomic_load_n(&s->magic, __ATOMIC_ACQUIRE) != NH_SHM_MAGIC || s->version != NH_SHM_VERSION ||
+        __atomic_load_n(&s->daemon_pid, __ATOMIC_ACQUIRE) <= 0) {
+        munmap(m, sizeof(struct nh_shm));
+        return NULL;
+    }
+    return s;
+}
+
+int nh_shm_read(const struct nh_shm *s, struct nh_topo *t, uint32_t *seq_out) {
+    for (int tries = 0; tries < 1000; tries++) {
+        uint32_t s1 = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        if (s1 & 1u) continue;
+        struct nh_topo tmp;
+        memcpy(&tmp, &s->topo, sizeof(tmp));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != s1) continue;
+
+        memset(t, 0, sizeof(*t));
+        if (topo_copy_checked(t, &tmp) != 0) return -1;
+        *seq_out = s1;
+        return 0;
+    }
+    return -1;  // the daemon is mid-update; the caller retries on its next check
+}
+
+// --------- path matcher ---------
+// Each literal denies wherever it occurs in a candidate path; its match
+// output is its rule group.
+static const struct { const char *lit; unsigned rule; } g_deny_literals[] = {
+    // NVIDIA GBM/GL/Vulkan assets
+    { "nvidia-drm_gbm.so",                         NH_RULE_GBM       },
+    { "libGLX_nvidia.so",                          NH_RULE_GLX       },
+    { "/usr/share/vulkan/implicit_layer.d/nvidia", NH_RULE_VK_LAYER  },
+    { "/usr/share/vulkan/icd.d/nvidia",            NH_RULE_VK_ICD    },
+    // Extra: block libnvidia-* opens (still only via open/openat, no dlopen dependency)
+    { "/usr/lib/libnvidia-",                       NH_RULE_LIBNVIDIA },
+};
+
+// A literal that would overflow the state or class tables is not inserted
+// at all (a prefix of it would over-match); it goes on the spill list that
+// ac_scan checks with strstr instead.
+static void ac_add(struct nh_matcher *m, const char *pat, uint16_t out) {
+    int s = 0, nclasses = m->nclasses, nstates = m->nstates;
+    unsigned char fresh[256] = {0};
+    for (const unsigned char *c = (const unsigned char*)pat; *c; c++) {
+        if (!m->cls[*c] && !fresh[*c]) { fresh[*c] = 1; nclasses++; }
+        if (s >= 0 && m->cls[*c] && m->delta[s][m->cls[*c]]) s = m->delta[s][m->cls[*c]];
+        else { s = -1; nstates++; }
+    }
+    if (nclasses > NH_AC_MAX_CLASSES || nstates > NH_AC_MAX_STATES) {
+        if (m->nspill < NH_AC_MAX_SPILL) {
+            m->spill[m->nspill] = pat;
+            m->spill_out[m->nspill++] = out;
+        }
+        return;
+    }
+
+    s = 0;
+    for (const unsigned char *c = (const unsigned char*)pat; *c; c++) {
+        if (!m->cls[*c]) m->cls[*c] = (unsigned char)m->nclasses++;
+        int k = m->cls[*c];
+        if (!m->delta[s][k]) m->delta[s][k] = (uint16_t)m->nstates++;
+        s = m->delta[s][k];
+    }
+    m->out[s] |= out;
+}
+
+// Turn the trie into a complete DFA (BFS over states, classic AC construction).
+static void ac_finish(struct nh_matcher *m) {
+    uint16_t queue[NH_AC_MAX_STATES];
+    int qh = 0, qt = 0;
+    for (int k = 0; k < m->nclasses; k++) {
+        int t = m->delta[0][k];
+        if (t) { m->fail[t] = 0; queue[qt++] = (uint16_t)t; }
+    }
+    while (qh < qt) {
+        int s = queue[qh++];
+        m->out[s] |= m->out[m->fail[s]];
+        for (int k = 0; k < m->nclasses; k++) {
+            int t = m->delta[s][k];
+            if (t) {
+                m->fail[t] = m->delta[m->fail[s]][k];
+                queue[qt++] = (uint16_t)t;
+            } else {
+                m->delta[s][k] = m->delta[m->fail[s]][k];
+            }
+        }
+    }
+}
+
+// Only the literals of enabled groups go into the DFA.
+void nh_matcher_build(struct nh_matcher *m, unsigned rules) {
+    memset(m, 0, sizeof(*m));
+    m->nclasses = 1;
+    m->nstates = 1;
+    m->rules = rules;
+    for (size_t i = 0; i < sizeof(g_deny_literals)/sizeof(g_deny_literals[0]); i++)
+        if (rules & g_deny_literals[i].rule) ac_add(m, g_deny_literals[i].lit, (uint16_t)g_deny_literals[i].rule);
+    ac_finish(m);
+}
+
+static inline unsigned ac_scan(const struct nh_matcher *m, const char *p) {
+    unsigned s = 0, out = 0;
+    for (const unsigned char *c = (const unsigned char*)p; *c; c++) {
+        s = m->delta[s][m->cls[*c]];
+        out |= m->out[s];
+    }
+    for (int i = 0; i < m->nspill; i++)
+        if (strstr(p, m->spill[i])) out |= m->spill_out[i];
+    return out;
+}
+
+// sysfs PCI attributes whose read or mmap reaches the device: config space,
+// the BARs (resource<N>, resource<N>_wc) and the option ROM. The plain
+// "resource" table is kernel data and stays readable.
+static int pci_attr_touches_device(const char *leaf) {
+    if (!strcmp(leaf, "config") || !strcmp(leaf, "rom")) return 1;
+    if (strncmp(leaf, "resource", 8) || leaf[8] < '0' || leaf[8] > '9') return 0;
+    const char *r = leaf + 9;
+    while (*r >= '0' && *r <= '9') r++;
+    return !*r || !strcmp(r, "_wc");
+}
+
+// "[<domain>:]<bus>/<dev>.<fn>" below /proc/bus/pci/
+static int proc_pci_parse(const char *q, uint32_t *bdf) {
+    unsigned v[2] = {0, 0}, nv = 0, digits = 0;
+    int h;
+    for (;; q++) {
+        if ((h = nh_hexval(*q)) >= 0 && digits < 4) { v[nv] = v[nv] << 4 | (unsigned)h; digits++; continue; }
+        if (*q == ':' && nv == 0 && digits) { nv = 1; digits = 0; continue; }
+        break;
+    }
+    if (*q != '/' || !digits || v[nv] > 0xff) return 0;
+    int d1 = nh_hexval(q[1]), d2 = nh_hexval(q[2]);
+    if (d1 < 0 || d2 < 0 || q[3] != '.' || q[4] < '0' || q[4] > '7' || q[5]) return 0;
+    unsigned dev = (unsigned)(d1 << 4 | d2);
+    if (dev > 0x1f) return 0;
+    *bdf = NH_BDF(nv ? v[0] : 0, v[nv], dev, (unsigned)(q[4] - '0'));
+    return 1;
+}
+
+// ".../<BDF>/<attr>" for an attribute that reaches the device, through ANY
+// sysfs path (bus or devices)
+static int sysfs_pci_attr(const char *p, uint32_t *bdf) {
+    const char *slash = strrchr(p, '/');
+    if (!slash || slash - p <= NH_BDF_STRLEN || !pci_attr_touches_device(slash + 1)) return 0;
+    const char *b = slash - NH_BDF_STRLEN;
+    return b[-1] == '/' && nh_bdf_parse(b, bdf) == NH_BDF_STRLEN;
+}
+
+int nh_match_path(const struct nh_matcher *m, const struct nh_topo *t, const char *p, int root) {
+    uint32_t bdf;
+    if (root == NH_ROOT_DEV) {
+        // Device nodes
+        if (!strncmp(p, "/dev/nvidia", 11)) {
+            if (m->rules & NH_RULE_DEV_NVIDIA) return 1;
+        } else if (!strncmp(p, "/dev/dri/", 9) && (m->rules & NH_RULE_DRI)) {
+            if (nh_topo_has_node(t, p + 9)) return 1;
+            // /dev/dri/by-path/pci-<BDF>-{card,render}
+            if (!strncmp(p + 9, "by-path/pci-", 12) && nh_bdf_parse(p + 21, &bdf) &&
+                nh_topo_has_bdf(t, bdf)) return 1;
+        } else if (!strncmp(p, "/dev/char/", 10) && (m->rules & NH_RULE_DEV_CHAR)) {
+            // udev's /dev/char/<major>:<minor> links
+            char *e;
+            unsigned long maj = strtoul(p + 10, &e, 10), min;
+            if (e != p + 10 && *e == ':' && e[1] >= '0' && e[1] <= '9') {
+                min = strtoul(e + 1, &e, 10);
+                if (!*e && maj < 4096 && min < (1ul << 20) && nh_topo_has_dev(t, (unsigned)maj, (unsigned)min))
+                    return 1;
+            }
+        }
+    } else if (root == NH_ROOT_SYS && t->bdfs_n && (m->rules & NH_RULE_SYSFS)) {
+        if (sysfs_pci_attr(p, &bdf) && nh_topo_has_bdf(t, bdf)) return 1;
+    } else if (root == NH_ROOT_PROC) {
+        // libpci's proc method: /proc/bus/pci/<bus>/<dev>.<fn> is config space
+        // (the devices list is filtered by the library instead)
+        return t->bdfs_n && (m->rules & NH_RULE_PROC_PCI) && proc_pci_parse(p + 14, &bdf) &&
+               nh_topo_has_bdf(t, bdf);
+    }
+
+    return ac_scan(m, p) ? 1 : 0;
+}
+
+unsigned nh_path_rules(const struct nh_matcher *m, const char *p, int root) {
+    uint32_t bdf;
+    unsigned r = 0;
+    if (root == NH_ROOT_DEV) {
+        if (!strncmp(p, "/dev/nvidia", 11)) r = NH_RULE_DEV_NVIDIA;
+        else if (!strncmp(p, "/dev/dri/", 9)) r = NH_RULE_DRI;
+        else if (!strncmp(p, "/dev/char/", 10)) r = NH_RULE_DEV_CHAR;
+    } else if (root == NH_ROOT_SYS) {
+        if (sysfs_pci_attr(p, &bdf)) r = NH_RULE_SYSFS;
+    } else if (root == NH_ROOT_PROC) {
+        return NH_RULE_PROC_PCI;
+    }
+    return r | ac_scan(m, p);
+}
+
+// --------- launcher snapshot ---------
+
+static int append_item(char **p, char *end, int first, const char *item) {
+    int w = snprintf(*p, (size_t)(end - *p), "%s%s", first ? "" : ",", item);
+    if (w < 0 || w >= end - *p) return -1;
+    *p += w;
+    return 0;
+}
+
+int nh_snapshot_encode(char *out, size_t out_sz, uint64_t token, int active, unsigned rules,
+                       const struct nh_topo *t) {
+    char *p = out, *end = out + out_sz, item[32];
+    int w = snprintf(p, out_sz, "v1;t=%016" PRIx64 ";a=%d;r=%x;n=", token, active ? 1 : 0, rules & NH_RULE_ALL);
+    if (w < 0 || (size_t)w >= out_sz) return -1;
+    p += w;
+    int first = 1;
+    for (int k = 0; k < NH_NODE_TYPES; k++)
+    for (int bit = 0; bit < 64; bit++) {
+        if (!((t->nodes[k] >> bit) & 1)) continue;
+        nh_node_format(item, sizeof(item), k, bit);
+        if (append_item(&p, end, first, item) != 0) return -1;
+        first = 0;
+    }
+    if (append_item(&p, end, 1, ";b=") != 0) return -1;
+    for (int i = 0; i < t->bdfs_n; i++) {
+        nh_bdf_format(item, sizeof(item), t->bdfs[i]);
+        if (append_item(&p, end, i == 0, item) != 0) return -1;
+    }
+    return 0;
+}
+
+// Parse one comma-separated list up to the next ';' (or end of string).
+static const char *parse_list(const char *s, struct nh_topo *t, int nodes) {
+    while (*s && *s != ';') {
+        const char *e = s;
+        while (*e && *e != ',' && *e != ';') e++;
+        size_t len = (size_t)(e - s);
+        if (len && len < 32) {
+            char item[32];
+            memcpy(item, s, len);
+            item[len] = 0;
+            if (nodes) nh_topo_add_node(t, item); else nh_topo_add_bdf(t, item);
+        }
+        s = (*e == ',') ? e + 1 : e;
+    }
+    return s;
+}
+
+int nh_snapshot_decode(const char *s, uint64_t *token, int *active, unsigned *rules, struct nh_topo *t) {
+    if (!s || strncmp(s, "v1;", 3) != 0) return -1;
+    s += 3;
+    *rules = NH_RULE_ALL;
+    int have_t = 0, have_a = 0;
+    while (*s) {
+        if (s[1] != '=') return -1;
+        char key = s[0];
+        s += 2;
+        if (key == 't') {
+            char *e;
+            *token = strtoull(s, &e, 16);
+            if (e == s) return -1;
+            s = e;
+            have_t = 1;
+        } else if (key == 'a') {
+            if (*s != '0' && *s != '1') return -1;
+            *active = (*s++ == '1');
+            have_a = 1;
+        } else if (key == 'r') {
+            char *e;
+            unsigned long r = strtoul(s, &e, 16);
+            if (e == s) return -1;
+            *rules = (unsigned)r & NH_RULE_ALL;
+            s = e;
+        } else if (key == 'n' || key == 'b') {
+            s = parse_list(s, t, key == 'n');
+        } else {
+            while (*s && *s != ';') s++;  // unknown field from a newer launcher
+        }
+        if (*s == ';') s++;
+        else if (*s) return -1;
+    }
+    return (have_t && have_a) ? 0 : -1;
+}
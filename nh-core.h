@@ -0,0 +1,394 @@
+// Shared between libnvidia-hide.so and the nvidia-hide launcher:
+// policy evaluation, DRM/BDF discovery and the formats used to hand
+// their results from one process to the next.
+#ifndef NH_CORE_H
+#define NH_CORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// keep core symbols out of the preload library's dynamic symbol table
+#define NH_HIDDEN __attribute__((visibility("hidden")))
+
+// --------- small helpers ---------
+NH_HIDDEN void nh_trim(char *s);
+NH_HIDDEN const char *nh_base_name(const char *p);
+NH_HIDDEN int nh_read_file_raw(const char *path, char *buf, size_t bufsz);
+NH_HIDDEN int nh_raw_stat(const char *path, struct stat *st);
+NH_HIDDEN uint64_t nh_hash64(uint64_t h, const void *data, size_t len);
+#define NH_HASH_SEED 0xcbf29ce484222325ull
+
+// linux_dirent64 for getdents64
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t  d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char d_name[];
+};
+
+// --------- rule groups ---------
+// Every deny rule belongs to one group. A learned per-app profile enables
+// only the groups that app was seen to need; everything else runs all.
+enum {
+    NH_RULE_DEV_NVIDIA = 1u << 0,   // /dev/nvidia*
+    NH_RULE_DRI        = 1u << 1,   // /dev/dri nodes, by-path links, udev aliases
+    NH_RULE_DEV_CHAR   = 1u << 2,   // /dev/char/<major>:<minor>
+    NH_RULE_SYSFS      = 1u << 3,   // sysfs config/resource/rom of a BDF
+    NH_RULE_PROC_PCI   = 1u << 4,   // /proc/bus/pci entries and the filtered devices list
+    NH_RULE_GBM        = 1u << 5,   // the deny literals, one group each
+    NH_RULE_GLX        = 1u << 6,
+    NH_RULE_VK_LAYER   = 1u << 7,
+    NH_RULE_VK_ICD     = 1u << 8,
+    NH_RULE_LIBNVIDIA  = 1u << 9,
+    NH_RULE_DLOPEN     = 1u << 10,  // dlopen of NVIDIA sonames
+    NH_RULE_LS_DEV     = 1u << 11,  // listing filters, in DIR_DEV..DIR_ICD order
+    NH_RULE_LS_DRI     = 1u << 12,
+    NH_RULE_LS_BYPATH  = 1u << 13,
+    NH_RULE_LS_ICD     = 1u << 14,
+    NH_RULE_COUNT      = 15,
+    NH_RULE_ALL        = (1u << NH_RULE_COUNT) - 1,
+};
+
+// Space-separated group names ("dev-nvidia dri ..."); "all" for NH_RULE_ALL.
+// Unknown names enable everything, so an older library never hides less.
+NH_HIDDEN unsigned nh_rules_parse(const char *s);
+NH_HIDDEN void nh_rules_format(char *out, size_t out_sz, unsigned rules);
+
+// --------- policy (allow/deny) ---------
+// If allowlist is non-empty, the library is active only when the exe matches.
+// If denylist matches, the library is disabled for that process.
+struct nh_policy {
+    int active;
+    int has_allow;
+    int allow_match;
+    int deny_match;
+    int compiled;       // list files were answered from policy.bin
+    int profile;        // rules came from a learned profile
+    unsigned rules;     // NH_RULE_* to enforce when active
+};
+
+NH_HIDDEN void nh_config_path(char *out, size_t out_sz, const char *leaf);
+// $XDG_RUNTIME_DIR/nvidia-hide[/leaf]; -1 without a usable XDG_RUNTIME_DIR
+NH_HIDDEN int nh_runtime_path(char *out, size_t out_sz, const char *leaf);
+NH_HIDDEN void nh_policy_eval(const char *exe_full, struct nh_policy *out);
+
+// Per-app profiles written by nvidia-hide learn, one per exe path:
+// $XDG_CONFIG_HOME/nvidia-hide/profiles/<basename>.<path hash> (else a
+// hand-written profiles/<basename>) holds an "exe <pattern>" line (matched
+// like a list entry) and a "rules <groups>" line. nh_policy_eval takes the
+// rules from it; LIBNVIDIAHIDE_PROFILES=0 ignores every profile. Returns 0
+// and the rules if exe has a matching profile.
+NH_HIDDEN void nh_profile_path(char *out, size_t out_sz, const char *exe_full);
+NH_HIDDEN int nh_profile_load(const char *exe_full, unsigned *rules);
+
+// Compile the allowlist/denylist files into $XDG_CONFIG_HOME/nvidia-hide/policy.bin
+// (or out_path). nh_policy_eval uses the blob while the sources are unchanged.
+// Returns 0 on success; counts are reported through the optional out params.
+NH_HIDDEN int nh_policy_compile(const char *out_path, int *n_exact, int *n_globs);
+
+// Identifies every input of nh_policy_eval for the given exe: its inode and
+// its path (the exe_full nh_policy_eval gets, not /proc/self/exe), the env
+// lists and the list files' mtimes. Returns 0 if exe can't be stat'ed.
+NH_HIDDEN uint64_t nh_policy_token(const char *exe);
+
+// --------- detected NVIDIA DRM nodes / PCI BDFs ---------
+// Parsed into integers at discovery time: DRM nodes are bits of a per-type
+// minor bitmap (card0..card63, renderD128..renderD191), BDFs are packed
+// domain:bus:dev.fn words. The whole set fits in one cache line.
+#define NH_MAX_BDFS 8
+#define NH_RENDER_MINOR_BASE 128
+
+enum { NH_NODE_CARD = 0, NH_NODE_RENDER, NH_NODE_TYPES };
+
+struct nh_topo {
+    uint64_t nodes[NH_NODE_TYPES];  // bit i: card<i> / renderD<128+i>
+    int32_t  bdfs_n;
+    uint32_t bdfs[NH_MAX_BDFS];     // NH_BDF(domain, bus, dev, fn)
+};
+
+#define NH_BDF(dom, bus, dev, fn) \
+    ((uint32_t)(dom) << 16 | (uint32_t)(bus) << 8 | (uint32_t)(dev) << 3 | (uint32_t)(fn))
+#define NH_BDF_STRLEN 12            // "0000:01:00.0"
+
+// "card1" / "renderD129" -> type and bitmap index; -1 for anything else
+// (including connectors like "card1-HDMI-A-1").
+static inline int nh_node_parse(const char *n, int *type, int *bit) {
+    const char *d;
+    int base;
+    if (!strncmp(n, "card", 4)) { *type = NH_NODE_CARD; d = n + 4; base = 0; }
+    else if (!strncmp(n, "renderD", 7)) { *type = NH_NODE_RENDER; d = n + 7; base = NH_RENDER_MINOR_BASE; }
+    else return -1;
+    if (!*d) return -1;
+    int v = 0;
+    for (; *d; d++) {
+        if (*d < '0' || *d > '9' || v > 1000) return -1;
+        v = v * 10 + (*d - '0');
+    }
+    v -= base;
+    if (v < 0 || v >= 64) return -1;
+    *bit = v;
+    return 0;
+}
+
+static inline int nh_hexval(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// "0000:01:00.0" or "01:00.0" at s. Returns the number of chars consumed,
+// 0 if s does not start with a BDF.
+static inline size_t nh_bdf_parse(const char *s, uint32_t *bdf) {
+    unsigned f[3] = {0, 0, 0};
+    int nf = 0;
+    const char *p = s;
+    for (;;) {
+        int digits = 0, h;
+        while ((h = nh_hexval(*p)) >= 0 && digits < 5) { f[nf] = f[nf] << 4 | (unsigned)h; p++; digits++; }
+        if (!digits) return 0;
+        nf++;
+        if (*p == ':' && nf < 3) { p++; continue; }
+        break;
+    }
+    if (*p != '.' || p[1] < '0' || p[1] > '7' || nf < 2) return 0;
+    unsigned dom = nf == 3 ? f[0] : 0, bus = f[nf - 2], dev = f[nf - 1];
+    if (dom > 0xffff || bus > 0xff || dev > 0x1f) return 0;
+    *bdf = NH_BDF(dom, bus, dev, (unsigned)(p[1] - '0'));
+    return (size_t)(p + 2 - s);
+}
+
+NH_HIDDEN void nh_node_format(char *out, size_t out_sz, int type, int bit);
+NH_HIDDEN void nh_bdf_format(char *out, size_t out_sz, uint32_t bdf);
+
+NH_HIDDEN void nh_topo_add_node(struct nh_topo *t, const char *name);
+NH_HIDDEN void nh_topo_add_bdf(struct nh_topo *t, const char *bdf);
+NH_HIDDEN int  nh_topo_nodes_n(const struct nh_topo *t);
+
+static inline int nh_topo_has_node(const struct nh_topo *t, const char *name) {
+    int type, bit;
+    return name && nh_node_parse(name, &type, &bit) == 0 && ((t->nodes[type] >> bit) & 1);
+}
+
+static inline int nh_topo_has_bdf(const struct nh_topo *t, uint32_t bdf) {
+    for (int i = 0; i < t->bdfs_n; i++) if (t->bdfs[i] == bdf) return 1;
+    return 0;
+}
+
+// Device numbers: DRM minors map 1:1 onto the node bitmaps, and the NVIDIA
+// driver's fixed major (nvidia0..N, nvidiactl, nvidia-modeset) is denied
+// outright. nvidia-uvm and nvidia-caps get dynamic majors and are only
+// caught by name.
+#define NH_DRM_MAJOR    226
+#define NH_NVIDIA_MAJOR 195
+
+static inline int nh_topo_has_dev(const struct nh_topo *t, unsigned maj, unsigned min) {
+    if (maj == NH_NVIDIA_MAJOR) return 1;
+    if (maj != NH_DRM_MAJOR) return 0;
+    if (min < 64) return (int)((t->nodes[NH_NODE_CARD] >> min) & 1);
+    if (min >= NH_RENDER_MINOR_BASE && min < NH_RENDER_MINOR_BASE + 64)
+        return (int)((t->nodes[NH_NODE_RENDER] >> (min - NH_RENDER_MINOR_BASE)) & 1);
+    return 0;
+}
+
+// Scan /sys/class/drm, going through the runtime cache when allowed.
+// Returns 1 if the result came from the cache, 0 if sysfs was scanned.
+NH_HIDDEN int nh_discover(struct nh_topo *t);
+
+// Always scans sysfs (and refreshes the cache): used by the daemon on uevents.
+NH_HIDDEN void nh_discover_scan(struct nh_topo *t);
+
+// --------- daemon segment ---------
+// nvidia-hide daemon keeps the live topology in a shared file mapping and
+// updates it under a seqlock on hotplug; preloaded processes map it read-only
+// and compare seq on every candidate check.
+#define NH_SHM_MAGIC   0x4d53484eu   // "NHSM"
+#define NH_SHM_VERSION 3
+
+struct nh_shm {
+    uint32_t magic, version;
+    uint32_t seq;           // odd while the daemon is writing topo
+    int32_t  daemon_pid;    // 0 after a clean daemon exit
+    struct nh_topo topo;
+};
+
+// Daemon side: create or reuse the segment (fd kept for locking).
+NH_HIDDEN struct nh_shm *nh_shm_open_rw(int *fd_out);
+// Liveness is an OFD write lock on the file, held for the daemon's lifetime
+// and dropped by the kernel when it dies. Unlike a pid it means the same in
+// every PID namespace. Returns -1 if another daemon holds it.
+NH_HIDDEN int nh_shm_lock(int fd);
+NH_HIDDEN void nh_shm_publish(struct nh_shm *s, const struct nh_topo *t);
+
+// Library side: NULL unless a live daemon owns the segment.
+NH_HIDDEN const struct nh_shm *nh_shm_map(void);
+// Consistent copy of the topology; returns -1 if no stable read succeeded.
+NH_HIDDEN int nh_shm_read(const struct nh_shm *s, struct nh_topo *t, uint32_t *seq_out);
+
+// --------- event log ---------
+// LIBNVIDIAHIDE_DEBUG=1: each process appends fixed-size binary events to
+// $XDG_RUNTIME_DIR/nvidia-hide/log/<pid>.log; nvidia-hide log merges and
+// decodes them. A file is one header followed by events. Timestamps are
+// CLOCK_MONOTONIC, so files of one boot merge by ts_ns directly.
+#define NH_LOG_MAGIC     0x474c484eu     // "NHLG"
+#define NH_LOG_VERSION   1
+#define NH_LOG_TEXT      32
+#define NH_LOG_MAX_HOOKS 32
+
+enum { NH_LOG_HOOK = 1, NH_LOG_MSG, NH_LOG_DROP };
+
+struct nh_log_header {
+    uint32_t magic, version;
+    int32_t  pid, ppid;
+    uint32_t event_size;
+    uint32_t nhooks;
+    char     hooks[NH_LOG_MAX_HOOKS][16];  // hook id -> name, as of this build
+    char     exe[256];
+};
+
+// NH_LOG_HOOK: hook = hook id, verdict = 1 if denied, hash/text = path or
+//              entry name (text keeps head and tail of long paths).
+// NH_LOG_MSG:  one dbg() line split into NH_LOG_TEXT-byte chunks; hash = message
+//              id (per thread), hook = chunk index, verdict = 1 on the last chunk.
+// NH_LOG_DROP: hash = events lost to a full ring since the previous one.
+// text is NUL-padded and not terminated when full.
+struct nh_log_event {
+    uint64_t ts_ns;
+    uint64_t hash;
+    uint32_t tid;
+    uint16_t kind;
+    uint8_t  hook;
+    uint8_t  verdict;
+    char     text[NH_LOG_TEXT];
+};
+
+// --------- path recording ---------
+// LIBNVIDIAHIDE_RECORD=1: every path and entry name the hooks decide on goes
+// to $XDG_RUNTIME_DIR/nvidia-hide/record/<pid>.rec, for bench/replay. A file
+// is one header followed by records, each a struct nh_rec and len bytes of
+// path (not terminated). The topology is kept so a replay decides against
+// the same devices the recording process saw.
+#define NH_REC_MAGIC   0x5252484eu       // "NHRR"
+#define NH_REC_VERSION 1
+
+struct nh_rec_header {
+    uint32_t magic, version;
+    int32_t  pid, ppid;
+    uint32_t nhooks;
+    uint32_t reserved;
+    char     hooks[NH_LOG_MAX_HOOKS][16];  // hook id -> name, as of this build
+    char     snapshot[1024];               // nh_snapshot_encode of the topology
+    char     exe[256];
+};
+
+// dircls: directory class of an entry name (readdir/getdents/scandir), 0 for
+// paths. Recording classifies every listed directory.
+struct nh_rec {
+    uint8_t  hook;
+    uint8_t  verdict;
+    uint8_t  dircls;
+    uint8_t  relative;      // resolved against a dirfd or the cwd
+    uint16_t len;
+};
+
+// --------- path matcher ---------
+// The deny literals compiled into one Aho-Corasick DFA over a compressed
+// byte alphabet; device nodes, by-path and /dev/char links, sysfs
+// config/resource/rom files and /proc/bus/pci entries are parsed and checked
+// against the topology instead. Used by the preload
+// library and by the launcher's seccomp supervisor.
+#define NH_AC_MAX_STATES  512
+#define NH_AC_MAX_CLASSES 64
+#define NH_AC_MAX_SPILL   8     // literals that did not fit, matched with strstr
+
+struct nh_matcher {
+    unsigned char cls[256];                              // byte -> class (0 = not in any pattern)
+    int nclasses;
+    int nstates;
+    uint16_t delta[NH_AC_MAX_STATES][NH_AC_MAX_CLASSES]; // full DFA after build
+    uint16_t fail[NH_AC_MAX_STATES];
+    uint16_t out[NH_AC_MAX_STATES];                      // NH_RULE_* of the literals ending here
+    unsigned rules;
+    int nspill;
+    const char *spill[NH_AC_MAX_SPILL];
+    uint16_t spill_out[NH_AC_MAX_SPILL];
+};
+
+enum { NH_ROOT_NONE = 0, NH_ROOT_DEV, NH_ROOT_SYS, NH_ROOT_USR, NH_ROOT_LIB, NH_ROOT_PROC };
+
+// Classifies a path by its first component, and only returns a root for the
+// prefixes any deny rule can live under (/dev/nvidia*, /dev/dri, /dev/char, /sys,
+// /proc/bus/pci, /usr/lib*, /usr/share/vulkan, /lib*). Needs no init state, so hooks use it
+// to pass everything else through before any discovery ran.
+// Short-circuiting keeps every read in bounds.
+static inline int nh_path_root(const char *p) {
+    if (p[0] != '/') return NH_ROOT_NONE;
+    switch (p[1]) {
+    case 'd':
+        if (p[2] != 'e' || p[3] != 'v' || p[4] != '/') break;
+        if (!strncmp(p + 5, "nvidia", 6) || !strncmp(p + 5, "dri/", 4) || !strncmp(p + 5, "char/", 5))
+            return NH_ROOT_DEV;
+        break;
+    case 's':
+        if (p[2] == 'y' && p[3] == 's' && p[4] == '/') return NH_ROOT_SYS;
+        break;
+    case 'p':
+        if (!strncmp(p + 2, "roc/bus/pci/", 12)) return NH_ROOT_PROC;
+        break;
+    case 'u':
+        if (p[2] != 's' || p[3] != 'r' || p[4] != '/') break;
+        if (!strncmp(p + 5, "lib", 3) || !strncmp(p + 5, "share/vulkan/", 13)) return NH_ROOT_USR;
+        break;
+    // /lib, /lib64, /lib32: merged-/usr aliases that loaders resolve through
+    case 'l':
+        if (p[2] == 'i' && p[3] == 'b') return NH_ROOT_LIB;
+        break;
+    }
+    return NH_ROOT_NONE;
+}
+
+NH_HIDDEN void nh_matcher_build(struct nh_matcher *m, unsigned rules);
+
+// Verdict for a path whose nh_path_root is root (not NH_ROOT_NONE): 1 = deny.
+NH_HIDDEN int nh_match_path(const struct nh_matcher *m, const struct nh_topo *t,
+                            const char *p, int root);
+
+// The groups whose rules look at a rooted path, whatever the topology: what
+// nvidia-hide learn keeps. m must be built with NH_RULE_ALL.
+NH_HIDDEN unsigned nh_path_rules(const struct nh_matcher *m, const char *p, int root);
+
+// --------- library names ---------
+// A soname or library path the loader must not find: any file name naming
+// NVIDIA (libGLX_nvidia, libEGL_nvidia, libnvidia-*, nvidia-drm_gbm.so),
+// except our own libnvidia-hide.so* and libnvidia-hide-audit.so*. Only the
+// file name counts, so a checkout in ~/nvidia-hide/ neither exempts nor
+// denies what it holds. Shared by the dlopen hook and the rtld-audit module.
+static inline int nh_lib_is_nvidia(const char *name) {
+    const char *base = strrchr(name, '/');
+    base = base ? base + 1 : name;
+    if (!strstr(base, "nvidia")) return 0;
+    if (strncmp(base, "libnvidia-hide", 14)) return 1;
+    return !(base[14] == '.' || !strncmp(base + 14, "-audit.", 7));
+}
+
+// --------- launcher snapshot ---------
+// nvidia-hide run evaluates the policy and discovery once and exports them
+// in LIBNVIDIAHIDE_SNAPSHOT as "v1;t=<token>;a=<0|1>;r=<rules>;n=<nodes>;b=<bdfs>".
+// The topology is valid for every descendant; the policy decision (active
+// and the rule groups) only for processes whose nh_policy_token matches t.
+// Snapshots without r= enforce NH_RULE_ALL.
+#define NH_SNAPSHOT_ENV "LIBNVIDIAHIDE_SNAPSHOT"
+
+// The GPU loader variables nvidia-hide run set for the tree (each was unset
+// before), ':'-separated; a process the policy leaves inactive unsets them.
+#define NH_VENDOR_ENV "LIBNVIDIAHIDE_VENDOR_ENV"
+
+NH_HIDDEN int nh_snapshot_encode(char *out, size_t out_sz, uint64_t token, int active,
+                                 unsigned rules, const struct nh_topo *t);
+NH_HIDDEN int nh_snapshot_decode(const char *s, uint64_t *token, int *active,
+                                 unsigned *rules, struct nh_topo *t);
+
+#endif
@@ -1,11 +1,31 @@
 #define _GNU_SOURCE
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/netlink.h>
+#include <linux/seccomp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include "nh-core.h"
 
 static int file_exists(const char *p) {
     struct stat st;
@@ -86,45 +106,1726 @@ static int resolve_so_path(char *out, size_t out_sz, const char *argv0) {
     return -1;
 }
 
+// execvp-style lookup, canonicalized so it compares equal to the child's /proc/self/exe
+static int resolve_exe(char *out, size_t out_sz, const char *cmd) {
+    if (!cmd || !*cmd || out_sz < PATH_MAX) return -1;
+    if (strchr(cmd, '/')) return realpath(cmd, out) ? 0 : -1;
+
+    const char *path = getenv("PATH");
+    if (!path || !*path) path = "/usr/local/bin:/usr/bin:/bin";
+    for (const char *p = path; ; ) {
+        const char *q = strchr(p, ':');
+        size_t len = q ? (size_t)(q - p) : strlen(p);
+        char cand[PATH_MAX];
+        int n = len ? snprintf(cand, sizeof(cand), "%.*s/%s", (int)len, p, cmd)
+                    : snprintf(cand, sizeof(cand), "./%s", cmd);
+        if (n > 0 && (size_t)n < sizeof(cand) && access(cand, X_OK) == 0 && file_exists(cand))
+            return realpath(cand, out) ? 0 : -1;
+        if (!q) break;
+        p = q + 1;
+    }
+    return -1;
+}
+
+// Evaluate policy + discovery once here so descendants can skip both.
+// The topology is also returned for the supervisor.
+// Returns the command's policy decision (1 if it could not be resolved,
+// matching the library's fail-open).
+static int export_snapshot(const char *cmd, struct nh_topo *topo) {
+    memset(topo, 0, sizeof(*topo));
+    nh_discover(topo);
+
+    char exe[PATH_MAX];
+    if (resolve_exe(exe, sizeof(exe), cmd) != 0) return 1;
+
+    struct nh_policy pol;
+    nh_policy_eval(exe, &pol);
+
+    char snap[4096];
+    if (nh_snapshot_encode(snap, sizeof(snap), nh_policy_token(exe), pol.active, pol.rules, topo) == 0)
+        setenv(NH_SNAPSHOT_ENV, snap, 1);
+    return pol.active;
+}
+
+// --------- Mesa-only vendor lists ---------
+// The Vulkan loader and libglvnd enumerate every ICD / EGL vendor JSON and
+// would only hit the preload's ENOENT for NVIDIA's. Pointing them at the
+// non-NVIDIA files up front means NVIDIA is never even considered. The lists
+// land in $XDG_RUNTIME_DIR/nvidia-hide/vendors.cache keyed by every scanned
+// directory and the inode, size and ctime of each JSON in it, so a file
+// rewritten in place is seen too. Variables the user set are kept; the ones
+// we set are named in NH_VENDOR_ENV for inactive descendants to drop.
+
+#define VENDOR_LIST_MAX 4096
+#define VENDOR_FILES_MAX 256
+#define VENDOR_CACHE_VERSION 2
+
+struct vendor_lists {
+    char vk[VENDOR_LIST_MAX];       // ':'-separated ICD JSONs without NVIDIA
+    char egl[VENDOR_LIST_MAX];      // ':'-separated EGL vendor JSONs without NVIDIA
+    int  vk_hidden, egl_hidden;     // NVIDIA files left out
+    int  egl_mesa;                  // a Mesa EGL vendor is present
+    int  vk_trunc, egl_trunc;       // the list did not fit: never exported
+};
+
+struct vendor_dirs {
+    int n;
+    char dir[16][PATH_MAX];
+};
+
+static void vendor_dirs_add(struct vendor_dirs *d, const char *base, const char *suffix) {
+    if (!base || base[0] != '/' || d->n >= 16) return;
+    if (snprintf(d->dir[d->n], sizeof(d->dir[0]), "%s/%s", base, suffix) < (int)sizeof(d->dir[0])) d->n++;
+}
+
+static void vendor_dirs_add_list(struct vendor_dirs *d, const char *list, const char *def, const char *suffix) {
+    if (!list || !*list) list = def;
+    char buf[PATH_MAX * 2];
+    snprintf(buf, sizeof(buf), "%s", list);
+    for (char *save = NULL, *tok = strtok_r(buf, ":", &save); tok; tok = strtok_r(NULL, ":", &save))
+        vendor_dirs_add(d, tok, suffix);
+}
+
+static void vendor_home_dir(char *out, size_t out_sz, const char *xdg_env, const char *home_leaf) {
+    const char *x = getenv(xdg_env), *home = getenv("HOME");
+    if (x && x[0] == '/') snprintf(out, out_sz, "%s", x);
+    else if (home && home[0] == '/') snprintf(out, out_sz, "%s/%s", home, home_leaf);
+    else out[0] = 0;
+}
+
+// the Vulkan loader's ICD search order (Linux)
+static void vendor_vk_dirs(struct vendor_dirs *d) {
+    char h[PATH_MAX];
+    memset(d, 0, sizeof(*d));
+    vendor_home_dir(h, sizeof(h), "XDG_CONFIG_HOME", ".config");
+    vendor_dirs_add(d, h, "vulkan/icd.d");
+    vendor_dirs_add_list(d, getenv("XDG_CONFIG_DIRS"), "/etc/xdg", "vulkan/icd.d");
+    vendor_dirs_add(d, "/etc", "vulkan/icd.d");
+    vendor_home_dir(h, sizeof(h), "XDG_DATA_HOME", ".local/share");
+    vendor_dirs_add(d, h, "vulkan/icd.d");
+    vendor_dirs_add_list(d, getenv("XDG_DATA_DIRS"), "/usr/local/share:/usr/share", "vulkan/icd.d");
+}
+
+// libglvnd's default EGL vendor dirs (sysconfdir, then datadir)
+static void vendor_egl_dirs(struct vendor_dirs *d) {
+    memset(d, 0, sizeof(*d));
+    vendor_dirs_add(d, "/etc", "glvnd/egl_vendor.d");
+    vendor_dirs_add_list(d, getenv("XDG_DATA_DIRS"), "/usr/local/share:/usr/share", "glvnd/egl_vendor.d");
+}
+
+static int vendor_is_json(const char *name) {
+    size_t len = strlen(name);
+    return len >= 6 && !strcmp(name + len - 5, ".json");
+}
+
+// stat follows the symlinks alternatives-managed ICDs usually are
+static uint64_t vendor_dirs_key(uint64_t h, const struct vendor_dirs *d) {
+    for (int i = 0; i < d->n; i++) {
+        h = nh_hash64(h, d->dir[i], strlen(d->dir[i]) + 1);
+        DIR *dir = opendir(d->dir[i]);
+        uint64_t files = dir ? 1 : 0;   // summed: readdir order does not matter
+        struct dirent *e;
+        while (dir && (e = readdir(dir)) != NULL) {
+            if (!vendor_is_json(e->d_name)) continue;
+            char path[PATH_MAX];
+            struct stat st;
+            int64_t id[4] = { -1, -1, -1, -1 };
+            if (snprintf(path, sizeof(path), "%s/%s", d->dir[i], e->d_name) < (int)sizeof(path) &&
+                stat(path, &st) == 0) {
+                id[0] = (int64_t)st.st_ino;
+                id[1] = (int64_t)st.st_size;
+                id[2] = (int64_t)st.st_ctim.tv_sec;
+                id[3] = (int64_t)st.st_ctim.tv_nsec;
+            }
+            files += nh_hash64(nh_hash64(NH_HASH_SEED, e->d_name, strlen(e->d_name) + 1), id, sizeof(id));
+        }
+        if (dir) closedir(dir);
+        h = nh_hash64(h, &files, sizeof(files));
+    }
+    return h;
+}
+
+static int vendor_cmp(const void *a, const void *b) {
+    // glvnd tries vendors in file-name order (the numeric prefix is the priority)
+    return strcmp(nh_base_name(*(char *const *)a), nh_base_name(*(char *const *)b));
+}
+
+// Fills out with the non-NVIDIA JSONs of every dir; returns the NVIDIA count.
+// *trunc is set when a file or the list did not fit.
+static int vendor_scan(const struct vendor_dirs *d, char *out, size_t out_sz, int *mesa, int *trunc) {
+    char *paths[VENDOR_FILES_MAX];
+    int n = 0, hidden = 0;
+    for (int i = 0; i < d->n; i++) {
+        DIR *dir = opendir(d->dir[i]);
+        if (!dir) continue;
+        struct dirent *e;
+        while ((e = readdir(dir)) != NULL) {
+            if (!vendor_is_json(e->d_name)) continue;
+            if (n >= VENDOR_FILES_MAX) { *trunc = 1; break; }
+            char path[PATH_MAX], body[8192];
+            if (snprintf(path, sizeof(path), "%s/%s", d->dir[i], e->d_name) >= (int)sizeof(path)) { *trunc = 1; continue; }
+            if (nh_read_file_raw(path, body, sizeof(body)) != 0) continue;
+            if (strstr(e->d_name, "nvidia") || strstr(body, "nvidia")) { hidden++; continue; }
+            if (mesa && strstr(body, "mesa")) *mesa = 1;
+            if (!(paths[n] = strdup(path))) break;
+            n++;
+        }
+        closedir(dir);
+    }
+    qsort(paths, (size_t)n, sizeof(paths[0]), vendor_cmp);
+    size_t w = 0;
+    out[0] = 0;
+    for (int i = 0; i < n; i++) {
+        int k = snprintf(out + w, out_sz - w, "%s%s", w ? ":" : "", paths[i]);
+        if (k > 0 && (size_t)k < out_sz - w) w += (size_t)k;
+        else { out[w] = 0; *trunc = 1; }
+        free(paths[i]);
+    }
+    return hidden;
+}
+
+static int vendor_cache_load(const char *path, uint64_t key, struct vendor_lists *v) {
+    FILE *f = fopen(path, "re");
+    if (!f) return -1;
+    char line[VENDOR_LIST_MAX + 16];
+    int version = 0, ok = 0;
+    unsigned long long k = 0;
+    memset(v, 0, sizeof(*v));
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\n")] = 0;
+        if (sscanf(line, "nvidia-hide-vendors %d %llx", &version, &k) == 2) { ok = version == VENDOR_CACHE_VERSION && k == key; continue; }
+        if (sscanf(line, "hidden %d %d %d", &v->vk_hidden, &v->egl_hidden, &v->egl_mesa) == 3) continue;
+        if (sscanf(line, "trunc %d %d", &v->vk_trunc, &v->egl_trunc) == 2) continue;
+        if (!strncmp(line, "vk ", 3)) snprintf(v->vk, sizeof(v->vk), "%.*s", VENDOR_LIST_MAX - 1, line + 3);
+        else if (!strncmp(line, "egl ", 4)) snprintf(v->egl, sizeof(v->egl), "%.*s", VENDOR_LIST_MAX - 1, line + 4);
+    }
+    fclose(f);
+    return ok ? 0 : -1;
+}
+
+static void vendor_cache_store(const char *path, uint64_t key, const struct vendor_lists *v) {
+    char dir[PATH_MAX], tmp[PATH_MAX];
+    if (nh_runtime_path(dir, sizeof(dir), NULL) != 0) return;
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST) return;
+    if (snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid()) >= (int)sizeof(tmp)) return;
+    FILE *f = fopen(tmp, "we");
+    if (!f) return;
+    fprintf(f, "nvidia-hide-vendors %d %llx\nhidden %d %d %d\ntrunc %d %d\nvk %s\negl %s\n", VENDOR_CACHE_VERSION,
+            (unsigned long long)key, v->vk_hidden, v->egl_hidden, v->egl_mesa, v->vk_trunc, v->egl_trunc,
+            v->vk, v->egl);
+    if (fclose(f) != 0 || rename(tmp, path) != 0) unlink(tmp);
+}
+
+static void export_vendor_lists(void) {
+    const char *env = getenv("LIBNVIDIAHIDE_VENDORS");
+    if (env && !strcmp(env, "0")) return;
+
+    struct vendor_dirs vk, egl;
+    vendor_vk_dirs(&vk);
+    vendor_egl_dirs(&egl);
+    uint64_t key = vendor_dirs_key(vendor_dirs_key(NH_HASH_SEED, &vk), &egl);
+
+    struct vendor_lists v;
+    char cache[PATH_MAX];
+    int have_cache = nh_runtime_path(cache, sizeof(cache), "vendors.cache") == 0;
+    if (!have_cache || vendor_cache_load(cache, key, &v) != 0) {
+        memset(&v, 0, sizeof(v));
+        v.vk_hidden = vendor_scan(&vk, v.vk, sizeof(v.vk), NULL, &v.vk_trunc);
+        v.egl_hidden = vendor_scan(&egl, v.egl, sizeof(v.egl), &v.egl_mesa, &v.egl_trunc);
+        if (have_cache) vendor_cache_store(cache, key, &v);
+    }
+
+    // a cut list would hide real drivers: the preload filtering has to do
+    if (v.vk_hidden && v.vk_trunc)
+        fprintf(stderr, "nvidia-hide: more Vulkan ICDs than fit in VK_DRIVER_FILES; leaving it unset\n");
+    if (v.egl_hidden && v.egl_trunc)
+        fprintf(stderr, "nvidia-hide: more EGL vendors than fit in __EGL_VENDOR_LIBRARY_FILENAMES; "
+                        "leaving it unset\n");
+
+    // only when there is something to leave out and something left to load
+    char set[128] = "";
+    if (v.vk_hidden && !v.vk_trunc && v.vk[0] && !getenv("VK_DRIVER_FILES") && !getenv("VK_ICD_FILENAMES")) {
+        setenv("VK_DRIVER_FILES", v.vk, 1);
+        setenv("VK_ICD_FILENAMES", v.vk, 1);     // loaders older than 1.3.234
+        strcat(set, ":VK_DRIVER_FILES:VK_ICD_FILENAMES");
+    }
+    if (v.egl_hidden && !v.egl_trunc && v.egl[0] && !getenv("__EGL_VENDOR_LIBRARY_FILENAMES")) {
+        setenv("__EGL_VENDOR_LIBRARY_FILENAMES", v.egl, 1);
+        strcat(set, ":__EGL_VENDOR_LIBRARY_FILENAMES");
+    }
+    if (v.egl_hidden && v.egl_mesa && !getenv("__GLX_VENDOR_LIBRARY_NAME")) {
+        setenv("__GLX_VENDOR_LIBRARY_NAME", "mesa", 1);
+        strcat(set, ":__GLX_VENDOR_LIBRARY_NAME");
+    }
+    if (!set[0]) return;
+    // a nested run adds to what the outer one set
+    const char *prev = getenv(NH_VENDOR_ENV);
+    char names[512];
+    snprintf(names, sizeof(names), "%s%s", prev && *prev ? prev : "", prev && *prev ? set : set + 1);
+    setenv(NH_VENDOR_ENV, names, 1);
+}
+
 static void usage(FILE *f) {
     fprintf(f,
         "Usage:\n"
-        "  nvidia-hide run -- <command> [args...]\n"
-        "  nvidia-hide run <command> [args...]\n"
+        "  nvidia-hide run [--supervise] [--dispatch] -- <command> [args...]\n"
+        "  nvidia-hide run [--supervise] [--dispatch] <command> [args...]\n"
+        "  nvidia-hide learn [--reset] [--keep] -- <command> [args...]\n"
+        "  nvidia-hide compile [-o <file>]\n"
+        "  nvidia-hide stats [--dir <dir>] [--pid <root-pid>]\n"
+        "  nvidia-hide log [--dir <dir>] [--pid <root-pid>]\n"
+        "  nvidia-hide bench [--duration <s>] [--interval <ms>] [--no-preload|--compare]\n"
+        "                    [--bdf <bdf>]... -- <command> [args...]\n"
+        "  nvidia-hide daemon\n"
         "\n"
         "Environment:\n"
         "  LIBNVIDIAHIDE_SO=/path/to/libnvidia-hide.so\n"
         "  LIBNVIDIAHIDE_ALLOWLIST=pat1:pat2:...   (optional; evaluated inside the .so)\n"
         "  LIBNVIDIAHIDE_DENYLIST=pat1:pat2:...    (optional; evaluated inside the .so)\n"
+        "  LIBNVIDIAHIDE_VENDORS=0                 (run: keep the Vulkan/EGL/GLX vendor env untouched)\n"
+        "  LIBNVIDIAHIDE_AUDIT=0                   (run: do not set LD_AUDIT=libnvidia-hide-audit.so)\n"
+        "  LIBNVIDIAHIDE_PROFILES=0                (enforce every rule group, ignore learned profiles)\n"
         "\n"
         "Config files (optional; evaluated inside the .so):\n"
         "  $XDG_CONFIG_HOME/nvidia-hide/allowlist (or ~/.config/nvidia-hide/allowlist)\n"
         "  $XDG_CONFIG_HOME/nvidia-hide/denylist  (or ~/.config/nvidia-hide/denylist)\n"
         "\n"
+        "run --supervise:\n"
+        "  Also routes open/openat/openat2 of the whole process tree through a seccomp\n"
+        "  user-notify filter answered by this launcher, which covers static binaries\n"
+        "  and children that drop LD_PRELOAD. Relative paths are resolved against the\n"
+        "  caller's cwd or dirfd through /proc/<pid>. The launcher stays until the last\n"
+        "  supervised process exits. The filter sets no_new_privs for the whole tree,\n"
+        "  so setuid helpers (chrome-sandbox, pkexec, sudo) lose their privileges.\n"
+        "\n"
+        "run --dispatch:\n"
+        "  Sets LIBNVIDIAHIDE_SUD=1: inside each preloaded process, syscalls issued\n"
+        "  outside libc trap into the library (syscall user dispatch, x86_64,\n"
+        "  Linux 5.11+) and get the same verdicts as the hooked libc calls.\n"
+        "\n"
+        "learn:\n"
+        "  Runs the command like run, with every rule and LIBNVIDIAHIDE_RECORD on, and\n"
+        "  writes $XDG_CONFIG_HOME/nvidia-hide/profiles/<exe basename> for each exe of\n"
+        "  the tree: only the rule groups its opens, stats, listings and dlopens fell\n"
+        "  under. The library then enforces just those (LIBNVIDIAHIDE_PROFILES=0\n"
+        "  ignores profiles). Groups add up over runs; --reset replaces them, --keep\n"
+        "  leaves the recordings in place.\n"
+        "\n"
+        "compile:\n"
+        "  Prebuilds the allowlist/denylist into $XDG_CONFIG_HOME/nvidia-hide/policy.bin.\n"
+        "  The .so maps it instead of parsing the lists; it is ignored once a list changes.\n"
+        "\n"
+        "bench:\n"
+        "  Starts the command under the preload and samples runtime PM of every\n"
+        "  discovered NVIDIA BDF (or --bdf) every --interval ms for --duration s after\n"
+        "  exec. Reports resumes and active time; --no-preload measures the bare app,\n"
+        "  --compare runs both back to back.\n"
+        "\n"
+        "daemon:\n"
+        "  Stays in the foreground and keeps $XDG_RUNTIME_DIR/nvidia-hide/daemon.shm\n"
+        "  current: rescans /sys/class/drm on drm/pci uevents (eGPU hotplug, driver\n"
+        "  rebind) and recompiles policy.bin when a list changes. Preloaded processes\n"
+        "  pick topology changes up on their next check, without a restart.\n"
+        "\n"
+        "stats:\n"
+        "  Aggregates the per-process files written with LIBNVIDIAHIDE_STATS=1\n"
+        "  (default dir $XDG_RUNTIME_DIR/nvidia-hide/stats); --pid limits the report\n"
+        "  to that process and its descendants.\n"
+        "\n"
+        "log:\n"
+        "  Merges the binary event logs written with LIBNVIDIAHIDE_DEBUG=1 (default dir\n"
+        "  $XDG_RUNTIME_DIR/nvidia-hide/log) into one timeline of init messages and\n"
+        "  hook decisions; --pid limits it to that process and its descendants.\n"
+        "\n"
         "Notes:\n"
-        "  - This launcher sets LD_PRELOAD only for the launched process (native apps).\n"
+        "  - This launcher sets LD_PRELOAD only for the launched process (native apps),\n"
+        "    and LD_AUDIT when libnvidia-hide-audit.so is installed next to the library.\n"
+        "  - Policy and DRM discovery are evaluated once here and handed to the process\n"
+        "    tree in LIBNVIDIAHIDE_SNAPSHOT.\n"
         "  - Flatpak/Snap sandboxing typically blocks LD_PRELOAD; this tool does not handle sandboxed apps.\n"
     );
 }
 
-static int set_preload(const char *so_path) {
-    const char *prev = getenv("LD_PRELOAD");
+// Appends val to a loader list variable unless it is already there.
+static int env_append(const char *var, const char *val, char sep) {
+    const char *prev = getenv(var);
     if (!prev || !*prev) {
-        return setenv("LD_PRELOAD", so_path, 1);
+        return setenv(var, val, 1);
     }
     // Avoid duplicating
-    if (strstr(prev, so_path)) return 0;
+    if (strstr(prev, val)) return 0;
 
-    // glibc reliably supports space-separated entries.
-    size_t need = strlen(prev) + 1 + strlen(so_path) + 1;
+    size_t need = strlen(prev) + 1 + strlen(val) + 1;
     char *buf = (char*)malloc(need);
     if (!buf) return -1;
-    snprintf(buf, need, "%s %s", prev, so_path);
-    int rc = setenv("LD_PRELOAD", buf, 1);
+    snprintf(buf, need, "%s%c%s", prev, sep, val);
+    int rc = setenv(var, buf, 1);
     free(buf);
     return rc;
 }
 
+static int set_preload(const char *so_path) {
+    // glibc reliably supports space-separated entries.
+    return env_append("LD_PRELOAD", so_path, ' ');
+}
+
+// The rtld-audit module installed next to the preload library, if any.
+// LD_AUDIT entries are colon-separated. LIBNVIDIAHIDE_AUDIT=0 leaves it out.
+static void set_audit(const char *so_path) {
+    const char *env = getenv("LIBNVIDIAHIDE_AUDIT");
+    if (env && !strcmp(env, "0")) return;
+    char dir[PATH_MAX], p[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", so_path);
+    char *slash = strrchr(dir, '/');
+    if (slash) *slash = 0;
+    else snprintf(dir, sizeof(dir), ".");
+    if (build_path(p, sizeof(p), dir, "libnvidia-hide-audit.so") == 0 && file_exists(p))
+        env_append("LD_AUDIT", p, ':');
+}
+
+static int cmd_compile(int argc, char **argv) {
+    const char *out = NULL;
+    for (int i = 2; i < argc; i++) {
+        if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            out = argv[++i];
+        } else {
+            fprintf(stderr, "nvidia-hide: compile: unexpected argument '%s'\n\n", argv[i]);
+            usage(stderr);
+            return 2;
+        }
+    }
+
+    char def_out[PATH_MAX];
+    if (!out) {
+        // make sure the config dir exists so the blob can land next to the lists
+        char dir[PATH_MAX];
+        nh_config_path(dir, sizeof(dir), "");
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+            fprintf(stderr, "nvidia-hide: compile: mkdir(%s) failed: %s\n", dir, strerror(errno));
+            return 1;
+        }
+        nh_config_path(def_out, sizeof(def_out), "policy.bin");
+        out = def_out;
+    }
+
+    int n_exact = 0, n_globs = 0;
+    if (nh_policy_compile(out, &n_exact, &n_globs) != 0) {
+        fprintf(stderr, "nvidia-hide: compile: failed to write %s: %s\n", out, strerror(errno));
+        return 1;
+    }
+    printf("nvidia-hide: wrote %s (%d exact, %d glob patterns)\n", out, n_exact, n_globs);
+    return 0;
+}
+
+// --------- seccomp supervisor (run --supervise) ---------
+// The child installs a filter that turns open/openat/openat2 into user
+// notifications (execve too, to notice image changes) and hands the listener
+// fd back over a socketpair before it execs. Worker threads here answer
+// ENOENT for paths nh_match_path denies and CONTINUE for everything else, so
+// static binaries and raw syscall users get the view preloaded code gets.
+// Relative paths are made absolute through /proc/<pid>/{cwd,fd/N} first.
+// This is a visibility tool, not a sandbox: CONTINUE lets the kernel re-read
+// the path, so a process racing its own memory can get past it.
+// Installing the filter needs PR_SET_NO_NEW_PRIVS, which every descendant
+// inherits: setuid helpers (chrome-sandbox, pkexec, sudo) run without their
+// privileges under --supervise.
+
+#if defined(__x86_64__)
+#define SUP_AUDIT_ARCH AUDIT_ARCH_X86_64
+#elif defined(__aarch64__)
+#define SUP_AUDIT_ARCH AUDIT_ARCH_AARCH64
+#endif
+#ifndef SYS_openat2
+#define SYS_openat2 437
+#endif
+
+#define SUP_MAX_WORKERS 8
+#define SUP_PID_SLOTS   4096    // direct-mapped per-pid policy
+
+static struct {
+    int fd;
+    struct seccomp_notif_sizes sizes;
+    struct nh_topo topo;
+    struct nh_matcher match;
+    uint64_t pids[SUP_PID_SLOTS];           // pid << 32 | (active + 1), 0 in the low bits after execve
+} g_sup;
+
+static pid_t g_sup_child = -1;
+
+#if defined(SUP_AUDIT_ARCH) && defined(SECCOMP_USER_NOTIF_FLAG_CONTINUE)
+
+static int sup_install_filter(void) {
+    #define SUP_NOTIFY(nr) \
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (nr), 0, 1), \
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_USER_NOTIF)
+    struct sock_filter f[] = {
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, arch)),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SUP_AUDIT_ARCH, 1, 0),
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr)),
+#ifdef __X32_SYSCALL_BIT
+        // x32 numbers share AUDIT_ARCH_X86_64; refuse them rather than let them by
+        BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, __X32_SYSCALL_BIT, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ERRNO | ENOSYS),
+#endif
+#ifdef SYS_open
+        SUP_NOTIFY(SYS_open),
+#endif
+        SUP_NOTIFY(SYS_openat),
+        SUP_NOTIFY(SYS_openat2),
+        SUP_NOTIFY(SYS_execve),
+        SUP_NOTIFY(SYS_execveat),
+        BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+    };
+    #undef SUP_NOTIFY
+    struct sock_fprog prog = { (unsigned short)(sizeof(f) / sizeof(f[0])), f };
+
+    if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) != 0) return -1;
+    return (int)syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER,
+                        SECCOMP_FILTER_FLAG_NEW_LISTENER, &prog);
+}
+
+// Copy a NUL-terminated string out of the target, never reading across an
+// unmapped page boundary. Returns 0 with out terminated, -1 otherwise.
+static int sup_read_path(pid_t pid, uint64_t addr, char *out, size_t out_sz) {
+    const size_t pg = (size_t)sysconf(_SC_PAGESIZE);
+    size_t got = 0;
+    while (got < out_sz - 1) {
+        size_t chunk = pg - (size_t)((addr + got) % pg);
+        if (chunk > out_sz - 1 - got) chunk = out_sz - 1 - got;
+        struct iovec l = { out + got, chunk };
+        struct iovec r = { (void*)(uintptr_t)(addr + got), chunk };
+        ssize_t n = process_vm_readv(pid, &l, 1, &r, 1, 0);
+        if (n <= 0) return -1;
+        if (memchr(out + got, 0, (size_t)n)) return 0;
+        got += (size_t)n;
+    }
+    return -1;  // longer than PATH_MAX: the kernel reports ENAMETOOLONG itself
+}
+
+// Make a relative path absolute against the target's dirfd (or cwd for
+// AT_FDCWD), read back through /proc/<pid>. "." components up front are
+// dropped; the caller re-checks the notification id, so a reused pid is not
+// trusted. Returns 0 with path rewritten in place, -1 otherwise.
+static int sup_abs_path(pid_t pid, int dirfd, char *path, size_t path_sz) {
+    char link[64], base[PATH_MAX];
+    if (dirfd == AT_FDCWD) snprintf(link, sizeof(link), "/proc/%d/cwd", (int)pid);
+    else snprintf(link, sizeof(link), "/proc/%d/fd/%d", (int)pid, dirfd);
+    ssize_t n = readlink(link, base, sizeof(base) - 1);
+    if (n <= 0 || base[0] != '/') return -1;    // sockets, pipes, anon inodes
+    if (base[n - 1] == '/') n--;                // "/" itself
+    base[n] = 0;
+
+    const char *rel = path;
+    while (rel[0] == '.' && (rel[1] == '/' || !rel[1])) rel += rel[1] ? 2 : 1;
+    while (*rel == '/') rel++;
+    size_t rn = strlen(rel);
+    if ((size_t)n + 1 + rn + 1 > path_sz) return -1;
+    memmove(path + n + 1, rel, rn + 1);
+    memcpy(path, base, (size_t)n);
+    path[n] = '/';
+    return 0;
+}
+
+// Policy of pid's current image; re-evaluated after each execve notification.
+static int sup_pid_active(pid_t pid) {
+    uint64_t *slot = &g_sup.pids[(uint32_t)pid % SUP_PID_SLOTS];
+    uint64_t v = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    // A recycled pid keeps the previous owner's entry until it execs; every
+    // process in the tree shares the launched app's image in practice.
+    if ((v >> 32) == (uint32_t)pid && (v & 3)) return (int)(v & 3) - 1;
+
+    char link[64], exe[PATH_MAX];
+    snprintf(link, sizeof(link), "/proc/%d/exe", (int)pid);
+    ssize_t n = readlink(link, exe, sizeof(exe) - 1);
+    int active = 1;     // fail open like the library does
+    if (n > 0) {
+        exe[n] = 0;
+        struct nh_policy pol;
+        nh_policy_eval(exe, &pol);
+        active = pol.active;
+    }
+    __atomic_store_n(slot, (uint64_t)(uint32_t)pid << 32 | (uint64_t)(active + 1), __ATOMIC_RELEASE);
+    return active;
+}
+
+static void sup_pid_exec(pid_t pid) {
+    __atomic_store_n(&g_sup.pids[(uint32_t)pid % SUP_PID_SLOTS], (uint64_t)(uint32_t)pid << 32, __ATOMIC_RELEASE);
+}
+
+// 1 = answer ENOENT. Anything we cannot inspect is let through.
+static int sup_decide(const struct seccomp_notif *req) {
+    int nr = req->data.nr;
+    if (nr == SYS_execve || nr == SYS_execveat) {
+        sup_pid_exec((pid_t)req->pid);
+        return 0;
+    }
+#ifdef SYS_open
+    uint64_t addr = nr == SYS_open ? req->data.args[0] : req->data.args[1];
+    int dirfd = nr == SYS_open ? AT_FDCWD : (int)req->data.args[0];
+#else
+    uint64_t addr = req->data.args[1];
+    int dirfd = (int)req->data.args[0];
+#endif
+
+    char path[PATH_MAX];
+    if (sup_read_path((pid_t)req->pid, addr, path, sizeof(path)) != 0) return 0;
+    // static binaries open "renderD129" relative to an fd on /dev/dri too
+    if (path[0] != '/' && sup_abs_path((pid_t)req->pid, dirfd, path, sizeof(path)) != 0) return 0;
+    int root = nh_path_root(path);
+    if (root == NH_ROOT_NONE) return 0;
+
+    // the target may have died (and its pid been reused) while we read
+    uint64_t id = req->id;
+    if (ioctl(g_sup.fd, SECCOMP_IOCTL_NOTIF_ID_VALID, &id) != 0) return 0;
+
+    if (!sup_pid_active((pid_t)req->pid)) return 0;
+    return nh_match_path(&g_sup.match, &g_sup.topo, path, root);
+}
+
+static void *sup_worker(void *arg) {
+    (void)arg;
+    struct seccomp_notif *req = calloc(1, g_sup.sizes.seccomp_notif);
+    struct seccomp_notif_resp *resp = calloc(1, g_sup.sizes.seccomp_notif_resp);
+    if (!req || !resp) return NULL;
+
+    for (;;) {
+        memset(req, 0, g_sup.sizes.seccomp_notif);
+        if (ioctl(g_sup.fd, SECCOMP_IOCTL_NOTIF_RECV, req) != 0) {
+            // ENOENT: the target died before we picked the notification up
+            if (errno == EINTR || errno == ENOENT) continue;
+            break;
+        }
+        memset(resp, 0, g_sup.sizes.seccomp_notif_resp);
+        resp->id = req->id;
+        if (sup_decide(req)) resp->error = -ENOENT;
+        else resp->flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+        // fails with ENOENT when the target is gone; nothing to do then
+        ioctl(g_sup.fd, SECCOMP_IOCTL_NOTIF_SEND, resp);
+    }
+    free(req);
+    free(resp);
+    return NULL;
+}
+
+static int sup_send_fd(int sock, int fd, int err) {
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { &err, sizeof(err) };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1 };
+    memset(cbuf, 0, sizeof(cbuf));
+    if (fd >= 0) {
+        msg.msg_control = cbuf;
+        msg.msg_controllen = sizeof(cbuf);
+        struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(c), &fd, sizeof(int));
+    }
+    return sendmsg(sock, &msg, 0) < 0 ? -1 : 0;
+}
+
+// Returns the received fd, or -1 with errno set to what the child reported.
+static int sup_recv_fd(int sock) {
+    int err = 0;
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = { &err, sizeof(err) };
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1,
+                          .msg_control = cbuf, .msg_controllen = sizeof(cbuf) };
+    ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    if (n <= 0) { errno = n == 0 ? EPIPE : errno; return -1; }
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    if (c && c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+        int fd;
+        memcpy(&fd, CMSG_DATA(c), sizeof(int));
+        return fd;
+    }
+    errno = err ? err : EINVAL;
+    return -1;
+}
+
+static void sup_forward_signal(int sig) {
+    if (g_sup_child > 0) kill(g_sup_child, sig);
+}
+
+static int sup_start_workers(void) {
+    if (syscall(SYS_seccomp, SECCOMP_GET_NOTIF_SIZES, 0, &g_sup.sizes) != 0) return -1;
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 2) n = 2;
+    if (n > SUP_MAX_WORKERS) n = SUP_MAX_WORKERS;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int started = 0;
+    for (long i = 0; i < n; i++) {
+        pthread_t t;
+        if (pthread_create(&t, &attr, sup_worker, NULL) == 0) started++;
+    }
+    pthread_attr_destroy(&attr);
+    return started ? 0 : -1;
+}
+
+static int run_supervised(char **cmd, const struct nh_topo *topo) {
+    g_sup.topo = *topo;
+    // profiles narrow the in-process matcher only; the supervisor enforces everything
+    nh_matcher_build(&g_sup.match, NH_RULE_ALL);
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) != 0) {
+        fprintf(stderr, "nvidia-hide: socketpair failed: %s\n", strerror(errno));
+        return 1;
+    }
+    // orphaned descendants must stay ours: their filtered calls fail with
+    // ENOSYS once the listener is gone
+    prctl(PR_SET_CHILD_SUBREAPER, 1, 0, 0, 0);
+
+    pid_t child = fork();
+    if (child < 0) {
+        fprintf(stderr, "nvidia-hide: fork failed: %s\n", strerror(errno));
+        return 1;
+    }
+    if (child == 0) {
+        close(sv[0]);
+        int fd = sup_install_filter();
+        sup_send_fd(sv[1], fd, fd < 0 ? errno : 0);
+        if (fd >= 0) close(fd);
+        close(sv[1]);
+        execvp(cmd[0], cmd);
+        fprintf(stderr, "nvidia-hide: execvp(%s) failed: %s\n", cmd[0], strerror(errno));
+        _exit(127);
+    }
+
+    close(sv[1]);
+    g_sup_child = child;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sup_forward_signal;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
+    sigaction(SIGQUIT, &sa, NULL);
+
+    g_sup.fd = sup_recv_fd(sv[0]);
+    close(sv[0]);
+    if (g_sup.fd < 0) {
+        fprintf(stderr, "nvidia-hide: supervision unavailable (%s); running with LD_PRELOAD only\n",
+                strerror(errno));
+    } else if (sup_start_workers() != 0) {
+        // the child is already filtered; without workers it would hang
+        fprintf(stderr, "nvidia-hide: could not start the supervisor: %s\n", strerror(errno));
+        kill(child, SIGKILL);
+    }
+
+    int status = 0, rc = 1;
+    for (;;) {
+        pid_t w = waitpid(-1, &status, 0);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            break;  // ECHILD: the whole tree is gone
+        }
+        if (w == child) {
+            rc = WIFEXITED(status) ? WEXITSTATUS(status)
+               : WIFSIGNALED(status) ? 128 + WTERMSIG(status) : 1;
+            g_sup_child = -1;
+        }
+    }
+    return rc;
+}
+
+#else
+
+static int run_supervised(char **cmd, const struct nh_topo *topo) {
+    (void)cmd; (void)topo;
+    fprintf(stderr, "nvidia-hide: --supervise is not supported on this architecture/kernel headers\n");
+    return 1;
+}
+
+#endif
+
+// --------- stats ---------
+// Reads the "<pid>.stats" files the library dumps at exit (format version 1).
+
+#define STAT_BUCKETS 32
+#define MAX_STAT_HOOKS 32
+
+struct hook_stat {
+    char name[32];
+    unsigned long long calls, denied, ns;
+    unsigned long long hist[STAT_BUCKETS];
+};
+
+struct proc_stat {
+    int pid, ppid, active;
+    char exe[PATH_MAX];
+    int nhooks;
+    struct hook_stat hooks[MAX_STAT_HOOKS];
+    unsigned long long vcache_hits, vcache_misses;
+    unsigned long long init_ns, init_waits, init_wait_ns;
+};
+
+static int read_stat_file(const char *path, struct proc_stat *ps) {
+    FILE *f = fopen(path, "re");
+    if (!f) return -1;
+    memset(ps, 0, sizeof(*ps));
+    char line[PATH_MAX + 64];
+    int version = 0;
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\n")] = 0;
+        if (sscanf(line, "nvidia-hide-stats %d", &version) == 1) continue;
+        if (sscanf(line, "pid %d", &ps->pid) == 1) continue;
+        if (sscanf(line, "ppid %d", &ps->ppid) == 1) continue;
+        if (sscanf(line, "active %d", &ps->active) == 1) continue;
+        if (sscanf(line, "vcache %llu %llu", &ps->vcache_hits, &ps->vcache_misses) == 2) continue;
+        if (sscanf(line, "init %llu %llu %llu", &ps->init_ns, &ps->init_waits, &ps->init_wait_ns) == 3) continue;
+        if (!strncmp(line, "exe ", 4)) { snprintf(ps->exe, sizeof(ps->exe), "%.*s", PATH_MAX - 1, line + 4); continue; }
+        if (!strncmp(line, "hook ", 5) && ps->nhooks < MAX_STAT_HOOKS) {
+            struct hook_stat *h = &ps->hooks[ps->nhooks];
+            int off = 0;
+            if (sscanf(line + 5, "%31s %llu %llu %llu%n", h->name, &h->calls, &h->denied, &h->ns, &off) != 4) continue;
+            const char *p = line + 5 + off;
+            for (int b = 0; b < STAT_BUCKETS; b++) {
+                char *e;
+                h->hist[b] = strtoull(p, &e, 10);
+                if (e == p) break;
+                p = e;
+            }
+            ps->nhooks++;
+        }
+    }
+    fclose(f);
+    return version == 1 ? 0 : -1;
+}
+
+// upper bound (ns) of the bucket holding the q-quantile
+static unsigned long long hist_quantile(const unsigned long long *hist, double q) {
+    unsigned long long total = 0, acc = 0;
+    for (int b = 0; b < STAT_BUCKETS; b++) total += hist[b];
+    if (!total) return 0;
+    for (int b = 0; b < STAT_BUCKETS; b++) {
+        acc += hist[b];
+        if ((double)acc >= q * (double)total) return 1ull << b;
+    }
+    return 1ull << (STAT_BUCKETS - 1);
+}
+
+static int in_tree(const struct proc_stat *all, int n, int idx, int root) {
+    // follow ppid links through the processes we have files for
+    for (int hops = 0, pid = all[idx].pid; hops < n + 1; hops++) {
+        if (pid == root) return 1;
+        int parent = -1;
+        for (int i = 0; i < n; i++) if (all[i].pid == pid) { parent = all[i].ppid; break; }
+        if (parent <= 0 || parent == pid) return 0;
+        pid = parent;
+    }
+    return 0;
+}
+
+static int cmd_stats(int argc, char **argv) {
+    char dir[PATH_MAX] = "";
+    int root = 0;
+    for (int i = 2; i < argc; i++) {
+        if (!strcmp(argv[i], "--dir") && i + 1 < argc) {
+            snprintf(dir, sizeof(dir), "%s", argv[++i]);
+        } else if (!strcmp(argv[i], "--pid") && i + 1 < argc) {
+            root = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "nvidia-hide: stats: unexpected argument '%s'\n\n", argv[i]);
+            usage(stderr);
+            return 2;
+        }
+    }
+    if (!dir[0]) {
+        const char *rt = getenv("XDG_RUNTIME_DIR");
+        if (!rt || !*rt) {
+            fprintf(stderr, "nvidia-hide: stats: XDG_RUNTIME_DIR not set; use --dir\n");
+            return 2;
+        }
+        snprintf(dir, sizeof(dir), "%s/nvidia-hide/stats", rt);
+    }
+
+    DIR *d = opendir(dir);
+    if (!d) {
+        fprintf(stderr, "nvidia-hide: stats: %s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+    struct proc_stat *all = NULL;
+    int n = 0;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        size_t len = strlen(e->d_name);
+        if (len < 7 || strcmp(e->d_name + len - 6, ".stats") != 0) continue;
+        char path[PATH_MAX];
+        if (build_path(path, sizeof(path), dir, e->d_name) != 0) continue;
+        struct proc_stat *na = realloc(all, (size_t)(n + 1) * sizeof(*all));
+        if (!na) break;
+        all = na;
+        if (read_stat_file(path, &all[n]) == 0) n++;
+    }
+    closedir(d);
+
+    struct hook_stat tot[MAX_STAT_HOOKS];
+    int ntot = 0;
+    memset(tot, 0, sizeof(tot));
+
+    printf("%-8s %-8s %-6s %10s %8s %10s  %s\n", "PID", "PPID", "ACTIVE", "CALLS", "DENIED", "DECIDE_US", "EXE");
+    int shown = 0;
+    unsigned long long vhits = 0, vmisses = 0, init_ns = 0, waits = 0, wait_ns = 0;
+    for (int i = 0; i < n; i++) {
+        if (root && !in_tree(all, n, i, root)) continue;
+        vhits += all[i].vcache_hits;
+        vmisses += all[i].vcache_misses;
+        init_ns += all[i].init_ns;
+        waits += all[i].init_waits;
+        wait_ns += all[i].init_wait_ns;
+        unsigned long long calls = 0, denied = 0, ns = 0;
+        for (int k = 0; k < all[i].nhooks; k++) {
+            const struct hook_stat *h = &all[i].hooks[k];
+            calls += h->calls;
+            denied += h->denied;
+            ns += h->ns;
+            int t = 0;
+            while (t < ntot && strcmp(tot[t].name, h->name) != 0) t++;
+            if (t == ntot) {
+                if (ntot == MAX_STAT_HOOKS) continue;
+                snprintf(tot[ntot++].name, sizeof(tot[0].name), "%s", h->name);
+            }
+            tot[t].calls += h->calls;
+            tot[t].denied += h->denied;
+            tot[t].ns += h->ns;
+            for (int b = 0; b < STAT_BUCKETS; b++) tot[t].hist[b] += h->hist[b];
+        }
+        printf("%-8d %-8d %-6d %10llu %8llu %10.1f  %s\n", all[i].pid, all[i].ppid, all[i].active,
+               calls, denied, (double)ns / 1000.0, all[i].exe);
+        shown++;
+    }
+
+    printf("\n%-12s %10s %8s %10s %8s %8s %8s\n", "HOOK", "CALLS", "DENIED", "DECIDE_US", "AVG_NS", "P50_NS<", "P99_NS<");
+    for (int t = 0; t < ntot; t++) {
+        printf("%-12s %10llu %8llu %10.1f %8.1f %8llu %8llu\n", tot[t].name, tot[t].calls, tot[t].denied,
+               (double)tot[t].ns / 1000.0, tot[t].calls ? (double)tot[t].ns / (double)tot[t].calls : 0.0,
+               hist_quantile(tot[t].hist, 0.50), hist_quantile(tot[t].hist, 0.99));
+    }
+    if (vhits + vmisses)
+        printf("\nverdict cache: %llu of %llu candidate lookups hit (%.1f%%)\n", vhits, vhits + vmisses,
+               100.0 * (double)vhits / (double)(vhits + vmisses));
+    if (init_ns || waits)
+        printf("init: %.1f us in total, %llu caller(s) blocked %.1f us waiting for it\n",
+               (double)init_ns / 1000.0, waits, (double)wait_ns / 1000.0);
+    printf("\n%d process(es)\n", shown);
+    free(all);
+    return 0;
+}
+
+// --------- log ---------
+// Decodes the "<pid>.log" event files written with LIBNVIDIAHIDE_DEBUG=1
+// (format version 1) and prints them as one timeline.
+
+struct log_src {
+    int pid, ppid;
+    uint32_t nhooks;
+    char hooks[NH_LOG_MAX_HOOKS][16];
+    char exe[256];
+};
+
+struct log_rec {
+    uint64_t ts;
+    int src;
+    struct nh_log_event ev;
+    char *msg;              // NH_LOG_MSG: the reassembled line
+};
+
+struct log_set {
+    struct log_src *src;
+    int nsrc;
+    struct log_rec *rec;
+    size_t nrec, cap;
+};
+
+static struct log_rec *log_push(struct log_set *ls) {
+    if (ls->nrec == ls->cap) {
+        size_t cap = ls->cap ? ls->cap * 2 : 4096;
+        struct log_rec *nr = realloc(ls->rec, cap * sizeof(*nr));
+        if (!nr) return NULL;
+        ls->rec = nr;
+        ls->cap = cap;
+    }
+    return &ls->rec[ls->nrec++];
+}
+
+static void log_append_text(char **msg, const struct nh_log_event *ev) {
+    size_t have = *msg ? strlen(*msg) : 0, add = strnlen(ev->text, NH_LOG_TEXT);
+    char *m = realloc(*msg, have + add + 1);
+    if (!m) return;
+    memcpy(m + have, ev->text, add);
+    m[have + add] = 0;
+    *msg = m;
+}
+
+static int read_log_file(const char *path, struct log_set *ls) {
+    FILE *f = fopen(path, "re");
+    if (!f) return -1;
+    struct nh_log_header hd;
+    if (fread(&hd, sizeof(hd), 1, f) != 1 || hd.magic != NH_LOG_MAGIC || hd.version != NH_LOG_VERSION ||
+        hd.event_size != sizeof(struct nh_log_event)) {
+        fclose(f);
+        return -1;
+    }
+    struct log_src *ns = realloc(ls->src, (size_t)(ls->nsrc + 1) * sizeof(*ns));
+    if (!ns) { fclose(f); return -1; }
+    ls->src = ns;
+    struct log_src *s = &ls->src[ls->nsrc];
+    s->pid = hd.pid;
+    s->ppid = hd.ppid;
+    s->nhooks = hd.nhooks < NH_LOG_MAX_HOOKS ? hd.nhooks : NH_LOG_MAX_HOOKS;
+    memcpy(s->hooks, hd.hooks, sizeof(s->hooks));
+    for (int h = 0; h < NH_LOG_MAX_HOOKS; h++) s->hooks[h][sizeof(s->hooks[h]) - 1] = 0;
+    snprintf(s->exe, sizeof(s->exe), "%.*s", (int)sizeof(s->exe) - 1, hd.exe);
+
+    size_t first = ls->nrec;
+    struct nh_log_event ev;
+    while (fread(&ev, sizeof(ev), 1, f) == 1) {
+        if (ev.kind == NH_LOG_MSG && ev.hook > 0) {
+            // later chunk: find the line it continues (same thread and id, recent)
+            for (size_t i = ls->nrec, seen = 0; i > first && seen < 512; i--, seen++) {
+                struct log_rec *r = &ls->rec[i - 1];
+                if (r->ev.kind == NH_LOG_MSG && r->ev.tid == ev.tid && r->ev.hash == ev.hash) {
+                    log_append_text(&r->msg, &ev);
+                    break;
+                }
+            }
+            continue;
+        }
+        struct log_rec *r = log_push(ls);
+        if (!r) break;
+        r->ts = ev.ts_ns;
+        r->src = ls->nsrc;
+        r->ev = ev;
+        r->msg = NULL;
+        if (ev.kind == NH_LOG_MSG) log_append_text(&r->msg, &ev);
+    }
+    fclose(f);
+    ls->nsrc++;
+    return 0;
+}
+
+static int log_rec_cmp(const void *a, const void *b) {
+    const struct log_rec *x = a, *y = b;
+    if (x->ts != y->ts) return x->ts < y->ts ? -1 : 1;
+    return x->src - y->src;
+}
+
+static int log_in_tree(const struct log_set *ls, int pid, int root) {
+    for (int hops = 0; hops < ls->nsrc + 1; hops++) {
+        if (pid == root) return 1;
+        int parent = -1;
+        for (int i = 0; i < ls->nsrc; i++) if (ls->src[i].pid == pid) { parent = ls->src[i].ppid; break; }
+        if (parent <= 0 || parent == pid) return 0;
+        pid = parent;
+    }
+    return 0;
+}
+
+static int cmd_log(int argc, char **argv) {
+    char dir[PATH_MAX] = "";
+    int root = 0;
+    for (int i = 2; i < argc; i++) {
+        if (!strcmp(argv[i], "--dir") && i + 1 < argc) {
+            snprintf(dir, sizeof(dir), "%s", argv[++i]);
+        } else if (!strcmp(argv[i], "--pid") && i + 1 < argc) {
+            root = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "nvidia-hide: log: unexpected argument '%s'\n\n", argv[i]);
+            usage(stderr);
+            return 2;
+        }
+    }
+    if (!dir[0] && nh_runtime_path(dir, sizeof(dir), "log") != 0) {
+        fprintf(stderr, "nvidia-hide: log: XDG_RUNTIME_DIR not set; use --dir\n");
+        return 2;
+    }
+
+    DIR *d = opendir(dir);
+    if (!d) {
+        fprintf(stderr, "nvidia-hide: log: %s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+    struct log_set ls;
+    memset(&ls, 0, sizeof(ls));
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+        size_t len = strlen(e->d_name);
+        if (len < 5 || strcmp(e->d_name + len - 4, ".log") != 0) continue;
+        char path[PATH_MAX];
+        if (build_path(path, sizeof(path), dir, e->d_name) == 0) read_log_file(path, &ls);
+    }
+    closedir(d);
+    qsort(ls.rec, ls.nrec, sizeof(*ls.rec), log_rec_cmp);
+
+    // records refer to sources by index, so only the listing is sorted (by pid)
+    int shown = 0, *order = calloc((size_t)ls.nsrc + 1, sizeof(int));
+    if (!order) return 1;
+    for (int i = 0; i < ls.nsrc; i++) {
+        int j = i;
+        for (; j > 0 && ls.src[order[j - 1]].pid > ls.src[i].pid; j--) order[j] = order[j - 1];
+        order[j] = i;
+    }
+    printf("%-8s %-8s  %s\n", "PID", "PPID", "EXE");
+    for (int k = 0; k < ls.nsrc; k++) {
+        const struct log_src *s = &ls.src[order[k]];
+        if (root && !log_in_tree(&ls, s->pid, root)) continue;
+        printf("%-8d %-8d  %s\n", s->pid, s->ppid, s->exe);
+        shown++;
+    }
+    free(order);
+
+    printf("\n%12s %-8s %-8s %-11s %-5s %s\n", "TIME_S", "PID", "TID", "HOOK", "DENY", "PATH / MESSAGE");
+    uint64_t t0 = 0;
+    size_t events = 0;
+    for (size_t i = 0; i < ls.nrec; i++) {
+        const struct log_rec *r = &ls.rec[i];
+        const struct log_src *s = &ls.src[r->src];
+        if (root && !log_in_tree(&ls, s->pid, root)) continue;
+        if (!events++) t0 = r->ts;
+        double t = (double)(r->ts - t0) / 1e9;
+        switch (r->ev.kind) {
+        case NH_LOG_HOOK: {
+            const char *hook = r->ev.hook < s->nhooks ? s->hooks[r->ev.hook] : "?";
+            int n = (int)strnlen(r->ev.text, NH_LOG_TEXT);
+            printf("%12.6f %-8d %-8u %-11s %-5s %.*s", t, s->pid, r->ev.tid, hook,
+                   r->ev.verdict ? "yes" : "no", n, r->ev.text);
+            // elided paths: the hash tells equal ones apart
+            if (n == NH_LOG_TEXT && !memcmp(r->ev.text + 12, "..", 2))
+                printf("  #%08llx", (unsigned long long)(r->ev.hash & 0xffffffffu));
+            printf("\n");
+            break;
+        }
+        case NH_LOG_MSG:
+            printf("%12.6f %-8d %-8u %-11s %-5s %s\n", t, s->pid, r->ev.tid, "-", "", r->msg ? r->msg : "");
+            break;
+        case NH_LOG_DROP:
+            printf("%12.6f %-8d %-8s %-11s %-5s (%llu events dropped: ring full)\n", t, s->pid, "-", "-", "",
+                   (unsigned long long)r->ev.hash);
+            break;
+        }
+    }
+    printf("\n%d process(es), %zu event(s)\n", shown, events);
+
+    for (size_t i = 0; i < ls.nrec; i++) free(ls.rec[i].msg);
+    free(ls.rec);
+    free(ls.src);
+    return 0;
+}
+
+// --------- bench (dGPU wake / startup) ---------
+// Samples power/runtime_status of each NVIDIA BDF at a fixed interval while
+// the command starts. Resumes are counted from status transitions; active
+// time comes from the kernel's runtime_active_time counter, which also
+// covers wakeups shorter than the sampling interval.
+
+#define BENCH_STATUS_LEN 16
+
+struct bench_dev {
+    char bdf[32];
+    int status_fd;
+    char start[BENCH_STATUS_LEN];
+    unsigned long long active0, suspended0;
+};
+
+struct bench_result {
+    int resumes;
+    unsigned long long active_ms, suspended_ms;   // counter deltas
+    double sampled_active_ms;
+    double first_resume_ms;                        // < 0: never resumed
+};
+
+static double mono_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static int bench_read_status(int fd, char *out, size_t out_sz) {
+    ssize_t n = fd >= 0 ? pread(fd, out, out_sz - 1, 0) : -1;
+    if (n <= 0) { snprintf(out, out_sz, "unknown"); return -1; }
+    out[n] = 0;
+    nh_trim(out);
+    return 0;
+}
+
+static unsigned long long bench_read_counter(const char *bdf, const char *leaf) {
+    char path[PATH_MAX], buf[64];
+    snprintf(path, sizeof(path), "/sys/bus/pci/devices/%s/power/%s", bdf, leaf);
+    if (nh_read_file_raw(path, buf, sizeof(buf)) != 0) return 0;
+    return strtoull(buf, NULL, 10);
+}
+
+static int bench_is_active(const char *status) {
+    return !strcmp(status, "active") || !strcmp(status, "resuming");
+}
+
+static void bench_snap_counters(struct bench_dev *d) {
+    d->active0 = bench_read_counter(d->bdf, "runtime_active_time");
+    d->suspended0 = bench_read_counter(d->bdf, "runtime_suspended_time");
+    bench_read_status(d->status_fd, d->start, sizeof(d->start));
+}
+
+// Waits until every device has runtime-suspended again (bounded) so that
+// back-to-back runs start from the same state.
+static void bench_settle(struct bench_dev *devs, int n, double max_ms) {
+    double t_end = mono_ms() + max_ms;
+    while (mono_ms() < t_end) {
+        int busy = 0;
+        for (int i = 0; i < n; i++) {
+            char st[BENCH_STATUS_LEN];
+            bench_read_status(devs[i].status_fd, st, sizeof(st));
+            if (bench_is_active(st)) busy = 1;
+        }
+        if (!busy) return;
+        usleep(50 * 1000);
+    }
+    fprintf(stderr, "nvidia-hide: bench: device still active after %.0f s; starting anyway\n", max_ms / 1e3);
+}
+
+struct bench_opts {
+    double duration_ms;
+    double interval_ms;
+    const char *so_path;    // NULL: run without the preload
+};
+
+static void bench_kill_tree(pid_t pgid) {
+    kill(-pgid, SIGTERM);
+    for (int i = 0; i < 40; i++) {
+        if (waitpid(-pgid, NULL, WNOHANG) < 0 && errno == ECHILD) return;
+        usleep(50 * 1000);
+    }
+    kill(-pgid, SIGKILL);
+    while (waitpid(-pgid, NULL, 0) > 0) { }
+}
+
+// One measured run. Returns the child's pid (>0) on success.
+static int bench_run_once(char **cmd, const struct bench_opts *o, struct bench_dev *devs, int n,
+                          struct bench_result *res, double *exec_ms, double *exit_ms) {
+    memset(res, 0, (size_t)n * sizeof(*res));
+    char prev[NH_MAX_BDFS][BENCH_STATUS_LEN];
+    for (int i = 0; i < n; i++) {
+        bench_snap_counters(&devs[i]);
+        snprintf(prev[i], sizeof(prev[i]), "%s", devs[i].start);
+        res[i].first_resume_ms = -1;
+    }
+
+    // the write end closes on exec, so EOF on the read end marks the exec
+    int pfd[2];
+    if (pipe2(pfd, O_CLOEXEC) != 0) return -1;
+    double t_fork = mono_ms();
+    pid_t child = fork();
+    if (child < 0) { close(pfd[0]); close(pfd[1]); return -1; }
+    if (child == 0) {
+        close(pfd[0]);
+        setpgid(0, 0);
+        if (o->so_path) {
+            struct nh_topo topo;
+            set_preload(o->so_path);
+            set_audit(o->so_path);
+            if (export_snapshot(cmd[0], &topo)) export_vendor_lists();
+        }
+        execvp(cmd[0], cmd);
+        int err = errno;
+        if (write(pfd[1], &err, sizeof(err)) < 0) { }
+        _exit(127);
+    }
+    setpgid(child, child);
+    close(pfd[1]);
+    int err = 0;
+    ssize_t got = read(pfd[0], &err, sizeof(err));
+    close(pfd[0]);
+    double t_exec = mono_ms();
+    *exec_ms = t_exec - t_fork;
+    *exit_ms = -1;
+    if (got == (ssize_t)sizeof(err)) {
+        waitpid(child, NULL, 0);
+        fprintf(stderr, "nvidia-hide: bench: execvp(%s) failed: %s\n", cmd[0], strerror(err));
+        return -1;
+    }
+
+    double t_end = t_exec + o->duration_ms, t_last = t_exec;
+    int exited = 0;
+    for (;;) {
+        double now = mono_ms();
+        for (int i = 0; i < n; i++) {
+            char st[BENCH_STATUS_LEN];
+            bench_read_status(devs[i].status_fd, st, sizeof(st));
+            int on = bench_is_active(st), was = bench_is_active(prev[i]);
+            if (was) res[i].sampled_active_ms += now - t_last;
+            if (on && !was) {
+                res[i].resumes++;
+                if (res[i].first_resume_ms < 0) res[i].first_resume_ms = now - t_exec;
+            }
+            snprintf(prev[i], sizeof(prev[i]), "%s", st);
+        }
+        t_last = now;
+        if (!exited) {
+            int status;
+            if (waitpid(child, &status, WNOHANG) == child) {
+                exited = 1;
+                *exit_ms = now - t_exec;
+            }
+        }
+        if (now >= t_end) break;
+        double left = t_end - now, step = left < o->interval_ms ? left : o->interval_ms;
+        usleep((useconds_t)(step * 1e3));
+    }
+    bench_kill_tree(child);
+
+    for (int i = 0; i < n; i++) {
+        res[i].active_ms = bench_read_counter(devs[i].bdf, "runtime_active_time") - devs[i].active0;
+        res[i].suspended_ms = bench_read_counter(devs[i].bdf, "runtime_suspended_time") - devs[i].suspended0;
+    }
+    return child;
+}
+
+static void bench_print(const char *label, const struct bench_dev *devs, const struct bench_result *res,
+                        int n, double exec_ms, double exit_ms) {
+    for (int i = 0; i < n; i++) {
+        char first[32] = "-", exited[32] = "-";
+        if (res[i].first_resume_ms >= 0) snprintf(first, sizeof(first), "%.1f", res[i].first_resume_ms);
+        if (exit_ms >= 0) snprintf(exited, sizeof(exited), "%.1f", exit_ms);
+        printf("%-11s %-14s %-10s %7d %10llu %12llu %10.1f %10s %8.2f %9s\n",
+               label, devs[i].bdf, devs[i].start, res[i].resumes, res[i].active_ms, res[i].suspended_ms,
+               res[i].sampled_active_ms, first, exec_ms, exited);
+    }
+}
+
+static int cmd_bench(int argc, char **argv) {
+    struct bench_opts o = { 10e3, 1.0, NULL };
+    int no_preload = 0, compare = 0, i = 2;
+    struct nh_topo topo;
+    memset(&topo, 0, sizeof(topo));
+    for (; i < argc; i++) {
+        if (!strcmp(argv[i], "--duration") && i + 1 < argc) o.duration_ms = atof(argv[++i]) * 1e3;
+        else if (!strcmp(argv[i], "--interval") && i + 1 < argc) o.interval_ms = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--no-preload")) no_preload = 1;
+        else if (!strcmp(argv[i], "--compare")) compare = 1;
+        else if (!strcmp(argv[i], "--bdf") && i + 1 < argc) nh_topo_add_bdf(&topo, argv[++i]);
+        else if (!strcmp(argv[i], "--")) { i++; break; }
+        else if (argv[i][0] == '-') {
+            fprintf(stderr, "nvidia-hide: bench: unexpected argument '%s'\n\n", argv[i]);
+            usage(stderr);
+            return 2;
+        } else break;
+    }
+    if (i >= argc || o.duration_ms <= 0 || o.interval_ms <= 0) {
+        usage(stderr);
+        return 2;
+    }
+
+    char so_path[PATH_MAX];
+    if (!no_preload || compare) {
+        if (resolve_so_path(so_path, sizeof(so_path), argv[0]) != 0) {
+            fprintf(stderr, "nvidia-hide: could not find libnvidia-hide.so.\n");
+            return 1;
+        }
+    }
+    if (!topo.bdfs_n) nh_discover(&topo);
+    if (!topo.bdfs_n) {
+        fprintf(stderr, "nvidia-hide: bench: no NVIDIA PCI device discovered (use --bdf)\n");
+        return 1;
+    }
+
+    struct bench_dev devs[NH_MAX_BDFS];
+    int n = topo.bdfs_n;
+    for (int k = 0; k < n; k++) {
+        char path[PATH_MAX];
+        nh_bdf_format(devs[k].bdf, sizeof(devs[k].bdf), topo.bdfs[k]);
+        snprintf(path, sizeof(path), "/sys/bus/pci/devices/%s/power/runtime_status", devs[k].bdf);
+        devs[k].status_fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (devs[k].status_fd < 0)
+            fprintf(stderr, "nvidia-hide: bench: %s: %s\n", path, strerror(errno));
+    }
+
+    struct bench_run { const char *label; const char *so; } runs[2];
+    int nruns = 0;
+    if (compare || no_preload) runs[nruns++] = (struct bench_run){ "no-preload", NULL };
+    if (compare || !no_preload) runs[nruns++] = (struct bench_run){ "preload", so_path };
+
+    printf("# %s, %.1f s after exec, sampled every %.2f ms\n", argv[i], o.duration_ms / 1e3, o.interval_ms);
+    printf("%-11s %-14s %-10s %7s %10s %12s %10s %10s %8s %9s\n", "run", "bdf", "start", "resumes",
+           "active_ms", "suspended_ms", "sampled_ms", "first_ms", "exec_ms", "exit_ms");
+    int rc = 0;
+    for (int r = 0; r < nruns; r++) {
+        struct bench_result res[NH_MAX_BDFS];
+        double exec_ms, exit_ms;
+        if (r > 0) bench_settle(devs, n, 30e3);
+        o.so_path = runs[r].so;
+        if (bench_run_once(&argv[i], &o, devs, n, res, &exec_ms, &exit_ms) < 0) { rc = 1; break; }
+        bench_print(runs[r].label, devs, res, n, exec_ms, exit_ms);
+        fflush(stdout);
+    }
+    for (int k = 0; k < n; k++) if (devs[k].status_fd >= 0) close(devs[k].status_fd);
+    return rc;
+}
+
+// --------- learn ---------
+// The command runs under the preload exactly as with run, except that every
+// rule group is on and each process records its decisions. Afterwards each
+// recorded path, listing and dlopen is mapped to the groups that look at it
+// (by shape, not verdict, so a learning run on one GPU layout holds on
+// another) and the union per exe becomes its profile.
+
+struct learn_exe {
+    char exe[sizeof(((struct nh_rec_header*)0)->exe)];
+    unsigned rules;
+    int procs;
+    uint64_t recs;
+};
+
+struct learn_set {
+    struct learn_exe *v;
+    int n;
+};
+
+static struct nh_matcher g_learn_match;
+
+static unsigned learn_record(const char *hook, int dircls, int relative, const char *p) {
+    if (!strcmp(hook, "dlopen")) return nh_lib_is_nvidia(p) ? NH_RULE_DLOPEN : 0;
+    if (!strcmp(hook, "readdir") || !strcmp(hook, "readdir64") || !strcmp(hook, "getdents64") ||
+        !strcmp(hook, "scandir"))
+        return dircls >= 1 && dircls <= 4 ? NH_RULE_LS_DEV << (dircls - 1) : 0;
+    // relative names are judged by their directory and device number, whatever the profile
+    if (relative) return 0;
+    int root = nh_path_root(p);
+    return root == NH_ROOT_NONE ? 0 : nh_path_rules(&g_learn_match, p, root);
+}
+
+static int learn_read(const char *path, struct learn_set *ls) {
+    FILE *f = fopen(path, "re");
+    if (!f) return -1;
+    struct nh_rec_header hd;
+    if (fread(&hd, sizeof(hd), 1, f) != 1 || hd.magic != NH_REC_MAGIC || hd.version != NH_REC_VERSION ||
+        hd.nhooks > NH_LOG_MAX_HOOKS) {
+        fclose(f);
+        return -1;
+    }
+    hd.exe[sizeof(hd.exe) - 1] = 0;
+    for (uint32_t h = 0; h < hd.nhooks; h++) hd.hooks[h][sizeof(hd.hooks[h]) - 1] = 0;
+
+    struct learn_exe *e = NULL;
+    for (int i = 0; i < ls->n && !e; i++) if (!strcmp(ls->v[i].exe, hd.exe)) e = &ls->v[i];
+    if (!e) {
+        struct learn_exe *v = realloc(ls->v, (size_t)(ls->n + 1) * sizeof(*v));
+        if (!v) { fclose(f); return -1; }
+        ls->v = v;
+        e = &v[ls->n++];
+        memset(e, 0, sizeof(*e));
+        memcpy(e->exe, hd.exe, sizeof(e->exe));
+    }
+    e->procs++;
+
+    struct nh_rec r;
+    char p[PATH_MAX];
+    // a record cut short by a crash ends the file
+    while (fread(&r, sizeof(r), 1, f) == 1 && r.len < sizeof(p) && fread(p, 1, r.len, f) == r.len) {
+        p[r.len] = 0;
+        e->recs++;
+        if (r.hook < hd.nhooks) e->rules |= learn_record(hd.hooks[r.hook], r.dircls, r.relative, p);
+    }
+    fclose(f);
+    return 0;
+}
+
+static int learn_write(const struct learn_exe *e, int reset, char *path, size_t path_sz, unsigned *rules) {
+    *rules = e->rules;
+    unsigned old;
+    if (!reset && nh_profile_load(e->exe, &old) == 0) *rules |= old;
+
+    char dir[PATH_MAX], tmp[PATH_MAX], names[256];
+    nh_config_path(dir, sizeof(dir), "");
+    mkdir(dir, 0755);
+    nh_config_path(dir, sizeof(dir), "profiles");
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) return -1;
+    nh_profile_path(path, path_sz, e->exe);
+    if (snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid()) >= (int)sizeof(tmp)) return -1;
+
+    nh_rules_format(names, sizeof(names), *rules);
+    FILE *f = fopen(tmp, "we");
+    if (!f) return -1;
+    fprintf(f, "# written by nvidia-hide learn; groups not listed are not enforced\n"
+               "exe %s\nrules %s\n", e->exe, names);
+    if (fclose(f) != 0 || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+static void learn_cleanup(const char *dir) {
+    DIR *d = opendir(dir);
+    if (!d) return;
+    struct dirent *e;
+    char path[PATH_MAX];
+    while ((e = readdir(d)) != NULL)
+        if (e->d_name[0] != '.' && build_path(path, sizeof(path), dir, e->d_name) == 0) unlink(path);
+    closedir(d);
+    rmdir(dir);
+}
+
+static int cmd_learn(int argc, char **argv) {
+    int reset = 0, keep = 0, i = 2;
+    for (; i < argc; i++) {
+        if (!strcmp(argv[i], "--reset")) reset = 1;
+        else if (!strcmp(argv[i], "--keep")) keep = 1;
+        else if (!strcmp(argv[i], "--")) { i++; break; }
+        else if (argv[i][0] == '-') {
+            fprintf(stderr, "nvidia-hide: learn: unexpected argument '%s'\n\n", argv[i]);
+            usage(stderr);
+            return 2;
+        } else break;
+    }
+    if (i >= argc) {
+        fprintf(stderr, "nvidia-hide: learn: missing command\n\n");
+        usage(stderr);
+        return 2;
+    }
+
+    char so_path[PATH_MAX];
+    if (resolve_so_path(so_path, sizeof(so_path), argv[0]) != 0) {
+        fprintf(stderr, "nvidia-hide: could not find libnvidia-hide.so.\n");
+        return 1;
+    }
+    char dir[PATH_MAX];
+    if (nh_runtime_path(dir, sizeof(dir), NULL) == 0) mkdir(dir, 0700);
+    if (nh_runtime_path(dir, sizeof(dir), "learn.XXXXXX") != 0)
+        snprintf(dir, sizeof(dir), "/tmp/nvidia-hide-learn.XXXXXX");
+    if (!mkdtemp(dir)) {
+        fprintf(stderr, "nvidia-hide: learn: cannot create a recording dir: %s\n", strerror(errno));
+        return 1;
+    }
+
+    // what run sets up, with every group on for the whole tree
+    setenv("LIBNVIDIAHIDE_PROFILES", "0", 1);
+    setenv("LIBNVIDIAHIDE_RECORD", dir, 1);
+    if (set_preload(so_path) != 0) {
+        fprintf(stderr, "nvidia-hide: failed to set LD_PRELOAD: %s\n", strerror(errno));
+        return 1;
+    }
+    set_audit(so_path);
+    struct nh_topo topo;
+    if (export_snapshot(argv[i], &topo)) export_vendor_lists();
+
+    // daemonizing helpers stay ours, so their recordings are complete too
+    prctl(PR_SET_CHILD_SUBREAPER, 1, 0, 0, 0);
+    pid_t child = fork();
+    if (child < 0) {
+        fprintf(stderr, "nvidia-hide: learn: fork failed: %s\n", strerror(errno));
+        return 1;
+    }
+    if (child == 0) {
+        execvp(argv[i], &argv[i]);
+        fprintf(stderr, "nvidia-hide: execvp(%s) failed: %s\n", argv[i], strerror(errno));
+        _exit(127);
+    }
+    signal(SIGINT, SIG_IGN);    // ^C reaches the app; the profile is still written
+    int st, rc = 1;
+    pid_t w;
+    while ((w = wait(&st)) > 0 || errno == EINTR)
+        if (w == child) rc = WIFEXITED(st) ? WEXITSTATUS(st) : 128 + WTERMSIG(st);
+    unsetenv("LIBNVIDIAHIDE_PROFILES");
+
+    nh_matcher_build(&g_learn_match, NH_RULE_ALL);
+    struct learn_set ls = { NULL, 0 };
+    DIR *d = opendir(dir);
+    struct dirent *e;
+    while (d && (e = readdir(d)) != NULL) {
+        size_t len = strlen(e->d_name);
+        char path[PATH_MAX];
+        if (len > 4 && !strcmp(e->d_name + len - 4, ".rec") && build_path(path, sizeof(path), dir, e->d_name) == 0)
+            learn_read(path, &ls);
+    }
+    if (d) closedir(d);
+    if (!ls.n) fprintf(stderr, "nvidia-hide: learn: nothing was recorded (is the command dynamically linked?)\n");
+
+    for (int k = 0; k < ls.n; k++) {
+        char path[PATH_MAX], names[256];
+        unsigned rules;
+        if (!ls.v[k].exe[0]) continue;
+        // an empty profile would switch hiding off for every later run of the exe
+        if (!ls.v[k].rules) {
+            printf("nvidia-hide: learn: %s: touched nothing hidden, no profile (%d processes, %llu records)\n",
+                   ls.v[k].exe, ls.v[k].procs, (unsigned long long)ls.v[k].recs);
+            continue;
+        }
+        if (learn_write(&ls.v[k], reset, path, sizeof(path), &rules) != 0) {
+            fprintf(stderr, "nvidia-hide: learn: %s: cannot write profile: %s\n", ls.v[k].exe, strerror(errno));
+            rc = rc ? rc : 1;
+            continue;
+        }
+        nh_rules_format(names, sizeof(names), rules);
+        printf("nvidia-hide: learn: %s: %s (%d processes, %llu records) -> %s\n", ls.v[k].exe,
+               names, ls.v[k].procs, (unsigned long long)ls.v[k].recs, path);
+        // a path this run never took will not be hidden later
+        if (rules != NH_RULE_ALL) {
+            fflush(stdout);
+            nh_rules_format(names, sizeof(names), NH_RULE_ALL & ~rules);
+            fprintf(stderr, "nvidia-hide: learn: %s: warning: no longer enforcing %s "
+                            "(rerun learn to add groups, or delete the profile)\n", ls.v[k].exe, names);
+        }
+    }
+    free(ls.v);
+    if (keep) printf("nvidia-hide: learn: recordings kept in %s\n", dir);
+    else learn_cleanup(dir);
+    return rc;
+}
+
+// --------- daemon ---------
+// Owns daemon.shm: rescans on drm/pci uevents (debounced, nvidia-drm binds
+// several nodes in a burst) and keeps policy.bin in sync with the lists.
+
+#define DAEMON_DEBOUNCE_MS 250
+
+static volatile sig_atomic_t g_daemon_stop = 0;
+
+static void daemon_on_signal(int sig) {
+    (void)sig;
+    g_daemon_stop = 1;
+}
+
+// kernel uevents: "ACTION@DEVPATH\0KEY=VALUE\0..."
+static int uevent_relevant(const char *buf, size_t n) {
+    for (size_t off = 0; off < n; off += strlen(buf + off) + 1) {
+        const char *kv = buf + off;
+        if (!strcmp(kv, "SUBSYSTEM=drm") || !strcmp(kv, "SUBSYSTEM=pci")) return 1;
+    }
+    return 0;
+}
+
+static int uevent_socket(void) {
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+    if (fd < 0) return -1;
+    struct sockaddr_nl sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.nl_family = AF_NETLINK;
+    sa.nl_groups = 1;   // kernel broadcast group
+    if (bind(fd, (struct sockaddr*)&sa, sizeof(sa)) != 0) { close(fd); return -1; }
+    return fd;
+}
+
+static void daemon_compile_policy(void) {
+    char out[PATH_MAX];
+    nh_config_path(out, sizeof(out), "policy.bin");
+    int n_exact = 0, n_globs = 0;
+    if (nh_policy_compile(out, &n_exact, &n_globs) == 0)
+        printf("nvidia-hide: daemon: compiled %s (%d exact, %d glob patterns)\n", out, n_exact, n_globs);
+    else
+        fprintf(stderr, "nvidia-hide: daemon: could not write %s: %s\n", out, strerror(errno));
+}
+
+static void daemon_rescan(struct nh_shm *shm, struct nh_topo *cur, int force) {
+    struct nh_topo t;
+    nh_discover_scan(&t);
+    if (!force && !memcmp(&t, cur, sizeof(t))) return;
+    *cur = t;
+    nh_shm_publish(shm, cur);
+    char name[32];
+    printf("nvidia-hide: daemon: nvidia_nodes=%d nvidia_bdfs=%d\n", nh_topo_nodes_n(cur), cur->bdfs_n);
+    for (int k = 0; k < NH_NODE_TYPES; k++)
+        for (int bit = 0; bit < 64; bit++)
+            if ((cur->nodes[k] >> bit) & 1) { nh_node_format(name, sizeof(name), k, bit); printf("  node: %s\n", name); }
+    for (int i = 0; i < cur->bdfs_n; i++) { nh_bdf_format(name, sizeof(name), cur->bdfs[i]); printf("  bdf:  %s\n", name); }
+    fflush(stdout);
+}
+
+static int cmd_daemon(int argc, char **argv) {
+    (void)argv;
+    if (argc > 2) {
+        usage(stderr);
+        return 2;
+    }
+
+    int shm_fd;
+    struct nh_shm *shm = nh_shm_open_rw(&shm_fd);
+    if (!shm) {
+        fprintf(stderr, "nvidia-hide: daemon: cannot create the segment (is XDG_RUNTIME_DIR set?): %s\n",
+                strerror(errno));
+        return 1;
+    }
+    if (nh_shm_lock(shm_fd) != 0) {
+        fprintf(stderr, "nvidia-hide: daemon: already running\n");
+        return 1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = daemon_on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGHUP, &sa, NULL);
+
+    int uev = uevent_socket();
+    if (uev < 0)
+        fprintf(stderr, "nvidia-hide: daemon: no uevent socket (%s); hotplug will not be seen\n",
+                strerror(errno));
+
+    char cfg[PATH_MAX];
+    nh_config_path(cfg, sizeof(cfg), "");
+    int ino = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (ino >= 0 && inotify_add_watch(ino, cfg, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE) < 0) {
+        close(ino);
+        ino = -1;
+    }
+
+    struct nh_topo cur;
+    memset(&cur, 0, sizeof(cur));
+    daemon_rescan(shm, &cur, 1);
+    daemon_compile_policy();
+    __atomic_store_n(&shm->daemon_pid, (int32_t)getpid(), __ATOMIC_RELEASE);
+
+    double deadline = -1;   // pending rescan
+    while (!g_daemon_stop) {
+        struct pollfd pfd[2] = { { uev, POLLIN, 0 }, { ino, POLLIN, 0 } };
+        int timeout = -1;
+        if (deadline >= 0) {
+            double left = deadline - mono_ms();
+            timeout = left > 0 ? (int)left + 1 : 0;
+        }
+        int n = poll(pfd, 2, timeout);
+        if (n < 0 && errno != EINTR) break;
+
+        if (uev >= 0 && (pfd[0].revents & POLLIN)) {
+            char buf[8192];
+            ssize_t len;
+            while ((len = recv(uev, buf, sizeof(buf) - 1, 0)) > 0) {
+                buf[len] = 0;
+                if (uevent_relevant(buf, (size_t)len) && deadline < 0)
+                    deadline = mono_ms() + DAEMON_DEBOUNCE_MS;
+            }
+        }
+        if (ino >= 0 && (pfd[1].revents & POLLIN)) {
+            char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+            ssize_t len;
+            int lists = 0;
+            while ((len = read(ino, buf, sizeof(buf))) > 0) {
+                for (char *p = buf; p < buf + len; ) {
+                    struct inotify_event *ev = (struct inotify_event*)p;
+                    if (ev->len && (!strcmp(ev->name, "allowlist") || !strcmp(ev->name, "denylist")))
+                        lists = 1;
+                    p += sizeof(*ev) + ev->len;
+                }
+            }
+            if (lists) daemon_compile_policy();
+        }
+        if (deadline >= 0 && mono_ms() >= deadline) {
+            deadline = -1;
+            daemon_rescan(shm, &cur, 0);
+        }
+    }
+
+    // readers stop trusting the segment; the file stays for the next daemon
+    __atomic_store_n(&shm->daemon_pid, 0, __ATOMIC_RELEASE);
+    printf("nvidia-hide: daemon: exiting\n");
+    return 0;
+}
+
 int main(int argc, char **argv) {
     if (argc < 2) {
         usage(stderr);
@@ -137,13 +1838,25 @@ int main(int argc, char **argv) {
         return 0;
     }
 
+    if (strcmp(sub, "compile") == 0) return cmd_compile(argc, argv);
+    if (strcmp(sub, "learn") == 0) return cmd_learn(argc, argv);
+    if (strcmp(sub, "stats") == 0) return cmd_stats(argc, argv);
+    if (strcmp(sub, "log") == 0) return cmd_log(argc, argv);
+    if (strcmp(sub, "bench") == 0) return cmd_bench(argc, argv);
+    if (strcmp(sub, "daemon") == 0) return cmd_daemon(argc, argv);
+
     if (strcmp(sub, "run") != 0) {
         fprintf(stderr, "nvidia-hide: unknown subcommand '%s'\n\n", sub);
         usage(stderr);
         return 2;
     }
 
-    int cmd_i = 2;
+    int cmd_i = 2, supervise = 0;
+    for (; cmd_i < argc; cmd_i++) {
+        if (!strcmp(argv[cmd_i], "--supervise")) supervise = 1;
+        else if (!strcmp(argv[cmd_i], "--dispatch")) setenv("LIBNVIDIAHIDE_SUD", "1", 1);
+        else break;
+    }
     if (cmd_i < argc && strcmp(argv[cmd_i], "--") == 0) cmd_i++;
 
     if (cmd_i >= argc) {
@@ -163,6 +1876,11 @@ int main(int argc, char **argv) {
         fprintf(stderr, "nvidia-hide: failed to set LD_PRELOAD: %s\n", strerror(errno));
         return 1;
     }
+    set_audit(so_path);
+
+    struct nh_topo topo;
+    if (export_snapshot(argv[cmd_i], &topo)) export_vendor_lists();
+    if (supervise) return run_supervised(&argv[cmd_i], &topo);
 
     execvp(argv[cmd_i], &argv[cmd_i]);
     fprintf(stderr, "nvidia-hide: execvp(%s) failed: %s\n", argv[cmd_i], strerror(errno));